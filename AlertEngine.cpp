@@ -0,0 +1,87 @@
+/**
+ * @file      AlertEngine.cpp
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  Distance bands with hysteresis and the due messages.
+ */
+
+#include <Arduino.h>
+#include "AlertEngine.h"
+
+static const AlertBand *sBands = NULL;
+static uint8_t sBandCount = 0;
+static uint8_t sBand = 0;
+static uint8_t sAnnouncedBand = 0;  // Of the last confirmed message
+static uint32_t sLastMillis = 0;
+
+/*
+ * @return  false if the table is empty or too long, the engine then stays silent
+ */
+bool initAlert(const AlertBand *aBands, uint8_t aBandCount)
+{
+  if (aBandCount == 0 || aBandCount > ALERT_MAX_BANDS)
+    {
+      sBandCount = 0;
+      return false;
+    }
+  sBands = aBands;
+  sBandCount = aBandCount;
+  sBand = 0;
+  sAnnouncedBand = 0;
+  return true;
+}
+
+/*
+ * Once per radar frame, with the filtered distance and its closing velocity
+ * in cm/s (0 without tracker).
+ *
+ * @return  Urgency of the message due now, 0 if none
+ */
+uint8_t updateAlert(uint16_t aCentimeter, int16_t aClosingVelocity, uint32_t aNowMillis)
+{
+  if (sBandCount == 0)
+    return 0;
+
+  // Only an approach is extrapolated, never a moving away. The velocity
+  // above the noise counts, so the prediction does not jump at the threshold
+  int32_t tCentimeter = aCentimeter;
+  if (aClosingVelocity > ALERT_MIN_CLOSING_VELOCITY)
+    tCentimeter -= (int32_t)(aClosingVelocity - ALERT_MIN_CLOSING_VELOCITY) * ALERT_LOOKAHEAD_MILLIS / 1000;
+
+  // At most one pass over the table, in one direction
+  uint8_t tBand = sBand;
+  while (tBand + 1 < sBandCount && tCentimeter < sBands[tBand + 1].enterCentimeter)
+    tBand++;
+  if (tBand == sBand)
+    while (tBand > 0 && tCentimeter >= sBands[tBand].leaveCentimeter)
+      tBand--;
+
+  sBand = tBand;
+  if (tBand == 0)
+    return 0;                   // Out of range, silent
+  // Closer than the last message: at once, it cuts a message of a farther band.
+  // Otherwise, even back from out of range, after the period of the band
+  if (tBand > sAnnouncedBand || aNowMillis - sLastMillis >= sBands[tBand].periodMillis)
+    return tBand;
+  return 0;
+}
+
+/*
+ * The due message was started, the next one waits for the period
+ */
+void confirmAlert(uint32_t aNowMillis)
+{
+  sLastMillis = aNowMillis;
+  sAnnouncedBand = sBand;
+}
+
+uint8_t getAlertUrgency(void)
+{
+  return sBand;
+}
+
+uint16_t getAlertPeriod(void)
+{
+  return sBandCount ? sBands[sBand].periodMillis : 0;
+}
@@ -0,0 +1,45 @@
+/**
+ * @file      AlertEngine.h
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  Alert policy between the distance filter and the audio.  A table of
+ * distance bands, from out of range to the closest, gives the urgency and the
+ * period of the messages. A band is entered below its entry distance and left
+ * only at or above its exit distance, so the noise around a threshold does not
+ * flip the cadence. A fast approach is announced earlier: the distance used is
+ * the one predicted ALERT_LOOKAHEAD_MILLIS ahead.
+ *
+ * A message is due when the band is closer than the one of the last message,
+ * or when the period of the band elapsed since the last message. It stays due
+ * until confirmAlert(), so a busy player only delays it, and going back and
+ * forth between two bands does not repeat it. Constant time per radar frame,
+ * no card access.
+ */
+
+#ifndef ALERT_ENGINE_H_
+#define ALERT_ENGINE_H_
+
+#include <stdint.h>
+
+#define ALERT_MAX_BANDS  8
+
+// Closing velocity (cm/s) taken as noise of the tracker, only the excess is extrapolated
+#define ALERT_MIN_CLOSING_VELOCITY 30
+#define ALERT_LOOKAHEAD_MILLIS     1000
+
+struct AlertBand
+{
+  uint16_t enterCentimeter;   // Entered from a farther band below this
+  uint16_t leaveCentimeter;   // Left for a farther band at or above this
+  uint16_t periodMillis;      // Between two messages in this band
+};
+
+// aBands[0] is out of range, silent. The urgency is the index in the table
+bool initAlert(const AlertBand *aBands, uint8_t aBandCount);
+uint8_t updateAlert(uint16_t aCentimeter, int16_t aClosingVelocity, uint32_t aNowMillis);
+void confirmAlert(uint32_t aNowMillis);
+uint8_t getAlertUrgency(void);
+uint16_t getAlertPeriod(void);
+
+#endif // ALERT_ENGINE_H_
@@ -0,0 +1,164 @@
+/**
+ * @file      BlackBox.cpp
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  Log of the radar samples and alerts on the SD card.
+ */
+
+#include <Arduino.h>
+#include <SD.h>
+#include "BlackBox.h"
+
+static File sLogFile;
+static bool sIsOpen = false;
+
+// Records are added to sSectors[sFillSector], full sectors wait from sWriteSector on
+static uint8_t sSectors[BLACKBOX_SECTORS][512];
+static uint8_t sFillSector = 0;
+static uint16_t sFillOffset = 0;
+static uint8_t sWriteSector = 0;
+static uint16_t sWriteOffset = 0;   // Not 0 only for the first sector after boot
+static uint8_t sFullCount = 0;
+static uint8_t sUnsyncedSectors = 0;
+static uint16_t sSequence = 0;
+static uint16_t sDropCount = 0;
+static uint16_t sWriteMicros = BLACKBOX_WRITE_MICROS;   // Longest sector write or sync seen
+
+/*
+ * Open the log for appending, before anything plays.
+ * @return  false if the file cannot be opened, nothing is logged then
+ */
+bool beginBlackBox(void)
+{
+  sLogFile = SD.open(BLACKBOX_FILE, FILE_WRITE);
+  if (!sLogFile)
+    return false;
+  // Complete the sector left partial by the last boot, so that every later
+  // write is a whole, aligned sector. The gap is zeros, skipped by the decoder.
+  uint16_t tPartial = sLogFile.size() % 512;
+  memset(sSectors[0], 0, 512);
+  sWriteOffset = tPartial;
+  sFillOffset = ((tPartial + sizeof(BlackBoxRecord) - 1) / sizeof(BlackBoxRecord)) * sizeof(BlackBoxRecord);
+  sIsOpen = true;
+  return true;
+}
+
+/*
+ * Add a record, called from the tasks only. Never touches the card.
+ */
+void logBlackBox(uint16_t aRawCentimeter, uint16_t aCentimeter, uint16_t aPeriodMillis,
+                 uint8_t aAudioState, uint8_t aAlert)
+{
+  uint16_t tSequence = sSequence++;
+  if (!sIsOpen)
+    return;
+  if (sFullCount >= BLACKBOX_SECTORS)
+    {
+      sDropCount++;
+      return;
+    }
+
+  uint8_t *tSector = sSectors[sFillSector];
+  if (sFillOffset + sizeof(BlackBoxRecord) <= 512)
+    {
+      BlackBoxRecord *tRecord = (BlackBoxRecord *)&tSector[sFillOffset];
+      tRecord->sync = BLACKBOX_SYNC;
+      tRecord->alert = aAlert;
+      tRecord->sequence = tSequence;
+      tRecord->timeMillis = millis();
+      tRecord->rawCentimeter = aRawCentimeter;
+      tRecord->centimeter = aCentimeter;
+      tRecord->periodMillis = aPeriodMillis;
+      tRecord->audioState = aAudioState;
+
+      uint8_t tChecksum = 0;
+      const uint8_t *tBytes = (const uint8_t *)tRecord;
+      for (uint8_t i = 0; i < sizeof(BlackBoxRecord) - 1; i++)
+        tChecksum ^= tBytes[i];
+      tRecord->checksum = tChecksum;
+      sFillOffset += sizeof(BlackBoxRecord);
+    }
+
+  if (sFillOffset + sizeof(BlackBoxRecord) > 512)
+    {
+      // Sector full, the next one is free since sFullCount < BLACKBOX_SECTORS
+      memset(&tSector[sFillOffset], 0, 512 - sFillOffset);
+      sFullCount++;
+      sFillSector = (sFillSector + 1) % BLACKBOX_SECTORS;
+      sFillOffset = 0;
+    }
+}
+
+static void measureWrite(uint32_t aStartMicros)
+{
+  uint32_t tMicros = micros() - aStartMicros;
+  if (tMicros > sWriteMicros)
+    sWriteMicros = tMicros > 0xFFFF ? 0xFFFF : tMicros;
+}
+
+/*
+ * Write the full sectors, or update the file size, if the bus can be spared
+ * from the audio and the radio for the longest write seen. All full sectors
+ * in one grant when possible, else one. Retried on the next call.
+ * @param aAudioMicros  What a buffer of the player lasts, from
+ *                      TMRpcm::cardWaitMicros(). The time asked for is at
+ *                      most half of it, granted within a few calls
+ */
+void flushBlackBox(uint16_t aAudioMicros)
+{
+  if (!sIsOpen)
+    return;
+  uint16_t tBudget = sWriteMicros < aAudioMicros / 2 ? sWriteMicros : aAudioMicros / 2;
+  if (sFullCount > 0)
+    {
+      uint8_t tCount = sFullCount;
+      uint32_t tMicros = (uint32_t)tCount * tBudget;
+      if (tMicros > 0xFFFF || !pcmSpiAcquire(PCM_SPI_LOG, tMicros))
+        {
+          tCount = 1;
+          if (!pcmSpiAcquire(PCM_SPI_LOG, tBudget))
+            return;
+        }
+      uint16_t tBytes = 0;
+      for (uint8_t i = 0; i < tCount; i++)
+        {
+          uint32_t tStart = micros();
+          tBytes += sLogFile.write(&sSectors[sWriteSector][sWriteOffset], 512 - sWriteOffset);
+          measureWrite(tStart);
+          sWriteOffset = 0;
+          sWriteSector = (sWriteSector + 1) % BLACKBOX_SECTORS;
+        }
+      pcmSpiRelease(PCM_SPI_LOG, tBytes);
+      sFullCount -= tCount;
+      sUnsyncedSectors += tCount;
+    }
+  else if (sUnsyncedSectors >= BLACKBOX_SYNC_SECTORS)
+    {
+      // Directory entry and FAT, so that a power loss keeps the records
+      if (!pcmSpiAcquire(PCM_SPI_LOG, tBudget))
+        return;
+      uint32_t tStart = micros();
+      sLogFile.flush();
+      measureWrite(tStart);
+      pcmSpiRelease(PCM_SPI_LOG, 0);
+      sUnsyncedSectors = 0;
+    }
+}
+
+/*
+ * @return  Records lost because all sectors were waiting for the card
+ */
+uint16_t getBlackBoxDropCount(void)
+{
+  return sDropCount;
+}
+
+/*
+ * @return  Longest sector write seen, in micro seconds, before the clamp of
+ *          flushBlackBox()
+ */
+uint16_t getBlackBoxWriteMicros(void)
+{
+  return sWriteMicros;
+}
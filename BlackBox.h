@@ -0,0 +1,51 @@
+/**
+ * @file      BlackBox.h
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  Log of every radar sample, filter  output and alert decision on the
+ * SD card, for incident analysis. Records are  collected in RAM sectors  and
+ * the full ones are written only when pcmSpi grants the bus: both TMRpcm
+ * buffers full, no radio packet due and enough time left, see pcmSpi.h.
+ * The time asked for is the longest write measured so far, BLACKBOX_WRITE_MICROS
+ * at first, but at most half of what a TMRpcm buffer plays: more is never
+ * granted while a clip plays from the card. A card busy longer now and then
+ * (a cluster allocation) makes that buffer late. Nothing waits for the card,
+ * records are dropped when the sectors are all full. Decode on the host with
+ * tools/blackbox_decode.py.
+ */
+
+#ifndef BLACKBOX_H_
+#define BLACKBOX_H_
+
+#include <stdint.h>
+#include <TMRpcm.h>
+
+#define BLACKBOX_FILE           "BLACKBOX.BIN"    // Appended to at every boot
+#define BLACKBOX_SYNC           0xB5
+#define BLACKBOX_SECTORS        2         // 512 bytes of RAM each
+#define BLACKBOX_WRITE_MICROS   20000     // First estimate of one sector write (a cluster allocation), raised by the writes measured
+#define BLACKBOX_SYNC_SECTORS   16        // File size updated in the directory every 8 KB
+
+// Little endian, as written. 32 records per sector
+struct __attribute__((packed)) BlackBoxRecord
+{
+  uint8_t  sync;            // BLACKBOX_SYNC
+  uint8_t  alert;           // Urgency of the message started since the last sample, 0 if none
+  uint16_t sequence;        // Gaps are dropped records
+  uint32_t timeMillis;      // Goes back to 0 at a new boot
+  uint16_t rawCentimeter;
+  uint16_t centimeter;      // Filtered
+  uint16_t periodMillis;
+  uint8_t  audioState;      // As in TelemetryFrame
+  uint8_t  checksum;        // XOR of all previous bytes
+};
+
+bool beginBlackBox(void);
+void logBlackBox(uint16_t aRawCentimeter, uint16_t aCentimeter, uint16_t aPeriodMillis,
+                 uint8_t aAudioState, uint8_t aAlert);
+void flushBlackBox(uint16_t aAudioMicros);
+uint16_t getBlackBoxDropCount(void);
+uint16_t getBlackBoxWriteMicros(void);
+
+#endif // BLACKBOX_H_
@@ -10,32 +10,148 @@
 // Import libraries
 #include <Arduino.h>
 
+#include <avr/power.h>  // PRR, unused peripherals
 #include <SD.h>
 #include <SPI.h>        // SDcard SPI services
 #include "HCSR04.h"     // Radar
+#include "Scheduler.h"  // Cooperative tasks
+#include "DistanceFilter.h"
+#include "AlertEngine.h"    // Bands, cadence of the messages
+#include "Telemetry.h"  // Binary console frames
+#include "BlackBox.h"   // Log on the SD card
+#include "Haptic.h"     // Vibration motor
 #include <TMRpcm.h>     // Audio player
 
+// Trace events of the sketch, see tools/trace_decode.py
+#define TRACE_RADAR_RESULT (TRACE_USER + 0) // arg: filtered distance in 2 cm steps
+#define TRACE_ALERT        (TRACE_USER + 1) // arg: urgency
+#define TRACE_HAPTIC       (TRACE_USER + 2) // arg: urgency
+
 // Constantes
 
 // Card        pin
 // Mega2560    53
 // Uno         10
 #define SD_ChipSelectPin       53
+// SPI clock of the card, F_CPU / 2 as set by SD_FULLSPEED in pcmConfig.h
+const uint32_t sdSpiClock = F_CPU / 2;
 
 // Global variables
 
 // Audio variables
-char* audioFile = "atnobs.wav";
+char audioFile[] = "atnobs.wav";
 const int speakerPin = 46;
+// With an external RAM module on the XMEM interface of the Mega, the alert
+// clip is copied there once at boot and played without any SD access.
+//#define USE_XMEM_CLIPS
+#if defined(USE_XMEM_CLIPS)
+byte* const xmemClipStart = (byte*)0x2200;  // First address after internal RAM
+const unsigned int xmemClipSize = 0xDDFF;   // Up to the end of the 64 KB space
+#endif
+pcmClip* alertClip = NULL;                  // NULL: stream audioFile from SD
+// Spoken distance instead of the alert message, rounded down to 50 cm and
+// composed from word files played without gaps: "obstacle", "cinquante" "cm",
+// "un" "metre", "un" "metre" "cinquante". The files must be in the WAV index.
+//#define USE_SPOKEN_DISTANCE
+#if defined(USE_SPOKEN_DISTANCE)
+char wordObstacle[] = "OBSTACLE.WAV";
+char wordOne[] = "UN.WAV";
+char wordMeter[] = "METRE.WAV";
+char wordFifty[] = "CINQUANT.WAV";
+char wordCentimeter[] = "CM.WAV";
+#endif
+// Parking sensor like beeps generated by TMRpcm instead of the voice message:
+// higher pitch and shorter pauses when closer, continuous tone when very close.
+//#define USE_TONE_ALERT
+#if defined(USE_TONE_ALERT)
+const unsigned int toneMinFrequency = 500;  // Hz, at lengthCentimeterAlert
+const unsigned int toneMaxFrequency = 1500; // Hz, at contact
+const unsigned int toneBeepMillis = 60;
+const unsigned int tonePauseMillisPerCentimeter = 2;
+const int toneContinuousCentimeter = 20;
+#endif
+// Vibration motor on pin 2 (OC3B through a transistor), pulsed at each due
+// message from the radar task itself: the cue does not wait for the card
+// nor for the clip playing. TIMER3 makes the PWM, see Haptic.h.
+//#define USE_HAPTIC
+#if defined(USE_HAPTIC)
+#if PCM_FIXED_TIMER == 3 || RF_TIMER == 3
+#error "USE_HAPTIC needs TIMER3, set another PCM_FIXED_TIMER or RF_TIMER in pcmConfig.h"
+#endif
+// One to three short pulses from far to near, a long one when very close
+const HapticStep hapticFar[] = { { 160, 80 }, { 0, 0 } };
+const HapticStep hapticMiddle[] = { { 200, 80 }, { 0, 120 }, { 200, 80 }, { 0, 0 } };
+const HapticStep hapticNear[] = { { 255, 80 }, { 0, 100 }, { 255, 80 }, { 0, 100 }, { 255, 80 }, { 0, 0 } };
+const HapticStep hapticContact[] = { { 255, 400 }, { 0, 0 } };
+const HapticStep* const hapticPatterns[] = { NULL, hapticFar, hapticMiddle, hapticNear, hapticContact };
+#endif
 // Radar variables
+#if defined(USE_INPUT_CAPTURE_TIMER4)
+const uint8_t ECHO_IN_PIN = US_INPUT_CAPTURE_ECHO_IN_PIN; // ICP4, measured in hardware
+#else
 const uint8_t ECHO_IN_PIN = 4;
+#endif
 const uint8_t TRIGGER_OUT_PIN = 5;
+const unsigned int lengthCentimeterTimeout = 300; // cm
+const int lengthCentimeterAlert = 200;  // cm
+// Task periods (ms). A HC-SR04 ping needs ~20 ms to let the echoes vanish.
+const uint16_t radarTaskPeriod = 20;
+#if defined(USE_INPUT_CAPTURE_TIMER4)
+// Near obstacles are pinged up to every 5 ms, see adaptUSDistanceInputCapture()
+const uint16_t radarPollPeriod = 2;
+#else
+const uint16_t radarPollPeriod = radarTaskPeriod;
+#endif
+const uint16_t consoleTaskPeriod = 250;
+// Air temperature for the speed of sound, from a TMP36 (10 mV per degree,
+// 500 mV at 0 degree) on this analog pin. Without it 20 degree is assumed,
+// which reads 3.5 % too far at 0 degree.
+//#define TEMPERATURE_PIN A0
+#if defined(TEMPERATURE_PIN)
+const uint16_t temperatureTaskPeriod = 10000;
+#endif
+// Without any message for that long, the PWM output is stopped to save the
+// battery. The next message ramps it up again (about 75 ms).
+const uint32_t audioIdleMillis = 5000;
+// Binary frames of every radar sample on the console, instead of the text
+// lines. Decode with tools/telemetry_decode.py, which skips the text of the
+// 'l' card listing and of the errors.
+//#define USE_TELEMETRY
+// Every radar sample and alert logged to BLACKBOX.BIN, written only in the
+// gaps of the audio reads. Decode with tools/blackbox_decode.py.
+//#define USE_BLACKBOX
+
+// Median of 5 pings, then alpha = 0.5, beta = 0.125 per ping. The velocity in
+// cm/s assumes one ping per radarTaskPeriod, see getClosingVelocity().
+DistanceFilter<5, lengthCentimeterTimeout, 128, 32, radarTaskPeriod> distanceFilter;
+
+// Alert bands, 10 cm of hysteresis on each threshold. The urgency is the
+// index: 1 (far) to 4 (close), also the priority of the clip in the player.
+const AlertBand alertBands[] =
+{
+  // enter, leave (cm), period (ms)
+  { 0, 0, 4000 },                                             // Out of range
+  { lengthCentimeterAlert, lengthCentimeterAlert + 10, 4000 },
+  { 150, 160, 2000 },
+  { 100, 110, 1000 },
+  { 80, 90, 500 },
+};
+
+// Shared state between tasks
+int rawLengthCentimeter = 0;
+int lengthCentimeter = 0;       // filtered
+int intervalMessage = 4000;
+uint32_t lastMessageMillis = 0;
+byte alertDue = 0;              // Urgency of the message to start, 0 if none
+uint32_t lastRadarMicros = 0;
+#if defined(USE_HAPTIC)
+byte hapticAlert = 0;           // Urgency of the due message already felt
+#endif
+byte lastAlert = 0;             // Urgency of the message started since the last sample
+uint8_t audioTask;
 
 // Create objects (Memory instance)
 
-Sd2Card card;
-SdVolume volume;
-SdFile root;
 TMRpcm tmrpcm;
 
 // Program initialization
@@ -44,9 +160,16 @@ void setup()
 {
   pinMode(LED_BUILTIN, OUTPUT);
   setup_console();
+  setup_power();
   setup_sdcard();
   setup_audio();
+#if defined(USE_BLACKBOX)
+  if (!beginBlackBox())
+    Serial.println("error: no black box log");
+#endif
   setup_radar();
+  initAlert(alertBands, sizeof(alertBands) / sizeof(alertBands[0]));
+  setup_tasks();
 }
 
 /******************
@@ -54,17 +177,199 @@ void setup()
  ******************/
 void loop()
 {
-  /* --- Radar --- */
-  int lengthCentimeter = getUSDistanceAsCentiMeterWithCentimeterTimeout(300);
-  int lengthCentimeterAlert = 200;  // cm
-  int intervalMessage = getPeriod(lengthCentimeter);
+  // Never delay() here: each task runs on its own deadline, and the
+  // scheduler sleeps until the next interrupt when none is reached
+  runScheduler();
+}
+
+/*********/
+/* Tasks */
+/*********/
+void radar_task(void)
+{
+#if defined(USE_INPUT_CAPTURE_TIMER4)
+  // Pings are triggered by TIMER4, only fetch the latest result
+  unsigned int pulseMicros;
+  if (!getUSDistanceInputCaptureResult(&pulseMicros))
+    return;
+  // Next pings: short window around this distance, full range now and then
+  adaptUSDistanceInputCapture(pulseMicros);
+  if (pulseMicros == US_INPUT_CAPTURE_OUT_OF_WINDOW)
+    return; // Not a reading, the next ping sweeps the full range
+  rawLengthCentimeter = getCentimeterFromUSMicroSeconds(pulseMicros);
+#else
+  rawLengthCentimeter = getUSDistanceAsCentiMeterWithCentimeterTimeout(lengthCentimeterTimeout);
+#endif
+  lengthCentimeter = distanceFilter.update(rawLengthCentimeter);
+  PCM_TRACE(TRACE_RADAR_RESULT, min(lengthCentimeter / 2, 255));
+  alertDue = updateAlert(lengthCentimeter, getClosingVelocity(), millis());
+  intervalMessage = getAlertPeriod();
+#if defined(USE_HAPTIC)
+  // Once per due message, again if it becomes more urgent before it is sent
+  if (alertDue > hapticAlert)
+    {
+      playHaptic(hapticPatterns[alertDue]);
+      PCM_TRACE(TRACE_HAPTIC, alertDue);
+    }
+  hapticAlert = alertDue;
+#endif
+  uint8_t audioState = tmrpcm.getPriority() << TELEMETRY_AUDIO_PRIORITY_SHIFT;
+  if (tmrpcm.isPlaying())
+    audioState |= TELEMETRY_AUDIO_PLAYING;
+#if defined(USE_TELEMETRY)
+  sendTelemetry(rawLengthCentimeter, lengthCentimeter, intervalMessage, audioState,
+                getSchedulerSleepPercent());
+#endif
+#if defined(USE_TONE_ALERT)
+  // Only updates the running tone, no restart of the playback
+  sendTone(lengthCentimeter, lengthCentimeterAlert);
+  lastAlert = getAlertUrgency();
+#if defined(USE_HAPTIC)
+  // No audio task, the pulse is the message
+  if (alertDue)
+    confirmAlert(millis());
+#endif
+#endif
+#if defined(USE_BLACKBOX)
+  logBlackBox(rawLengthCentimeter, lengthCentimeter, intervalMessage, audioState, lastAlert);
+#endif
+  lastAlert = 0;
+#if !defined(USE_TONE_ALERT)
+  // Only a due message wakes the audio task: a closer band or the end of the
+  // period since the last message, see AlertEngine.h
+  if (alertDue)
+    setTaskDeadline(audioTask, millis());
+#endif
+}
+
+void audio_task(void)
+{
+  if (alertDue == 0)
+    return;
+  // A closer band cuts the clip playing for a farther one
+  if (tmrpcm.isPlaying() && !isMoreUrgent(alertDue))
+    return; // Still due, retried on next radar frame
+  sendMessage(lengthCentimeter, alertDue);
+  confirmAlert(millis());
+  lastMessageMillis = millis();
+  lastAlert = alertDue;
+  alertDue = 0;
+}
 
+void console_task(void)
+{
+  // Commands from the host
+  if (Serial.available())
+    switch (Serial.read())
+      {
+#if defined(ENABLE_TRACE)
+      case 't': // Binary dump of the latency trace
+        pcmTraceDump(Serial);
+        break;
+#endif
+      case 'l': // Files on the card, never while the player reads it
+        if (tmrpcm.isPlaying())
+          Serial.println("info: busy, playing");
+        else
+          {
+            File dir = SD.open("/");
+            list_card(dir, 0);
+            dir.close();
+          }
+        break;
+      }
+#if !defined(USE_TELEMETRY)
   // Debug :: Send data to the Serial Port
   Serial.print("info: Period = ");
   Serial.println(intervalMessage);
+  if (getAlertUrgency() == 0)
+    {
+      // Use Case :: Exception
+      //    info :: Out of range :: Long range
+      Serial.print("info: Longue distance, ");
+      Serial.print(lengthCentimeter);
+      Serial.println("cm");
+    }
+  else
+    {
+      // Use Case :: Nominal
+      //     Print message, for instance: cm=32
+      Serial.print("info: Cas nominal, ");
+      Serial.print("cm=");
+      Serial.println(lengthCentimeter);
+    }
+#if defined(PCM_STATS)
+  // Audio load, enabled in pcmConfig.h
+  pcmStats audioStats = tmrpcm.stats();
+  Serial.print("info: Audio underruns = ");
+  Serial.print(audioStats.underruns);
+  Serial.print(", refill max/avg us = ");
+  Serial.print(audioStats.refillMaxMicros);
+  Serial.print("/");
+  Serial.print(audioStats.refillAvgMicros);
+  Serial.print(", sample ISR max ticks = ");
+  Serial.print(audioStats.sampleMaxTicks);
+  Serial.print(", playing % = ");
+  Serial.println(audioStats.dutyPercent);
+#endif
+#if defined(SPI_STATS)
+  // Shared bus, enabled in pcmConfig.h. Clients: audio, radio, log
+  for (uint8_t i = 0; i < PCM_SPI_CLIENTS; i++)
+    {
+      pcmSpiStats spiStats = pcmSpiGetStats(i);
+      Serial.print("info: SPI client ");
+      Serial.print(i);
+      Serial.print(" transfers = ");
+      Serial.print(spiStats.transfers);
+      Serial.print(", bytes = ");
+      Serial.print(spiStats.bytes);
+      Serial.print(", busy us = ");
+      Serial.print(spiStats.busyMicros);
+      Serial.print(", wait max us = ");
+      Serial.print(spiStats.maxWaitMicros);
+      Serial.print(", refused = ");
+      Serial.println(spiStats.refused);
+    }
+#endif
+#if defined(USE_BLACKBOX)
+  Serial.print("info: Black box drops = ");
+  Serial.print(getBlackBoxDropCount());
+  Serial.print(", write max us = ");
+  Serial.println(getBlackBoxWriteMicros());
+#endif
+#endif // USE_TELEMETRY
+}
+
+void telemetry_task(void)
+{
+  // Only what fits in the UART buffer, never waits
+  flushTelemetry();
+}
+
+void blackbox_task(void)
+{
+  // The full sectors, when the player and the radio can spare the bus
+  flushBlackBox(tmrpcm.cardWaitMicros());
+}
 
-  /* --- Audio player --- */
-  sendMessage(lengthCentimeter, lengthCentimeterAlert, intervalMessage);
+#if defined(TEMPERATURE_PIN)
+void temperature_task(void)
+{
+  // 1 mV is 0.1 degree, the conversion factors change only with the reading
+  int16_t tenthCelsius = (int32_t)analogRead(TEMPERATURE_PIN) * 5000 / 1024 - 500;
+  setUSTemperature(tenthCelsius);
+}
+#endif
+
+// Called by the scheduler before the CPU sleeps
+bool idle_hook(void)
+{
+#if !defined(USE_TONE_ALERT)
+  if (tmrpcm.isOutputOn() && !tmrpcm.isPlaying()
+      && millis() - lastMessageMillis >= audioIdleMillis)
+    tmrpcm.disable(); // Ramps the output down, then stops the timer
+#endif
+  return true;
 }
 
 /*****************/
@@ -84,76 +389,61 @@ void setup_console(void)
 #endif
 }
 
+void setup_power(void)
+{
+  // Power down what the sketch does not use. Kept: TIMER0 (millis), TIMER4
+  // (radar), TIMER5 (audio on pin 46), SPI (SD card), USART0 (console), the
+  // ADC with a TEMPERATURE_PIN and TIMER3 with USE_HAPTIC.
+#if !defined(TEMPERATURE_PIN)
+  ADCSRA &= ~_BV(ADEN); // The ADC must be off before its clock is stopped
+  power_adc_disable();
+#endif
+  ACSR |= _BV(ACD);     // Analog comparator
+  power_twi_disable();
+  power_timer1_disable();
+  power_timer2_disable();
+#if !defined(USE_HAPTIC)
+  power_timer3_disable();
+#endif
+  power_usart1_disable();
+  power_usart2_disable();
+  power_usart3_disable();
+}
+
 void setup_sdcard(void)
 {
-  // Show message at the begining of SD card initialization
-  Serial.println("");
-  Serial.println("Initializing SD card ... ");
-  // Setup digital port SD_ChipSelectPin in output mode
+  // Single initialization, straight at the SD_FULLSPEED clock of the player.
+  // The card survey is the 'l' console command, see list_card().
   pinMode(SD_ChipSelectPin, OUTPUT);
-  // Call init service from Sd2Card library
-  if (!card.init(SPI_HALF_SPEED, SD_ChipSelectPin))
+  if (!SD.begin(sdSpiClock, SD_ChipSelectPin))
     {
       // Exception: Initialization failed
-      Serial.println("Initialization failed. Things to check:");
-      Serial.println("* is card inserted ?");
-      Serial.println("* Is your wiring correct ?");
-      Serial.println("* did you change the chipSelect pin to match your shield or module ?");
+      Serial.println("error: SD card init failed (card inserted ? wiring ? chip select pin ?)");
       return;
     }
-  // Print this message whether SD card initialization is successfully
-  Serial.println("Wiring is correct and a card is present.");
+}
 
-  if (!SD.begin(SD_ChipSelectPin))
+// Names and sizes of the files on the card, recursively. Diagnosis only, it
+// holds the scheduler while printing.
+void list_card(File aDir, uint8_t aDepth)
+{
+  for (File entry = aDir.openNextFile(); entry; entry = aDir.openNextFile())
     {
-      Serial.println("SD fail");
-      return;
+      for (uint8_t i = 0; i < aDepth; i++)
+        Serial.print("  ");
+      Serial.print(entry.name());
+      if (entry.isDirectory())
+        {
+          Serial.println("/");
+          list_card(entry, aDepth + 1);
+        }
+      else
+        {
+          Serial.print(" ");
+          Serial.println(entry.size());
+        }
+      entry.close();
     }
-
-  // Print the type of detected SD card
-  Serial.print("SD card type: ");
-  switch(card.type()) {
-  case SD_CARD_TYPE_SD1:
-    Serial.println("SD1");
-    break;
-  case SD_CARD_TYPE_SD2:
-    Serial.println("SD2");
-    break;
-  case SD_CARD_TYPE_SDHC:
-    Serial.println("SDHC");
-    break;
-  default:
-    Serial.println("Unknown");
-  }
-
-  // Try to open the 'volume'/'partition' - it should be FAT16 or FAT32
-  if (!volume.init(card)) {
-    Serial.println("Could not find FAT16/FAT32 partition.\nMake sure you've formatted the card");
-    return;
-  }
-
-  // Print the type and size of the first FAT-type volume
-  uint32_t volumesize;
-  Serial.print("\nVolume type is FAT");
-  Serial.println(volume.fatType(), DEC);
-  volumesize = volume.blocksPerCluster();    // Clusters are collections of blocks
-  volumesize *= volume.clusterCount();       // We'll have a lot of clusters
-  volumesize *= 512;                         // SD card blocks are always 512 bytes
-  Serial.print("Volume size (bytes): ");
-  Serial.println(volumesize);
-  Serial.print("Volume size (Kbytes): ");
-  volumesize /= 1024;
-  Serial.println(volumesize);
-  Serial.print("Volume size (Mbytes): ");
-  volumesize /= 1024;
-  Serial.println(volumesize);
-
-  Serial.println("\nFiles found on the card (name, date and size in bytes): ");
-  root.openRoot(volume);
-
-  // List all files in the card with date and size
-  root.ls(LS_R | LS_DATE | LS_SIZE);
-  delay(2000);
 }
 
 void setup_radar(void)
@@ -161,61 +451,153 @@ void setup_radar(void)
   /*********/
   /* Radar */
   /*********/
+#if defined(USE_INPUT_CAPTURE_TIMER4)
+  // Distance measurement, continuously triggered at radarTaskPeriod at most
+  startUSDistanceInputCapture(TRIGGER_OUT_PIN, US_DISTANCE_TIMEOUT_MICROS_FOR_3_METER,
+                              radarTaskPeriod * 1000U);
+#else
   initUSDistancePins(TRIGGER_OUT_PIN, ECHO_IN_PIN); // Distance measurement
+#endif
 
 #if defined(TEENSYDUINO) // Add-on Teensyduino for Arduino's software (SDK)
   pinMode(5, OUTPUT);
   digitalWrite(5, HIGH); // Enable Amplified PROP shield
 #endif
-  delay(1000);
+}
+
+void setup_tasks(void)
+{
+  addTask(radar_task, radarPollPeriod);
+#if !defined(USE_TONE_ALERT)
+  // Woken up by radar_task() when a message is due
+  audioTask = addTask(audio_task, intervalMessage);
+#endif
+  addTask(console_task, consoleTaskPeriod);
+#if defined(USE_TELEMETRY)
+  addTask(telemetry_task, 0);
+#endif
+#if defined(USE_BLACKBOX)
+  addTask(blackbox_task, 0);
+#endif
+#if defined(TEMPERATURE_PIN)
+  addTask(temperature_task, temperatureTaskPeriod);
+#endif
+#if defined(USE_HAPTIC)
+  if (!beginHaptic())
+    Serial.println("error: no task left for the haptic output");
+#endif
+  setIdleCallback(idle_hook);
 }
 
 void setup_audio(void)
 {
   tmrpcm.speakerPin = speakerPin; // 5,6,11 or 46 on Mega, 9 on Uno, Nano, etc
+  // Header info of the WAV files, read from the card or rebuilt if missing
+  Serial.print("WAV files indexed: ");
+  Serial.println(tmrpcm.buildIndex(false));
+#if defined(USE_XMEM_CLIPS)
+  XMCRA = _BV(SRE); // Enable external memory interface
+  alertClip = tmrpcm.loadClip(audioFile, xmemClipStart, xmemClipSize);
+  if (alertClip == NULL)
+    Serial.println("Clip preload failed, playing from SD card");
+#endif
   // Complimentary Output or Dual Speakers:
   // pinMode(10,OUTPUT); Pin pairs: 9,10 Mega: 5-2,6-7,11-12,46-45
+#if defined(USE_TONE_ALERT)
+  // Start the output once, silent until an obstacle is in range
+  tmrpcm.playTone(0, 0, 0);
+#endif
 }
 
-void sendSound(void)
+void sendSound(byte urgency)
 {
-  // Send warning message.
-  tmrpcm.play(audioFile);
-  while (tmrpcm.isPlaying()) {} // Wait until file is played
-  tmrpcm.stopPlayback(); // Wait 1sec and stop
+  // Send warning message. Playback runs from the TMRpcm interrupts and the
+  // file is closed by the library at its end, so do not wait for it here.
+  if (alertClip != NULL)
+    tmrpcm.play(alertClip, urgency); // Cuts a less urgent one at the next buffer
+  else
+    tmrpcm.play(audioFile);
 }
 
-int getPeriod(int lengthCentimeter)
+// Of the tracker, scaled to the actual time between two radar results: the
+// adaptive pings come faster than the radarTaskPeriod the filter assumes
+int16_t getClosingVelocity(void)
 {
-  if (lengthCentimeter >= 150)
-    return 4000;
-  else if (lengthCentimeter >= 100)
-    return 2000;
-  else if (lengthCentimeter >= 80)
-    return 1000;
-  else
-    return 500;
+  uint32_t now = micros();
+  uint32_t interval = now - lastRadarMicros;
+  lastRadarMicros = now;
+  if (interval == 0 || interval > 4UL * radarTaskPeriod * 1000)
+    return 0; // First result or after a gap, no usable rate
+  return (int32_t)distanceFilter.getClosingVelocity() * (radarTaskPeriod * 1000L) / (int32_t)interval;
 }
 
-void sendMessage(int lengthCentimeter, int lengthCentimeterAlert, int intervalMessage)
+// Only a clip in memory can be cut in, the SD file always plays to its end
+bool isMoreUrgent(byte urgency)
 {
-  if (lengthCentimeter >= lengthCentimeterAlert)
-    {
-      // Use Case :: Exception
-      //    info :: Out of range :: Long range
-      Serial.print("info: Longue distance, ");
-      Serial.print(lengthCentimeter);
-      Serial.println("cm");
+#if defined(USE_SPOKEN_DISTANCE)
+  (void)urgency;
+  return false; // Sentences are read from the card too
+#else
+  return alertClip != NULL && tmrpcm.isPlaying()
+    && urgency > tmrpcm.getPriority();
+#endif
+}
+
+// The band and the cadence are decided by the alert engine, see radar_task()
+void sendMessage(int lengthCentimeter, byte urgency)
+{
+  PCM_TRACE(TRACE_ALERT, urgency);
+#if defined(USE_SPOKEN_DISTANCE)
+  if (sendSpeech(lengthCentimeter))
+    return;
+#else
+  (void)lengthCentimeter;   // Only spoken
+#endif
+  sendSound(urgency);
+}
 
+#if defined(USE_SPOKEN_DISTANCE)
+// One playlist per message, so the words follow without any gap
+bool sendSpeech(int lengthCentimeter)
+{
+  char* words[4];
+  byte count = 0;
+  int halfMeters = lengthCentimeter / 50; // 0 to 3 in range
+  if (halfMeters > 3)
+    halfMeters = 3; // Hysteresis of the far band, up to 2 m 10
+  words[count++] = wordObstacle;
+  if (halfMeters >= 2)
+    {
+      words[count++] = wordOne;
+      words[count++] = wordMeter;
+      if (halfMeters == 3)
+        words[count++] = wordFifty;
     }
-  else
+  else if (halfMeters == 1)
     {
-      // Use Case :: Nominal
-      //     Print message, for instance: cm=32
-      Serial.print("info: Cas nominal, ");
-      Serial.print("cm=");
-      Serial.println(lengthCentimeter);
-      sendSound();
+      words[count++] = wordFifty;
+      words[count++] = wordCentimeter;
     }
-  delay(intervalMessage);
-}
\ No newline at end of file
+  return tmrpcm.playlist(words, count);
+}
+#endif
+
+#if defined(USE_TONE_ALERT)
+void sendTone(int lengthCentimeter, int lengthCentimeterAlert)
+{
+  if (lengthCentimeter >= lengthCentimeterAlert)
+    {
+      // Use Case :: Exception
+      //    info :: Out of range :: Silence
+      tmrpcm.playTone(0, 0, 0);
+      return;
+    }
+  // Use Case :: Nominal
+  unsigned int frequency = map(lengthCentimeter, 0, lengthCentimeterAlert,
+                               toneMaxFrequency, toneMinFrequency);
+  unsigned int pauseMillis = 0; // Continuous
+  if (lengthCentimeter > toneContinuousCentimeter)
+    pauseMillis = lengthCentimeter * tonePauseMillisPerCentimeter;
+  tmrpcm.playTone(frequency, toneBeepMillis, pauseMillis);
+}
+#endif
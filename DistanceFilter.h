@@ -0,0 +1,158 @@
+/**
+ * @file      DistanceFilter.h
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  Filter stage between the HC-SR04 readings and the alert logic.
+ * A running median over a small window removes single spurious echoes and
+ * timeouts,  an optional  alpha-beta  tracker smooths  the  result  and
+ * estimates the closing velocity. Integer only, no allocation, the constants
+ * are template parameters so that the compiler can fold them.
+ */
+
+#ifndef DISTANCE_FILTER_H_
+#define DISTANCE_FILTER_H_
+
+#include <stdint.h>
+
+/*
+ * Median of the last WindowSize samples. The window is kept twice: in order
+ * of arrival to know the oldest sample, and sorted to read the median.
+ * Cost per sample is bounded by WindowSize moves, which is constant.
+ */
+template<uint8_t WindowSize>
+class RunningMedian
+{
+  static_assert(WindowSize > 0 && (WindowSize & 1), "WindowSize must be odd");
+
+public:
+  RunningMedian() : count(0), oldest(0) {}
+
+  uint16_t update(uint16_t aSample)
+  {
+    uint8_t i;
+    if (count < WindowSize)
+      {
+        i = count++;
+      }
+    else
+      {
+        // Remove the oldest sample, the hole is filled by shifting down
+        uint16_t tOldest = history[oldest];
+        for (i = 0; sorted[i] != tOldest; i++) {}
+        for (; i < WindowSize - 1; i++)
+          sorted[i] = sorted[i + 1];
+      }
+    history[oldest] = aSample;
+    if (++oldest >= WindowSize)
+      oldest = 0;
+
+    // Insert sorted, i is the index of the free slot at the end
+    while (i > 0 && sorted[i - 1] > aSample)
+      {
+        sorted[i] = sorted[i - 1];
+        i--;
+      }
+    sorted[i] = aSample;
+    return sorted[count / 2];
+  }
+
+  void reset(void) { count = 0; oldest = 0; }
+
+private:
+  uint16_t history[WindowSize];
+  uint16_t sorted[WindowSize];
+  uint8_t  count;
+  uint8_t  oldest;
+};
+
+/*
+ * Fixed gain Kalman filter  (alpha-beta) for  a constant  velocity  model.
+ * Position is in 1/16 cm, velocity in 1/16 cm per sample and the gains are
+ * in 1/256. PeriodMillis is the sample period, used only to report cm/s.
+ */
+template<uint8_t AlphaQ8, uint8_t BetaQ8, uint16_t PeriodMillis>
+class AlphaBetaTracker
+{
+  static_assert(1000 % PeriodMillis == 0, "PeriodMillis must divide one second");
+
+public:
+  AlphaBetaTracker() : position(0), velocity(0), isInitialized(false) {}
+
+  uint16_t update(uint16_t aCentimeter)
+  {
+    int16_t tMeasure = (int16_t)(aCentimeter << 4);
+    if (!isInitialized)
+      {
+        position = tMeasure;
+        velocity = 0;
+        isInitialized = true;
+      }
+    else
+      {
+        int16_t tPredicted = position + velocity;
+        int16_t tResidual = tMeasure - tPredicted;
+        position = tPredicted + (int16_t)(((int32_t)AlphaQ8 * tResidual) >> 8);
+        velocity += (int16_t)(((int32_t)BetaQ8 * tResidual) >> 8);
+        if (position < 0)
+          position = 0;
+      }
+    return (uint16_t)(position + 8) >> 4;
+  }
+
+  /*
+   * @return  Positive when the obstacle comes closer
+   */
+  int16_t getClosingVelocity(void)
+  {
+    return (int16_t)(((int32_t)-velocity * (1000 / PeriodMillis)) >> 4);
+  }
+
+  void reset(void) { isInitialized = false; }
+
+private:
+  int16_t position;
+  int16_t velocity;
+  bool    isInitialized;
+};
+
+/*
+ * The complete stage. A value of 0 (timeout) is replaced by NoEchoCentimeter
+ * before filtering, since a timeout means that nothing is in range. With
+ * AlphaQ8 = 0 the tracker code is optimized away and only the median is used.
+ */
+template<uint8_t WindowSize, uint16_t NoEchoCentimeter,
+         uint8_t AlphaQ8 = 0, uint8_t BetaQ8 = 0, uint16_t PeriodMillis = 20>
+class DistanceFilter
+{
+public:
+  uint16_t update(uint16_t aCentimeter)
+  {
+    if (aCentimeter == 0 || aCentimeter > NoEchoCentimeter)
+      aCentimeter = NoEchoCentimeter;
+    uint16_t tMedian = median.update(aCentimeter);
+    if (AlphaQ8 == 0)
+      return tMedian;
+    return tracker.update(tMedian);
+  }
+
+  /*
+   * @return  Closing velocity in cm/s, 0 without tracker
+   */
+  int16_t getClosingVelocity(void)
+  {
+    return (AlphaQ8 == 0) ? 0 : tracker.getClosingVelocity();
+  }
+
+  void reset(void)
+  {
+    median.reset();
+    tracker.reset();
+  }
+
+private:
+  RunningMedian<WindowSize> median;
+  AlphaBetaTracker<AlphaQ8, BetaQ8, PeriodMillis> tracker;
+};
+
+#endif // DISTANCE_FILTER_H_
@@ -3,6 +3,7 @@
  *
  *  US Sensor (HC-SR04) functions.
  *  The non blocking functions are using pin change interrupts and need the PinChangeInterrupt library to be installed.
+ *  On the Mega, the input capture functions are using TIMER4 and measure the echo pulse in hardware.
  *
  *  58,23 us per centimeter and 17,17 cm/ms (forth and back).
  *
@@ -55,27 +56,53 @@
 
 #include <Arduino.h>
 #include "HCSR04.h"
+#include <pcmTrace.h> // Latency trace of the TMRpcm library, empty if not enabled
 
 //#define DEBUG
 
+#if defined(ENABLE_TRACE)
+/*
+ * Distance in 2 cm steps for the trace record, 116.5 us per 2 cm
+ */
+static inline uint8_t getTraceArgFromUSMicroSeconds(unsigned int aPulseMicros) {
+    unsigned int tArg = aPulseMicros / 117;
+    return (tArg > 255) ? 255 : tArg;
+}
+#endif
+
 uint8_t sTriggerOutPin; // also used as aTriggerOutEchoInPin for 1 pin mode
 uint8_t sEchoInPin;
 
 uint8_t sHCSR04Mode = HCSR04_MODE_UNITITIALIZED;
 
 /*
+ * Common init for the single sensor functions below and for the HCSR04Array
  * @param aEchoInPin - If 0 then assume 1 pin mode
  */
-void initUSDistancePins(uint8_t aTriggerOutPin, uint8_t aEchoInPin) {
-    sTriggerOutPin = aTriggerOutPin;
+void initUSDistanceSensor(HCSR04Sensor *aSensor, uint8_t aTriggerOutPin, uint8_t aEchoInPin) {
+    aSensor->TriggerOutPin = aTriggerOutPin;
     if (aEchoInPin == 0) {
-        sHCSR04Mode = HCSR04_MODE_USE_1_PIN;
+        aSensor->EchoInPin = aTriggerOutPin;
+        aSensor->Mode = HCSR04_MODE_USE_1_PIN;
     } else {
-        sEchoInPin = aEchoInPin;
+        aSensor->EchoInPin = aEchoInPin;
         pinMode(aTriggerOutPin, OUTPUT);
-        pinMode(sEchoInPin, INPUT);
-        sHCSR04Mode = HCSR04_MODE_USE_2_PINS;
+        pinMode(aEchoInPin, INPUT);
+        aSensor->Mode = HCSR04_MODE_USE_2_PINS;
+    }
+}
+
+/*
+ * @param aEchoInPin - If 0 then assume 1 pin mode
+ */
+void initUSDistancePins(uint8_t aTriggerOutPin, uint8_t aEchoInPin) {
+    HCSR04Sensor tSensor;
+    initUSDistanceSensor(&tSensor, aTriggerOutPin, aEchoInPin);
+    sTriggerOutPin = tSensor.TriggerOutPin;
+    if (tSensor.Mode == HCSR04_MODE_USE_2_PINS) {
+        sEchoInPin = tSensor.EchoInPin;
     }
+    sHCSR04Mode = tSensor.Mode;
 }
 /*
  * Using this determines one pin mode
@@ -96,6 +123,7 @@ unsigned int getUSDistance(unsigned int aTimeoutMicros) {
 
 // need minimum 10 usec Trigger Pulse
     digitalWrite(sTriggerOutPin, HIGH);
+    PCM_TRACE(TRACE_US_TRIGGER, 0);
 
     if (sHCSR04Mode == HCSR04_MODE_USE_1_PIN) {
         // do it AFTER digitalWrite to avoid spurious triggering by just switching pin to output
@@ -139,16 +167,58 @@ unsigned int getUSDistance(unsigned int aTimeoutMicros) {
 #else
     unsigned long tUSPulseMicros = pulseInLong(tEchoInPin, HIGH, aTimeoutMicros);
 #endif
+    PCM_TRACE(TRACE_US_ECHO, getTraceArgFromUSMicroSeconds(tUSPulseMicros));
     return tUSPulseMicros;
 }
 
+/*
+ * Speed of sound in 0.1 m/s: 331.3 m/s at 0 degree plus 0.606 m/s per degree.
+ * Both conversion factors are only computed when the temperature changes, so a reading costs one multiplication.
+ */
+#define US_SOUND_SPEED_DECIMETER_PER_SECOND(aTenthCelsius) (3313 + ((aTenthCelsius) * 606L) / 1000)
+// Centimeter per micro second (forth and back) in Q16: c / 200000 with c in dm/s
+#define US_CENTIMETER_PER_MICRO_Q16(aSpeed) ((((aSpeed) * 65536L) + 100000L) / 200000L)
+// Micro seconds per centimeter (forth and back) in Q8: 200000 / c
+#define US_MICROS_PER_CENTIMETER_Q8(aSpeed) ((51200000L + ((aSpeed) / 2)) / (aSpeed))
+
+int16_t sUSTenthCelsius = US_DEFAULT_TENTH_CELSIUS;
+uint16_t sUSCentimeterPerMicroQ16 = US_CENTIMETER_PER_MICRO_Q16(US_SOUND_SPEED_DECIMETER_PER_SECOND(US_DEFAULT_TENTH_CELSIUS));
+uint16_t sUSMicrosPerCentimeterQ8 = US_MICROS_PER_CENTIMETER_Q8(US_SOUND_SPEED_DECIMETER_PER_SECOND(US_DEFAULT_TENTH_CELSIUS));
+
+/*
+ * @param aTenthCelsius - Air temperature in 1/10 degree, limited to -40 to 85 degree
+ */
+void setUSTemperature(int16_t aTenthCelsius) {
+    if (aTenthCelsius < -400) {
+        aTenthCelsius = -400;
+    } else if (aTenthCelsius > 850) {
+        aTenthCelsius = 850;
+    }
+    if (aTenthCelsius == sUSTenthCelsius) {
+        return;
+    }
+    long tSpeed = US_SOUND_SPEED_DECIMETER_PER_SECOND(aTenthCelsius);
+    sUSTenthCelsius = aTenthCelsius;
+    sUSCentimeterPerMicroQ16 = US_CENTIMETER_PER_MICRO_Q16(tSpeed);
+    sUSMicrosPerCentimeterQ8 = US_MICROS_PER_CENTIMETER_Q8(tSpeed);
+}
+
+int16_t getUSTemperature() {
+    return sUSTenthCelsius;
+}
+
 unsigned int getCentimeterFromUSMicroSeconds(unsigned int aDistanceMicros) {
-    // The reciprocal of formula in getUSDistanceAsCentiMeterWithCentimeterTimeout()
-    return (aDistanceMicros * 100L) / 5825;
+    // The reciprocal of getUSMicroSecondsFromCentimeter(), rounded
+    return ((uint32_t) aDistanceMicros * sUSCentimeterPerMicroQ16 + 0x8000) >> 16;
+}
+
+unsigned int getUSMicroSecondsFromCentimeter(unsigned int aCentimeter) {
+    uint32_t tMicros = ((uint32_t) aCentimeter * sUSMicrosPerCentimeterQ8 + 0x80) >> 8;
+    return (tMicros > 0xFFFF) ? 0xFFFF : tMicros;
 }
 
 /*
- * @return  Distance in centimeter @20 degree (time in us/58.25)
+ * @return  Distance in centimeter at the temperature of setUSTemperature() (time in us/58.25 at 20 degree)
  *          0 if timeout or pins are not initialized
  *
  *          timeout of 5825 micros is equivalent to 1 meter
@@ -158,11 +228,9 @@ unsigned int getUSDistanceAsCentiMeter(unsigned int aTimeoutMicros) {
     return (getCentimeterFromUSMicroSeconds(getUSDistance(aTimeoutMicros)));
 }
 
-// 58,23 us per centimeter (forth and back)
+// 58,23 us per centimeter (forth and back) at 20 degree
 unsigned int getUSDistanceAsCentiMeterWithCentimeterTimeout(unsigned int aTimeoutCentimeter) {
-// The reciprocal of formula in getCentimeterFromUSMicroSeconds()
-    unsigned int tTimeoutMicros = ((aTimeoutCentimeter * 233L) + 2) / 4; // = * 58.25 (rounded by using +1)
-    return getUSDistanceAsCentiMeter(tTimeoutMicros);
+    return getUSDistanceAsCentiMeter(getUSMicroSecondsFromCentimeter(aTimeoutCentimeter));
 }
 
 /*
@@ -297,4 +365,241 @@ bool isUSDistanceMeasureFinished() {
     }
     return false;
 }
-#endif // USE_PIN_CHANGE_INTERRUPT_D0_TO_D7 ...
\ No newline at end of file
+#endif // USE_PIN_CHANGE_INTERRUPT_D0_TO_D7 ...
+#if defined(USE_INPUT_CAPTURE_TIMER4)
+/*
+ * The INPUT CAPTURE version does not wait at all.
+ * TIMER4 runs in CTC mode with a period of one measurement cycle at 0.5 us resolution.
+ * Compare A (start of cycle) sets the trigger pin, compare B clears it 10 us later.
+ * The echo pulse edges are timestamped in hardware by ICP4, so interrupt latency
+ * (e.g. by the TMRpcm interrupts) has no influence on the result.
+ * Each cycle publishes exactly one result, 0 for timeout, in a single producer mailbox.
+ * check with: if (getUSDistanceInputCaptureResult(&tPulseMicros)) {<use tPulseMicros>};
+ */
+#define US_INPUT_CAPTURE_TICKS_PER_MICRO    2   // F_CPU / 8 prescaler
+#define US_INPUT_CAPTURE_TRIGGER_TICKS      (10 * US_INPUT_CAPTURE_TICKS_PER_MICRO)
+
+#define US_CAPTURE_STATE_WAIT_FOR_RISING    0
+#define US_CAPTURE_STATE_WAIT_FOR_FALLING   1
+#define US_CAPTURE_STATE_FINISHED           2
+
+/*
+ * Written only by the ISR, which cannot be interrupted by the reader.
+ * So incrementing the sequence after writing the value is sufficient to detect a torn read.
+ */
+struct USCaptureMailbox {
+    volatile uint8_t Sequence;
+    volatile unsigned int PulseMicros;
+};
+USCaptureMailbox sUSCaptureMailbox;
+uint8_t sUSCaptureLastReadSequence;
+
+volatile uint8_t *sTriggerOutPort;
+uint8_t sTriggerOutBitMask;
+volatile uint8_t sUSCaptureState;
+unsigned int sUSCaptureStartTicks;
+unsigned int sUSCaptureTimeoutTicks;
+unsigned int sUSCaptureFullTimeoutMicros;   // As given to startUSDistanceInputCapture()
+unsigned int sUSCaptureFullCycleMicros;
+// Timing requested by setUSDistanceInputCaptureTiming(), applied by the ISR at the start of the next cycle
+volatile bool sUSCaptureTimingPending;
+unsigned int sUSCapturePendingTimeoutTicks;
+unsigned int sUSCapturePendingCycleTicks;
+
+static inline void publishUSCaptureResult(unsigned int aPulseMicros) {
+    sUSCaptureMailbox.PulseMicros = aPulseMicros;
+    sUSCaptureMailbox.Sequence++;
+}
+
+static inline void publishUSCaptureTimeout() {
+    // A timeout of a narrowed window does not mean that nothing is in range
+    if (sUSCaptureTimeoutTicks < sUSCaptureFullTimeoutMicros * US_INPUT_CAPTURE_TICKS_PER_MICRO) {
+        publishUSCaptureResult(US_INPUT_CAPTURE_OUT_OF_WINDOW);
+    } else {
+        publishUSCaptureResult(0);
+    }
+}
+
+/*
+ * @param aTimeoutMicros - Longer echo pulses are reported as 0 (timeout)
+ * @param aCycleMicros - Time between two trigger pulses, must be longer than aTimeoutMicros
+ */
+void startUSDistanceInputCapture(uint8_t aTriggerOutPin, unsigned int aTimeoutMicros, unsigned int aCycleMicros) {
+    initUSDistancePins(aTriggerOutPin, US_INPUT_CAPTURE_ECHO_IN_PIN);
+    sTriggerOutPort = portOutputRegister(digitalPinToPort(aTriggerOutPin));
+    sTriggerOutBitMask = digitalPinToBitMask(aTriggerOutPin);
+
+    if (aCycleMicros > US_INPUT_CAPTURE_MAX_CYCLE_MICROS) {
+        aCycleMicros = US_INPUT_CAPTURE_MAX_CYCLE_MICROS;
+    }
+    if (aTimeoutMicros > aCycleMicros) {
+        aTimeoutMicros = aCycleMicros;
+    }
+    sUSCaptureTimeoutTicks = aTimeoutMicros * US_INPUT_CAPTURE_TICKS_PER_MICRO;
+    sUSCaptureFullTimeoutMicros = aTimeoutMicros;
+    sUSCaptureFullCycleMicros = aCycleMicros;
+    sUSCaptureTimingPending = false;
+    sUSCaptureState = US_CAPTURE_STATE_FINISHED;
+    sUSCaptureLastReadSequence = sUSCaptureMailbox.Sequence;
+
+    noInterrupts();
+    TCCR4A = 0;
+    TCCR4B = 0;
+    TCNT4 = 0;
+    OCR4A = (aCycleMicros * US_INPUT_CAPTURE_TICKS_PER_MICRO) - 1;
+    OCR4B = US_INPUT_CAPTURE_TRIGGER_TICKS;
+    TIFR4 = _BV(ICF4) | _BV(OCF4A) | _BV(OCF4B); // clear any outstanding interrupt
+    TIMSK4 = _BV(ICIE4) | _BV(OCIE4A) | _BV(OCIE4B);
+    // CTC mode with OCR4A as top, noise canceler, rising edge first, prescaler 8
+    TCCR4B = _BV(ICNC4) | _BV(ICES4) | _BV(WGM42) | _BV(CS41);
+    interrupts();
+}
+
+void stopUSDistanceInputCapture() {
+    TCCR4B = 0;
+    TIMSK4 = 0;
+    *sTriggerOutPort &= ~sTriggerOutBitMask;
+}
+
+/*
+ * Change the timeout and the cycle from the start of the next cycle on, without stopping the measurements.
+ * Limited like in startUSDistanceInputCapture(), and the timeout to the one given there.
+ */
+void setUSDistanceInputCaptureTiming(unsigned int aTimeoutMicros, unsigned int aCycleMicros) {
+    if (aCycleMicros > US_INPUT_CAPTURE_MAX_CYCLE_MICROS) {
+        aCycleMicros = US_INPUT_CAPTURE_MAX_CYCLE_MICROS;
+    }
+    if (aTimeoutMicros > sUSCaptureFullTimeoutMicros) {
+        aTimeoutMicros = sUSCaptureFullTimeoutMicros;
+    }
+    if (aTimeoutMicros > aCycleMicros) {
+        aTimeoutMicros = aCycleMicros;
+    }
+    noInterrupts();
+    sUSCapturePendingTimeoutTicks = aTimeoutMicros * US_INPUT_CAPTURE_TICKS_PER_MICRO;
+    sUSCapturePendingCycleTicks = aCycleMicros * US_INPUT_CAPTURE_TICKS_PER_MICRO;
+    sUSCaptureTimingPending = true;
+    interrupts();
+}
+
+/*
+ * Policy for the next ping, from the last two results. Only the main loop calls it.
+ */
+static unsigned int sUSAdaptiveLastPulseMicros = 0;    // 0: unknown, next ping sweeps the full range
+static uint8_t sUSAdaptiveCycles = 0;
+
+void adaptUSDistanceInputCapture(unsigned int aPulseMicros) {
+    unsigned int tLastPulseMicros = sUSAdaptiveLastPulseMicros;
+    bool tIsEcho = (aPulseMicros != 0 && aPulseMicros != US_INPUT_CAPTURE_OUT_OF_WINDOW);
+    sUSAdaptiveLastPulseMicros = tIsEcho ? aPulseMicros : 0;
+
+    if (!tIsEcho || tLastPulseMicros == 0 || ++sUSAdaptiveCycles >= US_ADAPTIVE_SWEEP_CYCLES) {
+        // Nothing to predict from, or time for a periodic sweep
+        sUSAdaptiveCycles = 0;
+        setUSDistanceInputCaptureTiming(sUSCaptureFullTimeoutMicros, sUSCaptureFullCycleMicros);
+        return;
+    }
+
+    // Constant speed: the next echo is shorter by as much as the last one was
+    unsigned int tPredictedMicros = aPulseMicros;
+    unsigned int tGuardMicros = US_ADAPTIVE_GUARD_MICROS;
+    if (aPulseMicros < tLastPulseMicros) {
+        unsigned int tClosingMicros = tLastPulseMicros - aPulseMicros;
+        tPredictedMicros = (tClosingMicros < aPulseMicros) ? aPulseMicros - tClosingMicros : 0;
+        tGuardMicros = US_ADAPTIVE_GUARD_CLOSING_MICROS;
+    } else {
+        // Getting farther: leave room for the same step again
+        tPredictedMicros += aPulseMicros - tLastPulseMicros;
+    }
+    // 25 % for the noise of the readings, plus a fixed margin for the near range
+    unsigned long tTimeoutMicros = tPredictedMicros + (tPredictedMicros >> 2) + US_ADAPTIVE_MARGIN_MICROS;
+    if (tTimeoutMicros > sUSCaptureFullTimeoutMicros) {
+        tTimeoutMicros = sUSCaptureFullTimeoutMicros;
+    }
+    unsigned long tCycleMicros = tTimeoutMicros + tGuardMicros;
+    if (tCycleMicros < US_ADAPTIVE_MIN_CYCLE_MICROS) {
+        tCycleMicros = US_ADAPTIVE_MIN_CYCLE_MICROS;
+    }
+    if (tCycleMicros > sUSCaptureFullCycleMicros) {
+        tCycleMicros = sUSCaptureFullCycleMicros;
+    }
+    setUSDistanceInputCaptureTiming(tTimeoutMicros, tCycleMicros);
+}
+
+/*
+ * @return true if a new result was published since the last call. Results of intermediate cycles are dropped.
+ */
+bool getUSDistanceInputCaptureResult(unsigned int *aPulseMicros) {
+    uint8_t tSequence;
+    unsigned int tPulseMicros;
+    do {
+        tSequence = sUSCaptureMailbox.Sequence;
+        tPulseMicros = sUSCaptureMailbox.PulseMicros;
+    } while (tSequence != sUSCaptureMailbox.Sequence);
+
+    if (tSequence == sUSCaptureLastReadSequence) {
+        return false;
+    }
+    sUSCaptureLastReadSequence = tSequence;
+    *aPulseMicros = tPulseMicros;
+    return true;
+}
+
+/*
+ * Start of cycle
+ */
+ISR(TIMER4_COMPA_vect) {
+    if (sUSCaptureState != US_CAPTURE_STATE_FINISHED) {
+        // No or too long echo in last cycle
+        publishUSCaptureTimeout();
+    }
+    if (sUSCaptureTimingPending) {
+        // The counter was just cleared, so the new top cannot be missed
+        OCR4A = sUSCapturePendingCycleTicks - 1;
+        sUSCaptureTimeoutTicks = sUSCapturePendingTimeoutTicks;
+        sUSCaptureTimingPending = false;
+    }
+    TCCR4B |= _BV(ICES4);
+    TIFR4 = _BV(ICF4);
+    if (*portInputRegister(digitalPinToPort(US_INPUT_CAPTURE_ECHO_IN_PIN)) & digitalPinToBitMask(US_INPUT_CAPTURE_ECHO_IN_PIN)) {
+        // Module is still busy with the echo of the last trigger, it would ignore a new one
+        sUSCaptureState = US_CAPTURE_STATE_FINISHED;
+        return;
+    }
+    sUSCaptureState = US_CAPTURE_STATE_WAIT_FOR_RISING;
+// need minimum 10 usec Trigger Pulse
+    *sTriggerOutPort |= sTriggerOutBitMask;
+    PCM_TRACE(TRACE_US_TRIGGER, 0);
+}
+
+/*
+ * Falling edge of trigger pulse starts measurement after 400/600 microseconds (old/new modules)
+ */
+ISR(TIMER4_COMPB_vect) {
+    *sTriggerOutPort &= ~sTriggerOutBitMask;
+}
+
+ISR(TIMER4_CAPT_vect) {
+    unsigned int tCaptureTicks = ICR4;
+    if (sUSCaptureState == US_CAPTURE_STATE_WAIT_FOR_RISING) {
+        // start of pulse
+        sUSCaptureStartTicks = tCaptureTicks;
+        sUSCaptureState = US_CAPTURE_STATE_WAIT_FOR_FALLING;
+        TCCR4B &= ~_BV(ICES4);
+    } else if (sUSCaptureState == US_CAPTURE_STATE_WAIT_FOR_FALLING) {
+        // end of pulse, the counter is reset only at start of cycle, so no overflow can happen here
+        unsigned int tPulseTicks = tCaptureTicks - sUSCaptureStartTicks;
+        sUSCaptureState = US_CAPTURE_STATE_FINISHED;
+        TCCR4B |= _BV(ICES4);
+        if (tPulseTicks > sUSCaptureTimeoutTicks) {
+            tPulseTicks = 0;
+            publishUSCaptureTimeout();
+        } else {
+            publishUSCaptureResult(tPulseTicks / US_INPUT_CAPTURE_TICKS_PER_MICRO);
+        }
+        PCM_TRACE(TRACE_US_ECHO, getTraceArgFromUSMicroSeconds(tPulseTicks / US_INPUT_CAPTURE_TICKS_PER_MICRO));
+    }
+    // Clear the flag possibly set by changing the edge
+    TIFR4 = _BV(ICF4);
+}
+#endif // USE_INPUT_CAPTURE_TIMER4
@@ -41,10 +41,25 @@
 #define US_DISTANCE_TIMEOUT_MICROS_FOR_2_METER 11650 // Timeout of 11650 is 2 meter
 #define US_DISTANCE_TIMEOUT_MICROS_FOR_3_METER 17475 // Timeout of 17475 is 3 meter
 
+struct HCSR04Sensor {
+    uint8_t TriggerOutPin; // also used as aTriggerOutEchoInPin for 1 pin mode
+    uint8_t EchoInPin;
+    uint8_t Mode;
+};
+
+void initUSDistanceSensor(HCSR04Sensor *aSensor, uint8_t aTriggerOutPin, uint8_t aEchoInPin = 0);
 void initUSDistancePins(uint8_t aTriggerOutPin, uint8_t aEchoInPin = 0);
 void initUSDistancePin(uint8_t aTriggerOutEchoInPin); // Using this determines one pin mode
 unsigned int getUSDistance(unsigned int aTimeoutMicros = US_DISTANCE_DEFAULT_TIMEOUT_MICROS);
+/*
+ * Speed of sound compensation, 20 degree if never set. The Mega has no internal temperature sensor, so the
+ * temperature comes from an external one. Only a change recomputes the conversion factors.
+ */
+#define US_DEFAULT_TENTH_CELSIUS 200
+void setUSTemperature(int16_t aTenthCelsius);
+int16_t getUSTemperature();
 unsigned int getCentimeterFromUSMicroSeconds(unsigned int aDistanceMicros);
+unsigned int getUSMicroSecondsFromCentimeter(unsigned int aCentimeter);
 unsigned int getUSDistanceAsCentiMeter(unsigned int aTimeoutMicros = US_DISTANCE_DEFAULT_TIMEOUT_MICROS);
 unsigned int getUSDistanceAsCentiMeterWithCentimeterTimeout(unsigned int aTimeoutCentimeter);
 void testUSSensor(uint16_t aSecondsToTest);
@@ -59,6 +74,44 @@ extern unsigned int sUSDistanceCentimeter;
 extern volatile unsigned long sUSPulseMicros;
 #endif
 
+/*
+ * Non blocking version using the input capture of TIMER4 (Mega only).
+ * The echo output of the module must be connected to ICP4 (pin 49).
+ * TIMER4 must not be used by anything else, e.g. the TMRpcm library, see DISABLE_TIMER4 in pcmConfig.h.
+ * Comment out to use TIMER4 for other things.
+ */
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+#define USE_INPUT_CAPTURE_TIMER4
+#endif
+
+#if defined(USE_INPUT_CAPTURE_TIMER4)
+#define US_INPUT_CAPTURE_ECHO_IN_PIN            49      // ICP4
+#define US_INPUT_CAPTURE_DEFAULT_CYCLE_MICROS   20000   // 50 Hz, let the US pulse of 3.43 meter vanish
+#define US_INPUT_CAPTURE_MAX_CYCLE_MICROS       32000   // 16 bit timer at 0.5 us resolution
+
+void startUSDistanceInputCapture(uint8_t aTriggerOutPin, unsigned int aTimeoutMicros = US_DISTANCE_DEFAULT_TIMEOUT_MICROS,
+        unsigned int aCycleMicros = US_INPUT_CAPTURE_DEFAULT_CYCLE_MICROS);
+void stopUSDistanceInputCapture();
+bool getUSDistanceInputCaptureResult(unsigned int *aPulseMicros);
+void setUSDistanceInputCaptureTiming(unsigned int aTimeoutMicros, unsigned int aCycleMicros);
+
+/*
+ * Adaptive ranging: after each result, the next pings only wait for an echo in a window around the predicted distance
+ * and come at a higher rate, the closer and the faster the obstacle approaches. Every US_ADAPTIVE_SWEEP_CYCLES pings
+ * and after a miss, one ping uses the full timeout and cycle of startUSDistanceInputCapture() again.
+ * A timeout in a narrowed window is reported as US_INPUT_CAPTURE_OUT_OF_WINDOW instead of 0, since it does not mean
+ * that nothing is in range.
+ */
+#define US_INPUT_CAPTURE_OUT_OF_WINDOW          0xFFFF
+#define US_ADAPTIVE_SWEEP_CYCLES                16
+#define US_ADAPTIVE_MARGIN_MICROS               1165    // 20 cm beyond the predicted echo
+#define US_ADAPTIVE_GUARD_MICROS                4000    // From the end of the window to the next trigger, to let late echoes vanish
+#define US_ADAPTIVE_GUARD_CLOSING_MICROS        2000    // The same when the obstacle comes closer
+#define US_ADAPTIVE_MIN_CYCLE_MICROS            5000    // 200 pings per second
+
+void adaptUSDistanceInputCapture(unsigned int aPulseMicros);
+#endif
+
 #define HCSR04_MODE_UNITITIALIZED   0
 #define HCSR04_MODE_USE_1_PIN       1
 #define HCSR04_MODE_USE_2_PINS      2
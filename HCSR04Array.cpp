@@ -0,0 +1,281 @@
+/*
+ *  HCSR04Array.cpp
+ *
+ *  Non blocking measurement of an array of US Sensors (HC-SR04).
+ *  The echo pulses of the active group are timestamped in the PCINT2 (port K) interrupt with micros().
+ *
+ *  Crosstalk rejection:
+ *  - Only echo pins of the active group are evaluated, so late echoes of another group are ignored.
+ *  - The next group is triggered after a guard time plus a small pseudo random delay,
+ *    so echoes of other sensors do not show up at the same distance in consecutive frames.
+ *  - A sudden jump to a much closer distance is only published if the next frame confirms it.
+ *
+ *  The refresh rate of the whole array is one slot (the echo time + guard time) per group,
+ *  instead of 20 ms per sensor for sequential blocking reads.
+ */
+
+#include <Arduino.h>
+#include "HCSR04Array.h"
+
+#if defined(USE_HCSR04_ARRAY)
+
+volatile uint8_t sArrayActiveMask;  // echo pins evaluated by the ISR
+volatile uint8_t sArrayStartedMask; // rising edge seen
+volatile uint8_t sArrayDoneMask;    // falling edge seen, pulse is valid
+uint8_t sArrayLastPortState;
+unsigned long sArrayEchoStartMicros[HCSR04_ARRAY_MAX_SENSORS];
+unsigned int sArrayEchoPulseMicros[HCSR04_ARRAY_MAX_SENSORS]; // indexed by bit of port K
+
+ISR (PCINT2_vect) {
+    unsigned long tMicros = micros();
+    uint8_t tPortState = PINK;
+    uint8_t tChanged = (tPortState ^ sArrayLastPortState) & sArrayActiveMask;
+    sArrayLastPortState = tPortState;
+
+    uint8_t tBitMask = 1;
+    for (uint8_t i = 0; tChanged != 0; ++i, tBitMask <<= 1) {
+        if (tChanged & tBitMask) {
+            tChanged &= ~tBitMask;
+            if (tPortState & tBitMask) {
+                // start of pulse
+                sArrayEchoStartMicros[i] = tMicros;
+                sArrayStartedMask |= tBitMask;
+            } else if (sArrayStartedMask & tBitMask) {
+                // end of pulse, ignore further edges of this pin in this slot
+                sArrayEchoPulseMicros[i] = tMicros - sArrayEchoStartMicros[i];
+                sArrayDoneMask |= tBitMask;
+                sArrayActiveMask &= ~tBitMask;
+            }
+        }
+    }
+}
+
+HCSR04Array::HCSR04Array(unsigned int aTimeoutMicros, unsigned int aGuardMicros) {
+    TimeoutMicros = aTimeoutMicros;
+    GuardMicros = aGuardMicros;
+    SensorCount = 0;
+    GroupCount = 0;
+    SlotIsActive = false;
+    FrameMicros = 0;
+    DitherState = 0xACE1;
+}
+
+/*
+ * @param aEchoInPin - If 0 then assume 1 pin mode
+ * @param aGroup - Sensors with the same group are triggered together
+ * @return Index of sensor in the distance vector or HCSR04_ARRAY_INVALID_SENSOR if echo pin is not on port K or array is full
+ */
+uint8_t HCSR04Array::addSensor(uint8_t aTriggerOutPin, uint8_t aEchoInPin, uint8_t aGroup) {
+    uint8_t tEchoInPin = (aEchoInPin == 0) ? aTriggerOutPin : aEchoInPin;
+    if (SensorCount >= HCSR04_ARRAY_MAX_SENSORS || digitalPinToPCICR(tEchoInPin) == 0
+            || digitalPinToPCICRbit(tEchoInPin) != PCIE2) {
+        return HCSR04_ARRAY_INVALID_SENSOR;
+    }
+    initUSDistanceSensor(&Sensors[SensorCount], aTriggerOutPin, aEchoInPin);
+    EchoBitMask[SensorCount] = bit(digitalPinToPCMSKbit(tEchoInPin));
+    SensorGroup[SensorCount] = (aGroup == HCSR04_ARRAY_OWN_GROUP) ? SensorCount : aGroup;
+    DistancesCentimeter[SensorCount] = 0;
+    CandidateCentimeter[SensorCount] = 0;
+    return SensorCount++;
+}
+
+void HCSR04Array::begin() {
+    // collect the distinct groups in ascending order
+    GroupCount = 0;
+    for (uint8_t i = 0; i < SensorCount; ++i) {
+        uint8_t tGroup = SensorGroup[i];
+        uint8_t j = 0;
+        while (j < GroupCount && GroupIds[j] < tGroup) {
+            j++;
+        }
+        if (j < GroupCount && GroupIds[j] == tGroup) {
+            continue;
+        }
+        for (uint8_t k = GroupCount; k > j; --k) {
+            GroupIds[k] = GroupIds[k - 1];
+        }
+        GroupIds[j] = tGroup;
+        GroupCount++;
+    }
+    for (uint8_t i = 0; i < SensorCount; ++i) {
+        PCMSK2 |= EchoBitMask[i];
+    }
+    sArrayActiveMask = 0;
+    PCIFR = _BV(PCIE2); // clear any outstanding interrupt
+    PCICR |= _BV(PCIE2);
+
+    CurrentGroup = 0;
+    SlotIsActive = false;
+    NextTriggerMicros = micros();
+    FrameStartMicros = NextTriggerMicros;
+}
+
+void HCSR04Array::end() {
+    sArrayActiveMask = 0;
+    for (uint8_t i = 0; i < SensorCount; ++i) {
+        PCMSK2 &= ~EchoBitMask[i];
+    }
+    SlotIsActive = false;
+}
+
+/*
+ * To be called as often as possible, e.g. on every scheduler pass. Blocks only for the trigger pulse.
+ * @return true if all sensors got a new value since the last true
+ */
+bool HCSR04Array::update() {
+    if (GroupCount == 0) {
+        return false;
+    }
+    bool tFrameIsComplete = false;
+    unsigned long tMicros = micros();
+    if (SlotIsActive) {
+        if (sArrayDoneMask != CurrentGroupMask
+                && (tMicros - SlotStartMicros) < ((unsigned long) TimeoutMicros + HCSR04_ARRAY_ECHO_DELAY_MICROS)) {
+            return false;
+        }
+        finishGroup();
+        NextTriggerMicros = tMicros + GuardMicros + (getDither() & HCSR04_ARRAY_DITHER_MASK);
+        if (++CurrentGroup >= GroupCount) {
+            CurrentGroup = 0;
+            FrameMicros = tMicros - FrameStartMicros;
+            FrameStartMicros = tMicros;
+            tFrameIsComplete = true;
+        }
+    }
+    if (!SlotIsActive && (long) (tMicros - NextTriggerMicros) >= 0) {
+        triggerGroup();
+    }
+    return tFrameIsComplete;
+}
+
+void HCSR04Array::triggerGroup() {
+    uint8_t tGroup = GroupIds[CurrentGroup];
+    uint8_t tMask = 0;
+    bool tHas1PinSensor = false;
+
+    sArrayActiveMask = 0;
+// need minimum 10 usec Trigger Pulse
+    for (uint8_t i = 0; i < SensorCount; ++i) {
+        if (SensorGroup[i] == tGroup) {
+            tMask |= EchoBitMask[i];
+            digitalWrite(Sensors[i].TriggerOutPin, HIGH);
+            if (Sensors[i].Mode == HCSR04_MODE_USE_1_PIN) {
+                // do it AFTER digitalWrite to avoid spurious triggering by just switching pin to output
+                pinMode(Sensors[i].TriggerOutPin, OUTPUT);
+                tHas1PinSensor = true;
+            }
+        }
+    }
+    delayMicroseconds(10);
+// falling edge starts measurement after 400/600 microseconds (old/new modules)
+    for (uint8_t i = 0; i < SensorCount; ++i) {
+        if (SensorGroup[i] == tGroup) {
+            digitalWrite(Sensors[i].TriggerOutPin, LOW);
+        }
+    }
+    if (tHas1PinSensor) {
+        // allow for 20 us low before switching to input which is high because of the modules pullup resistor.
+        delayMicroseconds(20);
+        for (uint8_t i = 0; i < SensorCount; ++i) {
+            if (SensorGroup[i] == tGroup && Sensors[i].Mode == HCSR04_MODE_USE_1_PIN) {
+                pinMode(Sensors[i].TriggerOutPin, INPUT);
+            }
+        }
+    }
+
+    noInterrupts();
+    sArrayLastPortState = PINK;
+    sArrayStartedMask = 0;
+    sArrayDoneMask = 0;
+    sArrayActiveMask = tMask;
+    interrupts();
+    CurrentGroupMask = tMask;
+    SlotStartMicros = micros();
+    SlotIsActive = true;
+}
+
+/*
+ * Convert the pulses of the current group, missing or too long pulses give 0 as for the blocking functions
+ */
+void HCSR04Array::finishGroup() {
+    sArrayActiveMask = 0;
+    uint8_t tDoneMask = sArrayDoneMask;
+    uint8_t tGroup = GroupIds[CurrentGroup];
+    for (uint8_t i = 0; i < SensorCount; ++i) {
+        if (SensorGroup[i] == tGroup) {
+            uint8_t tBitMask = EchoBitMask[i];
+            unsigned int tPulseMicros = 0;
+            if (tDoneMask & tBitMask) {
+                uint8_t tBitIndex = 0;
+                while ((tBitMask >>= 1) != 0) {
+                    tBitIndex++;
+                }
+                tPulseMicros = sArrayEchoPulseMicros[tBitIndex];
+                if (tPulseMicros > TimeoutMicros) {
+                    tPulseMicros = 0;
+                }
+            }
+            DistancesCentimeter[i] = rejectCrosstalk(i, getCentimeterFromUSMicroSeconds(tPulseMicros));
+        }
+    }
+    SlotIsActive = false;
+}
+
+/*
+ * Crosstalk always gives a too short distance. A reading much closer than the last one
+ * is kept as candidate and only published if the next reading of this sensor is near to it.
+ */
+unsigned int HCSR04Array::rejectCrosstalk(uint8_t aSensorIndex, unsigned int aCentimeter) {
+    unsigned int tLastCentimeter = DistancesCentimeter[aSensorIndex];
+    if (aCentimeter == 0 || tLastCentimeter == 0 || aCentimeter + HCSR04_ARRAY_MAX_JUMP_CENTIMETER >= tLastCentimeter) {
+        CandidateCentimeter[aSensorIndex] = 0;
+        return aCentimeter;
+    }
+    unsigned int tCandidate = CandidateCentimeter[aSensorIndex];
+    CandidateCentimeter[aSensorIndex] = aCentimeter;
+    if (tCandidate != 0 && aCentimeter + HCSR04_ARRAY_MAX_JUMP_CENTIMETER >= tCandidate
+            && tCandidate + HCSR04_ARRAY_MAX_JUMP_CENTIMETER >= aCentimeter) {
+        // confirmed
+        CandidateCentimeter[aSensorIndex] = 0;
+        return aCentimeter;
+    }
+    return tLastCentimeter;
+}
+
+/*
+ * 16 bit Galois LFSR
+ */
+uint16_t HCSR04Array::getDither() {
+    DitherState = (DitherState >> 1) ^ (-(DitherState & 1u) & 0xB400u);
+    return DitherState;
+}
+
+uint8_t HCSR04Array::getSensorCount() {
+    return SensorCount;
+}
+
+/*
+ * @return Distance in centimeter of last frame, 0 if timeout
+ */
+unsigned int HCSR04Array::getDistanceCentimeter(uint8_t aSensorIndex) {
+    if (aSensorIndex >= SensorCount) {
+        return 0;
+    }
+    return DistancesCentimeter[aSensorIndex];
+}
+
+/*
+ * @return Vector of getSensorCount() distances, in order of addSensor()
+ */
+const unsigned int* HCSR04Array::getDistancesCentimeter() {
+    return DistancesCentimeter;
+}
+
+/*
+ * @return Duration of last complete frame, i.e. the time for a new value of all sensors
+ */
+unsigned long HCSR04Array::getFrameMicros() {
+    return FrameMicros;
+}
+
+#endif // USE_HCSR04_ARRAY
@@ -0,0 +1,93 @@
+/*
+ * HCSR04Array.h
+ *
+ *  Array of up to 8 US Sensors (HC-SR04), e.g. left / right / head height, measured without blocking.
+ *  The echo pins must be on port K (A8 to A15 of the Mega), which all share the PCINT2_vect pin change interrupt.
+ *  Trigger pins can be any pin, 1 pin mode is supported if the trigger pin is also on port K.
+ *
+ *  Sensors of the same group are triggered together, the groups are triggered one after the other (round robin).
+ *  By default each sensor is its own group. Putting sensors which do not see each other,
+ *  e.g. left and right, in one group measures them in parallel and shortens the frame.
+ *
+ *  Usage:
+ *  HCSR04Array sSensors;
+ *  sSensors.addSensor(TRIGGER_LEFT_PIN, A8, 0);
+ *  sSensors.addSensor(TRIGGER_RIGHT_PIN, A9, 0);
+ *  sSensors.addSensor(TRIGGER_HEAD_PIN, A10, 1);
+ *  sSensors.begin();
+ *  loop: if (sSensors.update()) {<use sSensors.getDistancesCentimeter()>};
+ */
+
+#ifndef HCSR04_ARRAY_H_
+#define HCSR04_ARRAY_H_
+
+#include <stdint.h>
+#include "HCSR04.h"
+
+/*
+ * Uncomment to build the array, it then takes the PCINT2_vect interrupt. Arduino links every .cpp of the sketch
+ * folder, so by default the vector is left free for other users like SoftwareSerial on port K.
+ * PCINT2_vect is also used by the single sensor non blocking version.
+ */
+//#define USE_HCSR04_ARRAY
+#if defined(USE_HCSR04_ARRAY) \
+        && (!(defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)) || defined(USE_PIN_CHANGE_INTERRUPT_D0_TO_D7))
+#error "USE_HCSR04_ARRAY needs the port K of a Mega and the PCINT2_vect interrupt"
+#endif
+
+#if defined(USE_HCSR04_ARRAY)
+#define HCSR04_ARRAY_MAX_SENSORS            8       // pins of port K
+#define HCSR04_ARRAY_OWN_GROUP              0xFF
+#define HCSR04_ARRAY_INVALID_SENSOR         0xFF
+#define HCSR04_ARRAY_DEFAULT_GUARD_MICROS   2000    // let the last echoes of a group vanish before triggering the next one
+#define HCSR04_ARRAY_DITHER_MASK            0x03FF  // up to 1 ms random additional delay to decorrelate crosstalk
+#define HCSR04_ARRAY_ECHO_DELAY_MICROS      1000    // echo pulse starts 400/600 microseconds (old/new modules) after trigger
+#define HCSR04_ARRAY_MAX_JUMP_CENTIMETER    30      // a closer reading jumping more than this must be confirmed by the next frame
+
+/*
+ * Only one instance is possible, since the PCINT2 interrupt is shared
+ */
+class HCSR04Array {
+public:
+    HCSR04Array(unsigned int aTimeoutMicros = US_DISTANCE_DEFAULT_TIMEOUT_MICROS, unsigned int aGuardMicros =
+            HCSR04_ARRAY_DEFAULT_GUARD_MICROS);
+    uint8_t addSensor(uint8_t aTriggerOutPin, uint8_t aEchoInPin = 0, uint8_t aGroup = HCSR04_ARRAY_OWN_GROUP);
+    void begin();
+    void end();
+    bool update();
+
+    uint8_t getSensorCount();
+    unsigned int getDistanceCentimeter(uint8_t aSensorIndex);
+    const unsigned int* getDistancesCentimeter();
+    unsigned long getFrameMicros();
+
+private:
+    void triggerGroup();
+    void finishGroup();
+    unsigned int rejectCrosstalk(uint8_t aSensorIndex, unsigned int aCentimeter);
+    uint16_t getDither();
+
+    HCSR04Sensor Sensors[HCSR04_ARRAY_MAX_SENSORS];
+    uint8_t SensorGroup[HCSR04_ARRAY_MAX_SENSORS]; // group id as given by addSensor()
+    uint8_t EchoBitMask[HCSR04_ARRAY_MAX_SENSORS]; // bit in PINK
+    uint8_t GroupIds[HCSR04_ARRAY_MAX_SENSORS];    // sorted distinct group ids
+    uint8_t SensorCount;
+    uint8_t GroupCount;
+    uint8_t CurrentGroup;
+    uint8_t CurrentGroupMask;
+
+    unsigned int TimeoutMicros;
+    unsigned int GuardMicros;
+    bool SlotIsActive;
+    unsigned long SlotStartMicros;
+    unsigned long NextTriggerMicros;
+    unsigned long FrameStartMicros;
+    unsigned long FrameMicros;
+    uint16_t DitherState;
+
+    unsigned int DistancesCentimeter[HCSR04_ARRAY_MAX_SENSORS];  // published results
+    unsigned int CandidateCentimeter[HCSR04_ARRAY_MAX_SENSORS];  // closer jump waiting for confirmation
+};
+#endif // USE_HCSR04_ARRAY
+
+#endif // HCSR04_ARRAY_H_
@@ -0,0 +1,98 @@
+/**
+ * @file      Haptic.cpp
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  Vibration patterns on the hardware PWM of TIMER3.
+ */
+
+#include <Arduino.h>
+#include "Haptic.h"
+#include "Scheduler.h"
+
+#define HAPTIC_TOP ((F_CPU / HAPTIC_PWM_HZ) - 1)    // 799, ICR3 in fast PWM mode 14
+
+static const HapticStep *sStep = NULL;
+static uint32_t sStepDeadline = 0;
+static uint8_t sTask = SCHEDULER_INVALID_TASK;
+
+/*
+ * Duty 0 disconnects OC3B, fast PWM would still give a spike at each period
+ */
+static void applyStep(void)
+{
+  if (sStep->duty == 0)
+    TCCR3A &= ~_BV(COM3B1);
+  else
+    {
+      OCR3B = (uint16_t)(((uint32_t)sStep->duty * (HAPTIC_TOP + 1)) >> 8);
+      TCCR3A |= _BV(COM3B1);
+    }
+  // From the previous deadline, so that a late task does not stretch the pattern
+  sStepDeadline += sStep->periodMillis;
+  setTaskDeadline(sTask, sStepDeadline);
+}
+
+// Task of the scheduler, at the end of each step only
+static void stepHaptic(void)
+{
+  if (sStep == NULL)
+    return;
+  sStep++;
+  if (sStep->periodMillis == 0)
+    stopHaptic();
+  else
+    applyStep();
+}
+
+/*
+ * TIMER3 stays stopped until a pattern plays
+ *
+ * @return  false without room left in the scheduler
+ */
+bool beginHaptic(void)
+{
+  digitalWrite(HAPTIC_OUT_PIN, LOW);
+  pinMode(HAPTIC_OUT_PIN, OUTPUT);
+  // Fast PWM mode 14, TOP = ICR3, no interrupt
+  TCCR3A = _BV(WGM31);
+  TCCR3B = _BV(WGM33) | _BV(WGM32);
+  TIMSK3 = 0;
+  ICR3 = HAPTIC_TOP;
+  TCNT3 = 0;
+  sTask = addTask(stepHaptic, 1000);     // The deadline is set at each step
+  if (sTask == SCHEDULER_INVALID_TASK)
+    return false;
+  enableTask(sTask, false);
+  return true;
+}
+
+/*
+ * The first step starts at once, a pattern playing is replaced. aPattern
+ * must stay valid until its end, e.g. a const table of the sketch.
+ */
+void playHaptic(const HapticStep *aPattern)
+{
+  if (sTask == SCHEDULER_INVALID_TASK || aPattern == NULL || aPattern->periodMillis == 0)
+    return;
+  sStep = aPattern;
+  sStepDeadline = millis();
+  TCCR3B |= _BV(CS30);          // F_CPU, no prescaler
+  enableTask(sTask, true);
+  applyStep();
+}
+
+void stopHaptic(void)
+{
+  TCCR3A &= ~_BV(COM3B1);       // The pin is low again
+  TCCR3B &= ~(_BV(CS32) | _BV(CS31) | _BV(CS30));
+  TCNT3 = 0;
+  sStep = NULL;
+  if (sTask != SCHEDULER_INVALID_TASK)
+    enableTask(sTask, false);
+}
+
+bool isHapticPlaying(void)
+{
+  return sStep != NULL;
+}
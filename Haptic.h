@@ -0,0 +1,35 @@
+/**
+ * @file      Haptic.h
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  Vibration motor on the hardware PWM of TIMER3, output OC3B (pin 2),
+ * through a transistor. A pattern is a table of steps: the duty of a step is
+ * written once to OCR3B and the timer keeps the motor running on its own, no
+ * interrupt. A scheduler task only steps to the next entry at its deadline.
+ *
+ * TIMER3 is the spare 16-bit timer of the sketch: TIMER4 measures the radar
+ * and TIMER5 runs the audio on pin 46. OC3A (pin 5) is the radar trigger and
+ * stays a plain output, only OC3B is connected to the timer.
+ */
+
+#ifndef HAPTIC_H_
+#define HAPTIC_H_
+
+#include <stdint.h>
+
+#define HAPTIC_OUT_PIN  2       // OC3B
+#define HAPTIC_PWM_HZ   20000   // Above hearing, the motor only sees the mean voltage
+
+struct HapticStep
+{
+  uint8_t  duty;              // 0 (off) to 255 (full voltage)
+  uint16_t periodMillis;      // Duration of the step, 0 ends the pattern
+};
+
+bool beginHaptic(void);
+void playHaptic(const HapticStep *aPattern);
+void stopHaptic(void);
+bool isHapticPlaying(void);
+
+#endif // HAPTIC_H_
@@ -0,0 +1,175 @@
+/**
+ * @file      Scheduler.cpp
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  Cooperative task scheduler driven by millis().
+ */
+
+#include <Arduino.h>
+#include "Scheduler.h"
+#if defined(SCHEDULER_SLEEP)
+#include <avr/sleep.h>
+#endif
+
+static SchedulerTask sTasks[SCHEDULER_MAX_TASKS];
+static uint8_t sTaskCount = 0;
+static IdleCallback sIdleCallback = NULL;
+
+// Time spent asleep, in total and since the last getSchedulerSleepPercent()
+static uint32_t sSleepMillis = 0;
+static uint16_t sSleepMicros = 0;         // Below one millisecond, not yet in sSleepMillis
+static uint32_t sWindowSleepMicros = 0;
+static uint32_t sWindowStartMicros = 0;
+
+/*
+ * True once aDeadline is reached, also across the 49 days millis() wrap around
+ */
+static inline bool isDeadlineReached(uint32_t aNow, uint32_t aDeadline)
+{
+  return (int32_t)(aNow - aDeadline) >= 0;
+}
+
+/*
+ * @return  Task id or SCHEDULER_INVALID_TASK if the task table is full
+ */
+uint8_t addTask(TaskCallback aCallback, uint16_t aPeriodMillis)
+{
+  if (sTaskCount >= SCHEDULER_MAX_TASKS)
+    return SCHEDULER_INVALID_TASK;
+
+  SchedulerTask *tTask = &sTasks[sTaskCount];
+  tTask->callback = aCallback;
+  tTask->periodMillis = aPeriodMillis;
+  tTask->deadline = millis();
+  tTask->enabled = true;
+  return sTaskCount++;
+}
+
+/*
+ * The new period is applied from the next run on
+ */
+void setTaskPeriod(uint8_t aTaskId, uint16_t aPeriodMillis)
+{
+  if (aTaskId < sTaskCount)
+    sTasks[aTaskId].periodMillis = aPeriodMillis;
+}
+
+/*
+ * Move the next run of a task, earlier or later, to an absolute millis() value
+ */
+void setTaskDeadline(uint8_t aTaskId, uint32_t aDeadlineMillis)
+{
+  if (aTaskId < sTaskCount)
+    sTasks[aTaskId].deadline = aDeadlineMillis;
+}
+
+void enableTask(uint8_t aTaskId, bool aEnable)
+{
+  if (aTaskId < sTaskCount)
+    {
+      if (aEnable && !sTasks[aTaskId].enabled)
+        sTasks[aTaskId].deadline = millis();
+      sTasks[aTaskId].enabled = aEnable;
+    }
+}
+
+/*
+ * Called when the CPU is about to sleep, e.g. to power down the audio output
+ * after a while without sound. May return false to skip this sleep.
+ */
+void setIdleCallback(IdleCallback aCallback)
+{
+  sIdleCallback = aCallback;
+}
+
+/*
+ * True if a task with a period is due. Tasks with a period of 0 only poll.
+ */
+static bool isAnyDeadlineReached(void)
+{
+  uint32_t tNow = millis();
+  for (uint8_t i = 0; i < sTaskCount; i++)
+    {
+      SchedulerTask *tTask = &sTasks[i];
+      if (tTask->enabled && tTask->periodMillis != 0 && isDeadlineReached(tNow, tTask->deadline))
+        return true;
+    }
+  return false;
+}
+
+#if defined(SCHEDULER_SLEEP)
+/*
+ * SLEEP_MODE_IDLE only stops the CPU clock: the timers, the UART and SPI keep
+ * running, and any interrupt wakes it up, at least the TIMER0 tick every 1 ms.
+ */
+static void sleepUntilInterrupt(void)
+{
+  uint32_t tStart = micros();
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_mode();
+  uint32_t tSlept = micros() - tStart;
+
+  sWindowSleepMicros += tSlept;
+  sSleepMicros += tSlept;
+  // About 1 ms per sleep, cheaper than a division
+  while (sSleepMicros >= 1000)
+    {
+      sSleepMicros -= 1000;
+      sSleepMillis++;
+    }
+}
+#endif
+
+/*
+ * Run every task whose deadline is reached, in order of registration, then
+ * sleep until the next interrupt if no other deadline is reached meanwhile.
+ * To be called from loop() without any delay() around it.
+ */
+void runScheduler(void)
+{
+  for (uint8_t i = 0; i < sTaskCount; i++)
+    {
+      SchedulerTask *tTask = &sTasks[i];
+      uint32_t tNow = millis();
+      if (!tTask->enabled || !isDeadlineReached(tNow, tTask->deadline))
+        continue;
+
+      // Keep the cadence without drift, but do not try to catch up missed runs
+      tTask->deadline += tTask->periodMillis;
+      if (isDeadlineReached(tNow, tTask->deadline))
+        tTask->deadline = tNow + tTask->periodMillis;
+
+      // The callback may overwrite the deadline with setTaskDeadline()
+      tTask->callback();
+    }
+
+#if defined(SCHEDULER_SLEEP)
+  if (isAnyDeadlineReached())
+    return;
+  if (sIdleCallback != NULL && !sIdleCallback())
+    return;
+  sleepUntilInterrupt();
+#endif
+}
+
+uint32_t getSchedulerSleepMillis(void)
+{
+  return sSleepMillis;
+}
+
+/*
+ * @return  Part of the time spent asleep since the previous call, 0 to 100
+ */
+uint8_t getSchedulerSleepPercent(void)
+{
+  uint32_t tNow = micros();
+  uint32_t tWindow = tNow - sWindowStartMicros;
+  uint32_t tSlept = sWindowSleepMicros;
+  sWindowStartMicros = tNow;
+  sWindowSleepMicros = 0;
+  if (tWindow < 100)
+    return 0;
+  tSlept /= tWindow / 100;
+  return tSlept > 100 ? 100 : tSlept;
+}
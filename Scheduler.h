@@ -0,0 +1,47 @@
+/**
+ * @file      Scheduler.h
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  Cooperative  task  scheduler driven  by millis(). Every  task has its
+ * own deadline, so a slow task (audio, console) never  delays the sampling  of
+ * the radar.  Tasks must return quickly and never block.
+ *
+ * When no deadline is reached after a pass, the CPU sleeps in SLEEP_MODE_IDLE
+ * until the next interrupt: the millis() tick, the radar timer, the audio  or
+ * the UART. Tasks with a period of 0 are run on every wake up but do not keep
+ * the CPU awake.
+ */
+
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+#include <stdint.h>
+
+#define SCHEDULER_MAX_TASKS     8
+#define SCHEDULER_INVALID_TASK  0xFF
+
+// Comment out to never sleep, e.g. to measure the scheduler jitter
+#define SCHEDULER_SLEEP
+
+typedef void (*TaskCallback)(void);
+typedef bool (*IdleCallback)(void);   // Return false to stay awake this pass
+
+struct SchedulerTask
+{
+  TaskCallback callback;
+  uint16_t     periodMillis;  // 0 means run on every scheduler pass
+  uint32_t     deadline;      // millis() value of the next run
+  bool         enabled;
+};
+
+uint8_t addTask(TaskCallback aCallback, uint16_t aPeriodMillis);
+void setTaskPeriod(uint8_t aTaskId, uint16_t aPeriodMillis);
+void setTaskDeadline(uint8_t aTaskId, uint32_t aDeadlineMillis);
+void enableTask(uint8_t aTaskId, bool aEnable);
+void setIdleCallback(IdleCallback aCallback);
+void runScheduler(void);
+uint32_t getSchedulerSleepMillis(void);
+uint8_t getSchedulerSleepPercent(void);
+
+#endif // SCHEDULER_H_
@@ -9,9 +9,21 @@
     #include <SdFat.h>
 #endif
 #include <TMRpcm.h>
+#include <util/atomic.h>
 
 #if !defined (RF_ONLY)
 
+#if defined (SD_RAW_READ)
+    #if !defined (SDFAT) || defined (ENABLE_MULTI)
+        #error "SD_RAW_READ needs SDFAT and single track mode"
+    #endif
+    #if !defined (buffSize)
+        #define buffSize 512   //One SD block per refill
+    #elif buffSize != 512
+        #error "SD_RAW_READ needs a buffSize of 512"
+    #endif
+#endif
+
 //********************* Timer arrays and pointers **********************
 //********** Enables use of different timers on different boards********
 
@@ -43,21 +55,28 @@
         #endif
 
     //*** These aliases can be commented out to enable full use of alternate timers for other things
+    //*** With PCM_FIXED_TIMER only the vectors of that timer are used
+      #if !defined (PCM_FIXED_TIMER)
         ISR(TIMER3_OVF_vect, ISR_ALIASOF(TIMER1_OVF_vect));
         ISR(TIMER3_CAPT_vect, ISR_ALIASOF(TIMER1_CAPT_vect));
 
+        #if !defined (DISABLE_TIMER4)
         ISR(TIMER4_OVF_vect, ISR_ALIASOF(TIMER1_OVF_vect));
         ISR(TIMER4_CAPT_vect, ISR_ALIASOF(TIMER1_CAPT_vect));
+        #endif
 
         ISR(TIMER5_OVF_vect, ISR_ALIASOF(TIMER1_OVF_vect));
         ISR(TIMER5_CAPT_vect, ISR_ALIASOF(TIMER1_CAPT_vect));
+      #endif
 
         #if defined (ENABLE_RECORDING)
         ISR(TIMER3_COMPA_vect, ISR_ALIASOF(TIMER1_COMPA_vect));
         ISR(TIMER3_COMPB_vect, ISR_ALIASOF(TIMER1_COMPB_vect));
 
+        #if !defined (DISABLE_TIMER4)
         ISR(TIMER4_COMPA_vect, ISR_ALIASOF(TIMER1_COMPA_vect));
         ISR(TIMER4_COMPB_vect, ISR_ALIASOF(TIMER1_COMPB_vect));
+        #endif
 
         ISR(TIMER5_COMPA_vect, ISR_ALIASOF(TIMER1_COMPA_vect));
         ISR(TIMER5_COMPB_vect, ISR_ALIASOF(TIMER1_COMPB_vect));
@@ -87,8 +106,10 @@
             volatile unsigned int *OCRnB[] ={&one,&two};
         #endif
     //*** These aliases can be commented out to enable full use of alternate timers for other things
+      #if !defined (PCM_FIXED_TIMER)
         ISR(TIMER3_OVF_vect, ISR_ALIASOF(TIMER1_OVF_vect));
         ISR(TIMER3_CAPT_vect, ISR_ALIASOF(TIMER1_CAPT_vect));
+      #endif
 
         #if defined (ENABLE_RECORDING)
         ISR(TIMER3_COMPA_vect, ISR_ALIASOF(TIMER1_COMPA_vect));
@@ -169,9 +190,21 @@ volatile unsigned int dataEnd;
 volatile boolean buffEmpty[2] = {true,true}, whichBuff = false, playing = 0, a, b;
 
 //*** Options/Indicators from MSb to LSb: paused, qual, rampUp, 2-byte samples, loop, loop2nd track, 16-bit ***
-byte optionByte = B01100000;
+#if defined (PCM_FIXED_TIMER) && !PCM_FIXED_QUALITY
+    byte optionByte = B00100000;
+#else
+    byte optionByte = B01100000;
+#endif
 
-volatile byte buffer[2][buffSize], buffCount = 0;
+volatile byte buffer[2][buffSize];
+#if buffSize > 255
+    #if defined (ENABLE_MULTI)
+        #error "buffSize is limited to 254 in multi mode"
+    #endif
+    volatile unsigned int buffCount = 0;
+#else
+    volatile byte buffCount = 0;
+#endif
 char volMod=0;
 byte tt;
 
@@ -191,6 +224,116 @@ byte tt;
     byte tt2 = 0;
 #endif
 
+#if !defined (ENABLE_MULTI)
+    //*** Output compare value of each sample value at the current volume ***
+    //*** The sample interrupt is a table read instead of a variable shift ***
+    unsigned int volTable[256];
+    unsigned int volGain = 256;     //In 1/256, 256 is the original level
+    boolean volTableReady = 0;
+
+    //Each entry is stored with interrupts off, the sample interrupt may read it meanwhile
+    void buildVolTable(){
+        for(unsigned int i=0; i<256; i++){
+            unsigned long v = ((unsigned long)i * volGain) >> 8;
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE){ volTable[i] = v > 0xFFFF ? 0xFFFF : v; }
+        }
+        volTableReady = 1;
+    }
+
+    //The same gain as the former shift by volMod
+    void volModToGain(){
+        if(volMod >= 0){ volGain = volMod > 7 ? 0xFFFF : 256U << volMod; }
+        else{            volGain = volMod < -8 ? 0 : 256 >> -volMod; }
+        buildVolTable();
+    }
+#endif
+
+#if !defined (ENABLE_MULTI)
+    //*** The source refilling the buffers, called from the buffer interrupt ***
+    pcmSource* volatile activeSource = NULL;
+    pcmFileSource fileSource;
+    pcmToneSource toneSource;
+    #if defined (SD_RAW_READ)
+        pcmRawSource rawSource;
+    #endif
+#endif
+
+#if !defined (ENABLE_MULTI)
+    unsigned int spiSampleRate;     //Of the playing source, for audioCanWait()
+    boolean audioCanWait(unsigned int micros);
+    void audioHold();
+    void audioResume();
+#endif
+
+#if defined (PLAY_QUEUE)
+    #if defined (ENABLE_MULTI)
+        #error "PLAY_QUEUE is only supported in single track mode"
+    #endif
+    //*** Sources waiting behind activeSource, highest priority first ***
+    pcmSource* volatile pendingSource = NULL;   //Cuts in at the next buffer
+    volatile byte pendingPriority;
+    volatile byte activePriority = 0;
+    pcmSource* queueSource[PLAY_QUEUE];
+    byte queuePriority[PLAY_QUEUE];
+    volatile byte queueCount = 0;
+#endif
+
+#if defined (MEMORY_CLIPS)
+    #if defined (ENABLE_MULTI)
+        #error "MEMORY_CLIPS is only supported in single track mode"
+    #endif
+    pcmClip clips[MEMORY_CLIPS];
+    byte clipCount = 0;
+    pcmMemorySource clipSources[MEMORY_CLIPS];
+    pcmMemorySource clipSource;     //For clips not registered with addClip()
+#endif
+
+#if defined (ENABLE_TRACE)
+    volatile boolean traceFirstSample = 0;
+#endif
+
+#if defined (PCM_STATS)
+    #if defined (ENABLE_MULTI)
+        #error "PCM_STATS is only supported in single track mode"
+    #endif
+    pcmStats stat;
+    unsigned long statStartMillis = 0, playStartMillis;
+    boolean statPlaying = 0;
+
+    void statsEndPlay(){
+        if(statPlaying){ stat.playingMillis += millis() - playStartMillis; statPlaying = 0; }
+    }
+#endif
+
+#if defined (WAV_INDEX)
+    #if defined (ENABLE_MULTI)
+        #error "WAV_INDEX is only supported in single track mode"
+    #endif
+    wavIndexEntry wavIndex[WAV_INDEX];
+    byte indexCount = 0;
+    #if defined (WAV_TAGS)
+        const char indexMagic[4] = {'W','I','X','5'};
+        const char tagIds[WAV_TAG_COUNT][5] = {"INAM","IART","IPRD","TPE1","TIT2","TALB"};
+    #else
+        const char indexMagic[4] = {'W','I','X','4'};
+    #endif
+    #if defined (ADPCM)
+        wavIndexEntry* adpcmEntry = NULL;   //Set by indexInfo() for an IMA-ADPCM file
+    #endif
+#endif
+
+#if defined (ADPCM)
+    pcmAdpcmSource adpcmSource;
+#endif
+
+#if defined (PLAYLIST)
+    #if !defined (WAV_INDEX)
+        #error "PLAYLIST needs WAV_INDEX"
+    #endif
+    pcmWavSource wavSources[PLAYLIST];
+    pcmPlaylistSource playlistSource;
+#endif
+
 #if defined (ENABLE_RECORDING)
     
     #if defined(SDFAT)
@@ -200,6 +343,24 @@ byte tt;
     #endif
       
     byte recording = 0;
+
+    #if defined (RECORD_RAW)
+        #if !defined (SDFAT) || defined (ENABLE_MULTI)
+            #error "RECORD_RAW needs SDFAT and single track mode"
+        #endif
+        #if !defined (BLOCK_COUNT)
+            #define BLOCK_COUNT 2000UL     //1 MB, 47 s at 22kHz
+        #endif
+        //*** Full blocks wait in the ring from recordTail on, the ADC fills recordRing[recordHead] ***
+        byte recordRing[RECORD_RAW_BLOCKS][512];
+        volatile byte recordHead = 0, recordTail = 0, recordFilled = 0;
+        volatile unsigned int recordCount = 0;
+        volatile unsigned int recordDrops = 0;     //Samples lost with a full ring or file
+        unsigned long recordFirstBlock, recordLastBlock;
+        volatile unsigned long recordBlock;         //Next block of the multi-block write
+        unsigned int recordRate;
+        Sd2Card* recordCard;
+    #endif
 #endif
 //**************************************************************
 //********** Core Playback Functions used in all modes *********
@@ -232,10 +393,14 @@ void TMRpcm::setPin(){
     disable();
     pinMode(speakerPin,OUTPUT);
 
-    #if !defined (USE_TIMER2) //NOT using TIMER2
+    #if defined (PCM_FIXED_TIMER)
+        tt = pcmPlayer::timer::index;
+    #elif !defined (USE_TIMER2) //NOT using TIMER2
         switch(speakerPin){
             case 5: tt=1; break; //use TIMER3
+          #if !defined (DISABLE_TIMER4)
             case 6: tt=2; break;//use TIMER4
+          #endif
             case 46:tt=3; break;//use TIMER5
             default:tt=0; break; //useTIMER1 as default
         }
@@ -257,13 +422,17 @@ void TMRpcm::setPins(){
     pinMode(speakerPin2,OUTPUT);
     switch(speakerPin){
         case 5: tt=1; break; //use TIMER3
+      #if !defined (DISABLE_TIMER4)
         case 6: tt=2; break;//use TIMER4
+      #endif
         case 46:tt=3; break;//use TIMER5
         default:tt=0; break; //useTIMER1 as default
     }
     switch(speakerPin2){
         case 5: tt2=1; break; //use TIMER3
+      #if !defined (DISABLE_TIMER4)
         case 6: tt2=2; break;//use TIMER4
+      #endif
         case 46:tt2=3; break;//use TIMER5
         default:tt2=0; break; //useTIMER1 as default
     }
@@ -370,13 +539,26 @@ boolean TMRpcm::wavInfo(char* filename){
 //*************** General Playback Functions *****************
 
 void TMRpcm::quality(boolean q){
+  #if !defined (PCM_FIXED_TIMER) //Else fixed by PCM_FIXED_QUALITY
     if(!playing){   bitWrite(optionByte,6,q); } //qual = q; }
+  #else
+    (void)q;
+  #endif
 }
 
 void TMRpcm::stopPlayback(){
     playing = 0;
 
     *TIMSK[tt] &= ~(togByte | _BV(TOIE1));
+    #if !defined (ENABLE_MULTI)
+        if(activeSource){ activeSource->stop(); activeSource = NULL; }
+    #endif
+    #if defined (PCM_STATS)
+        statsEndPlay();
+    #endif
+    #if defined (PLAY_QUEUE)
+        pendingSource = NULL; queueCount = 0; activePriority = 0;
+    #endif
 
     if(ifOpen()){ sFile.close(); }
 
@@ -426,6 +608,7 @@ Prevents a whole lot more #if defined statements */
 
     boolean TMRpcm::ifOpen(){
         if(sFile){ return 1;}
+        return 0;
     }
 
 #else
@@ -459,6 +642,7 @@ void TMRpcm::play(char* filename){
 
 void TMRpcm::play(char* filename, unsigned long seekPoint){
 
+  PCM_TRACE(TRACE_PLAY,0);
   if(speakerPin != lastSpeakPin){
       #if !defined (MODE2)
         setPin();
@@ -468,19 +652,545 @@ void TMRpcm::play(char* filename, unsigned long seekPoint){
       lastSpeakPin=speakerPin;
    }
   stopPlayback();
+  #if defined (ADPCM) && defined (WAV_INDEX)
+  adpcmEntry = NULL;
+  #endif
+  #if defined (WAV_INDEX)
+  if(!indexInfo(filename))
+  #endif
   if(!wavInfo(filename)){
     #if defined (debug)
         Serial.println("WAV ERROR 2");
     #endif
   return;
   }//verify its a valid wav file
+  #if defined (PCM_FIXED_TIMER)
+  if((optionByte & (_BV(4) | _BV(1))) != pcmPlayer::formatBits){
+    #if defined (debug)
+        Serial.println("WAV FORMAT NOT PCM_FIXED");
+    #endif
+    sFile.close();
+    return;
+  }
+  #endif
+  PCM_TRACE(TRACE_HEADER,0);
+  #if defined (ADPCM) && defined (WAV_INDEX)
+  if(adpcmEntry){
+    //Decoded from sFile in the buffer interrupt, seekPoint is not supported
+    adpcmSource.beginFile(adpcmEntry->dataOffset, adpcmEntry->dataLength, SAMPLE_RATE, adpcmEntry->blockAlign);
+    byte tmp = 128;
+    adpcmSource.fill(&tmp,1);
+    activeSource = &adpcmSource;
+    startPlayback(tmp);
+    return;
+  }
+  #endif
 
 
+    fileSource.begin(SAMPLE_RATE, fPosition());
         if(seekPoint > 0){ seekPoint = (SAMPLE_RATE*seekPoint) + fPosition();
         seek(seekPoint); //skip the header info
 
   }
+    byte tmp = (sFile.read() + sFile.peek()) / 2;
+    activeSource = &fileSource;
+    #if defined (SD_RAW_READ)
+        //Contiguous files are read block by block, without the file system
+        if(rawSource.begin(SAMPLE_RATE, fileSource.dataStart, sFile.fileSize() - (dataEnd - buffSize))){
+            if(rawSource.seek(fPosition() - 1)){ activeSource = &rawSource; }
+        }
+    #endif
+    startPlayback(tmp);
+}
+
+//Play from any source (memory, generated, codec). The source must stay valid until playback ends
+void TMRpcm::play(pcmSource* source){
+    if(source == NULL){ return; }
+    PCM_TRACE(TRACE_PLAY,1);
+    if(speakerPin != lastSpeakPin){
+      #if !defined (MODE2)
+        setPin();
+      #else
+        setPins();
+      #endif
+        lastSpeakPin=speakerPin;
+    }
+    stopPlayback();
+    SAMPLE_RATE = source->sampleRate;
+    byte tmp = 0;
+    source->rewind();
+    if(!source->fill(&tmp,1)){ return; }
+    activeSource = source;
+    startPlayback(tmp);
+}
+
+//Sine beeps generated in the buffer interrupt. Calling it again while the tone plays
+//only changes the pitch and the envelope, without restarting or ramping the output
+//frequency 0 or onMillis 0: silence, offMillis 0: continuous tone
+void TMRpcm::playTone(unsigned int frequency, unsigned int onMillis, unsigned int offMillis){
+    if(frequency == 0){ onMillis = 0; }
+    if(playing && activeSource == &toneSource){
+        toneSource.setFrequency(frequency);
+        toneSource.setEnvelope(onMillis, offMillis);
+        return;
+    }
+    toneSource.begin(frequency, TONE_SAMPLE_RATE, 255);
+    toneSource.setEnvelope(onMillis, offMillis);
+    play(&toneSource);
+}
+
+#if defined (WAV_INDEX)
+
+//*** Index of the WAV headers, so play() does not parse them ***
+
+//Loads the index from WAV_INDEX_FILE, or scans the root directory if there is none or rescan is set
+//Returns the number of indexed files
+byte TMRpcm::buildIndex(boolean rescan){
+    stopPlayback();
+    if(!rescan && loadIndex()){ return indexCount; }
+    indexCount = 0;
+
+  #if !defined (SDFAT)
+    File root = SD.open("/");
+    if(!root){ return 0; }
+    while(indexCount < WAV_INDEX){
+        sFile = root.openNextFile();
+        if(!sFile){ break; }
+        char* name = sFile.name();
+  #else
+    SdBaseFile* root = SdBaseFile::cwd();
+    root->rewind();
+    while(indexCount < WAV_INDEX && sFile.openNext(root,O_READ)){
+        char name[13];
+        sFile.getFilename(name);
+  #endif
+        byte len = strlen(name);
+        if(len > 4 && len < 13 && !strcasecmp(name+len-4,".WAV")){
+            wavIndexEntry* entry = &wavIndex[indexCount];
+            strcpy(entry->name,name);
+            if(parseWav(entry)){ indexCount++; }
+        }
+        sFile.close();
+    }
+  #if !defined (SDFAT)
+    root.close();
+  #endif
+    saveIndex();
+    return indexCount;
+}
+
+wavIndexEntry* TMRpcm::findIndex(char* filename){
+    if(*filename == '/'){ filename++; }
+    for(byte i=0; i<indexCount; i++){
+        if(!strcasecmp(wavIndex[i].name,filename)){ return &wavIndex[i]; }
+    }
+    return NULL;
+}
+
+//Walks the RIFF chunks of the open sFile, a few small reads and no byte by byte search.
+//With WAV_TAGS the walk goes on after the data chunk for the tags
+boolean TMRpcm::parseWav(wavIndexEntry* entry){
+    byte hdr[16];
+    if(sFile.read(hdr,12) != 12 || memcmp(hdr,"RIFF",4) || memcmp(hdr+8,"WAVE",4)){ return 0; }
+  #if !defined (SDFAT)
+    entry->fileSize = sFile.size();
+    entry->firstCluster = 0;
+  #else
+    entry->fileSize = sFile.fileSize();
+    entry->firstCluster = sFile.firstCluster();
+  #endif
+    entry->sampleRate = 0;
+    entry->dataOffset = 0;
+  #if defined (WAV_TAGS)
+    memset(entry->tagOffset,0,sizeof(entry->tagOffset));
+  #endif
+    unsigned long pos = 12;
+    while(pos + 8 <= entry->fileSize){
+        if(sFile.read(hdr,8) != 8){ break; }
+        unsigned long size = hdr[4] | (unsigned long)hdr[5] << 8 | (unsigned long)hdr[6] << 16 | (unsigned long)hdr[7] << 24;
+        pos += 8;
+        if(!memcmp(hdr,"fmt ",4)){
+            if(size < 16 || sFile.read(hdr,16) != 16){ return 0; }
+            unsigned int format = hdr[0] | hdr[1] << 8;
+            entry->format = format;
+            entry->channels = hdr[2];
+            entry->sampleRate = hdr[4] | hdr[5] << 8;
+            entry->blockAlign = hdr[12] | hdr[13] << 8;
+            entry->bitsPerSample = hdr[14];
+            //IMA-ADPCM (0x11) must be mono, 4-bit. Other formats are taken as PCM
+          #if defined (ADPCM)
+            if(format == 0x11 && (entry->channels != 1 || entry->bitsPerSample != 4)){ return 0; }
+          #else
+            if(format == 0x11){ return 0; }
+          #endif
+        }else
+        if(!memcmp(hdr,"data",4)){
+            if(entry->sampleRate == 0){ return 0; }
+            entry->dataOffset = pos;
+            if(size > entry->fileSize - pos){ size = entry->fileSize - pos; }
+            entry->dataLength = size;
+          #if !defined (WAV_TAGS)
+            return 1;
+          #endif
+        }
+      #if defined (WAV_TAGS)
+        else if(!memcmp(hdr,"LIST",4)){ parseListTags(entry, pos, pos + size); }
+        else if(!memcmp(hdr,"id3 ",4) || !memcmp(hdr,"ID3 ",4)){ parseId3Tags(entry, pos); }
+        else if(!memcmp(hdr,"ID3",3)){ parseId3Tags(entry, pos - 8); break; }   //Appended after the last chunk
+      #endif
+        pos += size + (size & 1);   //Chunks are word aligned
+        if(!seek(pos)){ break; }
+    }
+    return entry->dataOffset > 0;
+}
+
+#if defined (WAV_TAGS)
+
+static void setTag(wavIndexEntry* entry, byte tag, unsigned long pos, unsigned long size){
+    if(entry->tagOffset[tag] || size == 0){ return; }
+    entry->tagOffset[tag] = pos;
+    entry->tagLength[tag] = size > 255 ? 255 : size;
+}
+
+//Subchunks of a LIST INFO chunk, the sFile is at its type
+void TMRpcm::parseListTags(wavIndexEntry* entry, unsigned long pos, unsigned long end){
+    byte hdr[8];
+    if(sFile.read(hdr,4) != 4 || memcmp(hdr,"INFO",4)){ return; }
+    pos += 4;
+    while(pos + 8 <= end && sFile.read(hdr,8) == 8){
+        unsigned long size = hdr[4] | (unsigned long)hdr[5] << 8 | (unsigned long)hdr[6] << 16 | (unsigned long)hdr[7] << 24;
+        pos += 8;
+        for(byte i=0; i<3; i++){
+            if(!memcmp(hdr,tagIds[i],4)){ setTag(entry, i, pos, size); }
+        }
+        pos += size + (size & 1);
+        if(!seek(pos)){ return; }
+    }
+}
+
+//Frames of an ID3v2.3 or 2.4 tag starting at pos, only their headers are read
+void TMRpcm::parseId3Tags(wavIndexEntry* entry, unsigned long pos){
+    byte hdr[10];
+    if(!seek(pos) || sFile.read(hdr,10) != 10 || memcmp(hdr,"ID3",3) || hdr[3] < 3 || hdr[3] > 4){ return; }
+    byte version = hdr[3];
+    unsigned long end = pos + 10 + ((unsigned long)hdr[6] << 21 | (unsigned long)hdr[7] << 14 | (unsigned long)hdr[8] << 7 | hdr[9]);
+    pos += 10;
+    if(hdr[5] & 0x40){ //Extended header, its size includes itself in 2.4 only
+        if(sFile.read(hdr,4) != 4){ return; }
+        if(version == 3){ pos += 4 + ((unsigned long)hdr[0] << 24 | (unsigned long)hdr[1] << 16 | (unsigned long)hdr[2] << 8 | hdr[3]); }
+        else{ pos += (unsigned long)hdr[0] << 21 | (unsigned long)hdr[1] << 14 | (unsigned long)hdr[2] << 7 | hdr[3]; }
+    }
+    while(pos + 10 <= end && seek(pos) && sFile.read(hdr,10) == 10 && hdr[0] != 0){   //Zeros: padding
+        unsigned long size;
+        if(version == 3){ size = (unsigned long)hdr[4] << 24 | (unsigned long)hdr[5] << 16 | (unsigned long)hdr[6] << 8 | hdr[7]; }
+        else{ size = (unsigned long)hdr[4] << 21 | (unsigned long)hdr[5] << 14 | (unsigned long)hdr[6] << 7 | hdr[7]; }
+        pos += 10;
+        for(byte i=3; i<WAV_TAG_COUNT; i++){
+            if(!memcmp(hdr,tagIds[i],4)){ setTag(entry, i, pos, size); }
+        }
+        pos += size;
+    }
+}
+
+//Reads a tag found by parseWav() with a single seek. LIST values are copied, ID3 text is
+//taken as Latin-1, one byte of each UTF-16 character. Returns the length, 0 if the file has no such tag
+byte TMRpcm::readTag(wavIndexEntry* entry, byte tag, char* tagData){
+    if(entry->tagOffset[tag] == 0){ return 0; }
+    if(ifOpen()){ noInterrupts();}
+  #if !defined (SDFAT)
+    File xFile = SD.open(entry->name);
+    boolean ok = xFile && xFile.size() == entry->fileSize && xFile.seek(entry->tagOffset[tag]);
+  #else
+    SdFile xFile;
+    boolean ok = xFile.open(entry->name,O_READ) && xFile.fileSize() == entry->fileSize && xFile.seekSet(entry->tagOffset[tag]);
+  #endif
+    byte len = 0;
+    if(ok){
+        byte left = entry->tagLength[tag];
+        byte encoding = 0;
+        if(tag >= 3){ encoding = xFile.read(); left--; }
+        boolean high = 0;   //UTF-16 big endian, the Latin-1 byte comes second
+        if(encoding == 1 && left >= 2){
+            high = xFile.read() == 0xFE; xFile.read(); left -= 2;
+        }else if(encoding == 2){ high = 1; }
+        byte step = (encoding == 1 || encoding == 2) ? 2 : 1;
+        while(left >= step){
+            int c = xFile.read();
+            if(step == 2){
+                int c2 = xFile.read();
+                if(high){ c = c2; }
+            }
+            left -= step;
+            if(c <= 0){ break; }
+            tagData[len++] = c;
+        }
+    }
+    tagData[len] = '\0';
+    xFile.close();
+    if(ifOpen()){ interrupts();}
+    return len;
+}
+
+#endif
+
+//Opens the file and sets up playback from the index, 0 if not indexed or changed since
+boolean TMRpcm::indexInfo(char* filename){
+    wavIndexEntry* entry = findIndex(filename);
+    if(entry == NULL){ return 0; }
+  #if !defined (SDFAT)
+    sFile = SD.open(filename);
+    if(!sFile || sFile.size() != entry->fileSize){ if(sFile){ sFile.close(); } return 0; }
+  #else
+    if(!sFile.open(filename) || sFile.fileSize() != entry->fileSize){ if(sFile.isOpen()){ sFile.close(); } return 0; }
+  #endif
+  #if defined (ADPCM)
+    adpcmEntry = entry->format == 0x11 ? entry : NULL;
+  #endif
+    SAMPLE_RATE = entry->sampleRate;
+    #if defined (USE_TIMER2)
+        if(SAMPLE_RATE < 9000 ){ SR = 0; }
+        else if(SAMPLE_RATE < 20000){ SR = 1; }
+        else if(SAMPLE_RATE < 28000){ SR = 2; }
+        else{ SR = 3; }
+    #endif
+    #if defined (STEREO_OR_16BIT)
+        if(entry->channels == 2){ bitSet(optionByte,4); }
+        else if(entry->bitsPerSample == 16){ bitSet(optionByte,1); bitSet(optionByte,4); }
+        else{ bitClear(optionByte,4); bitClear(optionByte,1); }
+    #endif
+    dataEnd = entry->fileSize - entry->dataOffset - entry->dataLength + buffSize;
+    return seek(entry->dataOffset);
+}
+
+#if defined (PLAYLIST)
+
+//Plays the indexed files back to back. All are opened here, while the card is free, so the buffer
+//interrupt only moves on to the data of the next one. Returns 0 if one is missing or in another format
+boolean TMRpcm::playlist(char** filenames, byte count){
+    stopPlayback();
+    playlistSource.clear();
+    if(count > PLAYLIST){ count = PLAYLIST; }
+    wavIndexEntry* first = NULL;
+    for(byte i=0; i<count; i++){
+        wavIndexEntry* entry = findIndex(filenames[i]);
+        if(entry == NULL || entry->format == 0x11){ break; }   //IMA-ADPCM files can only play alone
+        if(first == NULL){ first = entry; }
+        else if(entry->channels != first->channels || entry->bitsPerSample != first->bitsPerSample){ break; }
+        if(!openWav(&wavSources[i], entry)){ break; }
+        if(!playlistSource.add(&wavSources[i])){ wavSources[i].stop(); break; }
+    }
+    if(playlistSource.count < count || count == 0){
+        playlistSource.stop();
+        return 0;
+    }
+    #if defined (STEREO_OR_16BIT)
+        if(first->channels == 2){ bitSet(optionByte,4); }
+        else if(first->bitsPerSample == 16){ bitSet(optionByte,1); bitSet(optionByte,4); }
+        else{ bitClear(optionByte,4); bitClear(optionByte,1); }
+    #endif
+    #if defined (PCM_FIXED_TIMER)
+    if((optionByte & (_BV(4) | _BV(1))) != pcmPlayer::formatBits){
+        #if defined (debug)
+            Serial.println("WAV FORMAT NOT PCM_FIXED");
+        #endif
+        playlistSource.stop();
+        return 0;
+    }
+    #endif
+    play(&playlistSource);
+    return playing;
+}
+
+//Opens the file of an index entry in its own handle, at its first data byte
+boolean TMRpcm::openWav(pcmWavSource* wav, wavIndexEntry* entry){
+  #if !defined (SDFAT)
+    wav->file = SD.open(entry->name);
+    if(!wav->file){ return 0; }
+    if(wav->file.size() != entry->fileSize){ wav->file.close(); return 0; }
+  #else
+    if(!wav->file.open(entry->name,O_READ)){ return 0; }
+    if(wav->file.fileSize() != entry->fileSize){ wav->file.close(); return 0; }
+  #endif
+    wav->sampleRate = entry->sampleRate;
+    wav->dataStart = entry->dataOffset;
+    wav->dataLength = entry->dataLength;
+    if(!wav->rewind()){ wav->file.close(); return 0; }
+    return 1;
+}
+
+#endif
+
+boolean TMRpcm::loadIndex(){
+    char magic[4];
+  #if !defined (SDFAT)
+    sFile = SD.open(WAV_INDEX_FILE);
+    if(!sFile){ return 0; }
+  #else
+    if(!sFile.open(WAV_INDEX_FILE,O_READ)){ return 0; }
+  #endif
+    indexCount = 0;
+    if(sFile.read(magic,4) == 4 && !memcmp(magic,indexMagic,4)){
+        byte count = sFile.read();
+        if(count > WAV_INDEX){ count = WAV_INDEX; }
+        if(sFile.read(wavIndex,count * sizeof(wavIndexEntry)) == (int)(count * sizeof(wavIndexEntry))){
+            indexCount = count;
+        }
+    }
+    sFile.close();
+    return indexCount > 0;
+}
+
+void TMRpcm::saveIndex(){
+  #if !defined (SDFAT)
+    if(SD.exists(WAV_INDEX_FILE)){ SD.remove(WAV_INDEX_FILE); }
+    sFile = SD.open(WAV_INDEX_FILE,FILE_WRITE);
+    if(!sFile){ return; }
+  #else
+    if(!sFile.open(WAV_INDEX_FILE,O_CREAT | O_WRITE | O_TRUNC)){ return; }
+  #endif
+    sFile.write((byte*)indexMagic,4);
+    sFile.write(indexCount);
+    sFile.write((byte*)wavIndex,indexCount * sizeof(wavIndexEntry));
+    sFile.close();
+}
+
+#endif
+
+#if defined (PLAY_QUEUE)
+
+//Plays the source now if nothing plays. While playing, a higher priority source replaces the
+//playing one at the next buffer boundary, otherwise it is queued and follows without a gap.
+//Returns 0 if the source was dropped: queue full, or other sample rate than the playing source
+boolean TMRpcm::play(pcmSource* source, byte priority){
+    if(source == NULL){ return 0; }
+    if(!playing || activeSource == NULL){
+        play(source);
+        activePriority = priority;
+        return playing;
+    }
+    if(source->sampleRate != SAMPLE_RATE){ return 0; }
+
+    noInterrupts();
+    if(priority > getPriority()){
+        //A lower pending source is dropped, its message would be stale too
+        pendingPriority = priority;
+        pendingSource = source;
+        interrupts();
+        return 1;
+    }
+    byte i = queueCount;
+    if(i >= PLAY_QUEUE){
+        if(queuePriority[PLAY_QUEUE-1] >= priority){ interrupts(); return 0; }
+        i = PLAY_QUEUE-1;   //Drop the lowest one
+    }else{ queueCount++; }
+    while(i > 0 && queuePriority[i-1] < priority){
+        queueSource[i] = queueSource[i-1]; queuePriority[i] = queuePriority[i-1];
+        i--;
+    }
+    queueSource[i] = source; queuePriority[i] = priority;
+    interrupts();
+    return 1;
+}
+
+//Priority of the playing source, or of the one about to cut in. 0 when stopped
+byte TMRpcm::getPriority(){
+    if(!playing){ return 0; }
+    return pendingSource ? pendingPriority : activePriority;
+}
+
+//Called from the buffer interrupt only
+pcmSource* popQueue(){
+    pcmSource* src = queueSource[0];
+    activePriority = queuePriority[0];
+    byte count = queueCount - 1;
+    for(byte i=0; i<count; i++){ queueSource[i] = queueSource[i+1]; queuePriority[i] = queuePriority[i+1]; }
+    queueCount = count;
+    return src;
+}
+
+#endif
+
+#if defined (MEMORY_CLIPS)
+
+//*** Clips preloaded into RAM or compiled into PROGMEM, played without SD access ***
+
+pcmClip* TMRpcm::addClip(const byte* data, unsigned long length, unsigned int sampleRate, byte location){
+    if(clipCount >= MEMORY_CLIPS || length == 0){ return NULL; }
+    clipSources[clipCount].begin(data, length, sampleRate, location);
+    pcmClip* clip = &clips[clipCount++];
+    clip->data = data;
+    clip->farData = (uintptr_t)data;
+    clip->length = length;
+    clip->sampleRate = sampleRate;
+    clip->location = location;
+    return clip;
+}
+
+//progmemData from pgm_get_far_address(), anywhere in the flash
+pcmClip* TMRpcm::addClip(uint_farptr_t progmemData, unsigned long length, unsigned int sampleRate){
+    pcmClip* clip = addClip(NULL, length, sampleRate, CLIP_IN_PROGMEM);
+    if(clip == NULL){ return NULL; }
+    clipSources[clip - clips].beginProgmem(progmemData, length, sampleRate);
+    clip->farData = progmemData;
+    return clip;
+}
+
+pcmClip* TMRpcm::loadClip(char* filename, byte* ram, unsigned int maxLength){
+    stopPlayback();
+    if(!wavInfo(filename)){
+        #if defined (debug)
+            Serial.println("CLIP ERROR");
+        #endif
+        if(ifOpen()){ sFile.close(); }
+        return NULL;
+    }
+    //Up to the chunks after the samples (LIST, id3), dataEnd counts them plus buffSize.
+    //From the file size, available() stops at 32767 on the SD library
+    #if !defined (SDFAT)
+        unsigned long length = sFile.size() - fPosition();
+    #else
+        unsigned long length = sFile.fileSize() - fPosition();
+    #endif
+    unsigned long trailing = dataEnd - buffSize;
+    length = length > trailing ? length - trailing : 0;
+    if(length > maxLength){ length = maxLength; }
+    length = sFile.read(ram,length);
+    sFile.close();
+    return addClip(ram, length, SAMPLE_RATE, CLIP_IN_RAM);
+}
+
+//The source of a clip registered with addClip() or loadClip(), NULL for other clips
+pcmSource* clipToSource(pcmClip* clip){
+    if(clip < clips || clip >= clips + clipCount){ return NULL; }
+    return &clipSources[clip - clips];
+}
+
+void TMRpcm::play(pcmClip* clip){
+    if(clip == NULL){ return; }
+    pcmSource* src = clipToSource(clip);
+    if(src == NULL){
+        stopPlayback();
+        if(clip->location == CLIP_IN_PROGMEM){ clipSource.beginProgmem(clip->farData, clip->length, clip->sampleRate); }
+        else{ clipSource.begin(clip->data, clip->length, clip->sampleRate, clip->location); }
+        src = &clipSource;
+    }
+    play(src);
+}
+
+#if defined (PLAY_QUEUE)
+//Only registered clips can be queued, each has its own source
+boolean TMRpcm::play(pcmClip* clip, byte priority){
+    return play(clipToSource(clip), priority);
+}
+#endif
+
+#endif
+
+void TMRpcm::startPlayback(byte tmp){
     playing = 1; bitClear(optionByte,7); //paused = 0;
+    #if defined (PCM_STATS)
+        playStartMillis = millis(); statPlaying = 1;
+    #endif
 
     if(SAMPLE_RATE > 45050 ){ SAMPLE_RATE = 24000;
     #if defined (debug)
@@ -488,6 +1198,8 @@ void TMRpcm::play(char* filename, unsigned long seekPoint){
         Serial.println(SAMPLE_RATE);
     #endif
     }
+    spiSampleRate = SAMPLE_RATE;
+    pcmSpiRegister(PCM_SPI_AUDIO, audioCanWait, audioHold, audioResume);
 
 #if !defined (USE_TIMER2)
     //if(qual)
@@ -504,7 +1216,6 @@ void TMRpcm::play(char* filename, unsigned long seekPoint){
         *TCCRnB[tt] |= _BV(CS20);
     }
 #endif
-    byte tmp = (sFile.read() + sFile.peek()) / 2;
 
     #if defined(rampMega)
     if(bitRead(optionByte,5)){
@@ -513,7 +1224,7 @@ void TMRpcm::play(char* filename, unsigned long seekPoint){
             timerSt();
             for(unsigned int i=0; i < resolution; i++){
 
-                *OCRnB[tt] = constrain(resolution-i,0,resolution);
+                *OCRnB[tt] = resolution-i;  //1 to resolution
 
             //if(bitRead(*TCCRnB[tt],0)){
             //  for(int i=0; i<10; i++){
@@ -529,8 +1240,13 @@ void TMRpcm::play(char* filename, unsigned long seekPoint){
     #endif
 
     //rampUp = 0;
-    unsigned int mod;
-    if(volMod > 0){ mod = *OCRnA[tt] >> volMod; }else{ mod = *OCRnA[tt] << (volMod*-1); }
+    PCM_TRACE(TRACE_RAMP,0);
+    #if defined (ENABLE_TRACE)
+        traceFirstSample = 1;
+    #endif
+    if(!volTableReady){ buildVolTable(); }
+    unsigned int mod = 0;
+    if(volGain){ mod = ((unsigned long)*OCRnA[tt] << 8) / volGain; }
     if(tmp > mod){
         for(unsigned int i=0; i<buffSize; i++){ mod = constrain(mod+1,mod, tmp); buffer[0][i] = mod; }
         for(unsigned int i=0; i<buffSize; i++){ mod = constrain(mod+1,mod, tmp); buffer[1][i] = mod; }
@@ -556,15 +1272,63 @@ void TMRpcm::volume(char upDown){
   }else{
       volMod--;
   }
+  volModToGain();
 }
 
 void TMRpcm::setVolume(char vol) {
     volMod = vol - 4 ;
+    volModToGain();
+}
+
+//Finer steps than volume(): gain in 1/256, 256 is the level of setVolume(4), 512 of setVolume(5)
+void TMRpcm::setGain(unsigned int gain){
+    volGain = gain;
+    buildVolTable();
+}
+
+#if defined (PCM_STATS)
+
+//A consistent copy of the counters, with the averages computed
+pcmStats TMRpcm::stats(){
+    noInterrupts();
+    pcmStats copy = stat;
+    boolean isPlaying = statPlaying;
+    unsigned long start = playStartMillis;
+    interrupts();
+    unsigned long now = millis();
+    if(isPlaying){ copy.playingMillis += now - start; }
+    copy.totalMillis = now - statStartMillis;
+    if(copy.refills){ copy.refillAvgMicros = copy.refillTotalMicros / copy.refills; }
+    if(copy.totalMillis){ copy.dutyPercent = (copy.playingMillis * 100) / copy.totalMillis; }
+    return copy;
+}
+
+void TMRpcm::resetStats(){
+    noInterrupts();
+    memset(&stat, 0, sizeof(stat));
+    statStartMillis = millis();
+    if(statPlaying){ playStartMillis = statStartMillis; }
+    interrupts();
 }
 
+#endif
+
 #if defined (ENABLE_RECORDING)
 
   ISR(TIMER1_COMPA_vect){
+    #if defined (RECORD_RAW)
+        //One block per interrupt, the sample interrupt keeps filling the ring meanwhile
+        if(recordFilled){
+            *TIMSK[tt] &= ~(_BV(OCIE1A));
+            sei();
+            if(recordBlock <= recordLastBlock && recordCard->writeData(recordRing[recordTail])){ recordBlock++; }
+            else{ recordDrops += 512; }
+            recordTail = recordTail + 1 < RECORD_RAW_BLOCKS ? recordTail + 1 : 0;
+            noInterrupts();
+            recordFilled--;
+            *TIMSK[tt] |= _BV(OCIE1A);  //Interrupts are enabled again on return
+        }
+    #else
         if(buffEmpty[!whichBuff] == 0){
             a = !whichBuff;
             *TIMSK[tt] &= ~(_BV(OCIE1A));
@@ -573,14 +1337,32 @@ void TMRpcm::setVolume(char vol) {
             buffEmpty[a] = 1;
             *TIMSK[tt] |= _BV(OCIE1A);
         }
+    #endif
   }
 #endif
 
-#if !defined (USE_TIMER2) //Not using TIMER2
-ISR(TIMER1_CAPT_vect){
-#else                     //Using TIMER2
-ISR(TIMER2_COMPB_vect){
-#endif
+//1 if the playing source, or one taking over in the next buffer, reads the SD card
+static inline boolean refillOnCard(){
+    pcmSource* src = activeSource;
+    if(src && src->onCard){ return 1; }
+    #if defined (PLAY_QUEUE)
+    src = pendingSource;
+    if(src && src->onCard){ return 1; }
+    for(byte i=0; i<queueCount; i++){
+        if(queueSource[i]->onCard){ return 1; }
+    }
+    #endif
+    return 0;
+}
+
+//*** Mask register of the timer selected at runtime by setPin() ***
+struct pcmTimerTT {
+    static inline volatile byte& timsk(){ return *TIMSK[tt]; }
+};
+
+//Body of the buffer interrupt, Timer gives its mask register
+template<class Timer> static inline void refillBuffers() __attribute__((always_inline));
+template<class Timer> static inline void refillBuffers(){
 
   // The first step is to disable this interrupt before manually enabling global interrupts.
   // This allows this interrupt vector (COMPB) to continue loading data while allowing the overflow interrupt
@@ -589,32 +1371,104 @@ ISR(TIMER2_COMPB_vect){
  //Then enable global interupts before this interrupt is finished, so the music can interrupt the buffering
   //sei();
 
-    if(buffEmpty[!whichBuff]){
+    if(!buffEmpty[!whichBuff]){ return; }
+    //Tones and clips in memory refill without the SPI bus. Otherwise retried on the next interrupt
+    //while another SPI client has it
+    boolean onCard = refillOnCard();
+    if(!onCard || pcmSpiBegin(PCM_SPI_AUDIO)){
 
         a = !whichBuff;
-        *TIMSK[tt] &= ~togByte;
+        Timer::timsk() &= ~togByte;
         sei();
+        #if defined (PCM_STATS)
+            unsigned long refillStart = micros();
+        #endif
 
-        if( sFile.available() <= dataEnd){
+        pcmSource* src = activeSource;
+        unsigned int len = 0;
+        #if defined (PLAY_QUEUE)
+        boolean fade = 0;
+        if(pendingSource){
+            if(src){ src->stop(); }
+            src = activeSource = pendingSource;
+            activePriority = pendingPriority;
+            pendingSource = NULL;
+            src->rewind();
+            fade = 1;
+        }
+        #endif
+        if(src){
+            len = src->fill((byte*)buffer[a],buffSize);
+            if(len < buffSize && bitRead(optionByte,3) && src->rewind()){
+                len += src->fill((byte*)buffer[a]+len,buffSize-len);
+            }
+        }
+        #if defined (PLAY_QUEUE)
+        //Continue with the next queued source in the same buffer, without a gap
+        while(len < buffSize && queueCount){
+            if(src){ src->stop(); }
+            src = activeSource = popQueue();
+            src->rewind();
+            len += src->fill((byte*)buffer[a]+len,buffSize-len);
+        }
+        //Fade from the last sample of the playing buffer, the output is never ramped down
+        if(fade && len){
+            int last = buffer[!a][buffSize-1];
+            for(unsigned int i=0; i<CROSSFADE_SAMPLES && i<len; i++){
+                buffer[a][i] = last + (((int)buffer[a][i] - last) * (int)i) / CROSSFADE_SAMPLES;
+            }
+        }
+        #endif
+        if(onCard){ pcmSpiEnd(PCM_SPI_AUDIO, len); }
+
+        #if defined (PCM_STATS)
+        unsigned int refillMicros = micros() - refillStart;
+        stat.refills++;
+        stat.refillTotalMicros += refillMicros;
+        if(refillMicros > stat.refillMaxMicros){ stat.refillMaxMicros = refillMicros; }
+        #if defined (SD_RAW_READ)
+        if(src == &fileSource || src == &rawSource){
+        #else
+        if(src == &fileSource){
+        #endif
+            byte bucket = 0;
+            for(unsigned int t = 500; bucket < PCM_STATS_SD_BUCKETS-1 && refillMicros >= t; t <<= 1){ bucket++; }
+            stat.sdRefills[bucket]++;
+        }
+        #endif
 
-            #if !defined (SDFAT)
-                if(bitRead(optionByte,3)){ sFile.seek(44); *TIMSK[tt] |= togByte; return;}
-                *TIMSK[tt] &= ~( togByte | _BV(TOIE1) );
-                if(sFile){ sFile.close();}
-            #else
-                if(bitRead(optionByte,3)){ sFile.seekSet(44); *TIMSK[tt] |= togByte; return;}
-                *TIMSK[tt] &= ~( togByte | _BV(TOIE1) );
-                if(sFile.isOpen()){ sFile.close();}
-            #endif
+        if(len == 0){
+            Timer::timsk() &= ~( togByte | _BV(TOIE1) );
+            if(src){ src->stop(); }
+            activeSource = NULL;
             playing = 0;
+            #if defined (PCM_STATS)
+                statsEndPlay();
+            #endif
             return;
         }
-        sFile.read((byte*)buffer[a],buffSize);
+        //Pad a short last buffer with its last sample to avoid a click
+        for(unsigned int i=len; i<buffSize; i++){ buffer[a][i] = buffer[a][len-1]; }
             buffEmpty[a] = 0;
-            *TIMSK[tt] |= togByte;
+            Timer::timsk() |= togByte;
     }
 }
 
+#if defined (PCM_FIXED_TIMER)
+template<class Timer, byte Channels, byte Bits, bool Quality>
+void TMRpcmT<Timer,Channels,Bits,Quality>::refillInterrupt(){
+    refillBuffers<Timer>();
+}
+#elif !defined (USE_TIMER2) //Not using TIMER2
+ISR(TIMER1_CAPT_vect){
+    refillBuffers<pcmTimerTT>();
+}
+#else                     //Using TIMER2
+ISR(TIMER2_COMPB_vect){
+    refillBuffers<pcmTimerTT>();
+}
+#endif
+
 #if defined(USE_TIMER2)
 
     ISR(TIMER2_OVF_vect){
@@ -628,14 +1482,18 @@ ISR(TIMER2_COMPB_vect){
         }
         loadCounter++;
 
-        if(volMod < 0 ){  *OCRnB[tt] = buffer[whichBuff][buffCount] >> (volMod*-1);
-        }else{            *OCRnB[tt] = buffer[whichBuff][buffCount] << volMod;
-        }
+        *OCRnB[tt] = volTable[buffer[whichBuff][buffCount]];
         ++buffCount;
+        #if defined (ENABLE_TRACE)
+            if(traceFirstSample){ traceFirstSample = 0; pcmTrace(TRACE_FIRST_SAMPLE,0); }
+        #endif
           if(buffCount >= buffSize){
           buffCount = 0;
           buffEmpty[whichBuff] = true;
           whichBuff = !whichBuff;
+          #if defined (PCM_STATS)
+            if(buffEmpty[whichBuff]){ stat.underruns++; }
+          #endif
         }
     }
 
@@ -644,11 +1502,25 @@ ISR(TIMER2_COMPB_vect){
 #if defined (ENABLE_RECORDING)
   ISR(TIMER1_COMPB_vect){
 
+  #if defined (RECORD_RAW)
+    byte sample = ADCH;
+    if(recording > 1){
+        *OCRnA[tt] = volTable[sample];
+    }
+    if(recording < 3){
+        if(recordFilled < RECORD_RAW_BLOCKS){
+            recordRing[recordHead][recordCount] = sample;
+            if(++recordCount >= 512){
+                recordCount = 0;
+                recordHead = recordHead + 1 < RECORD_RAW_BLOCKS ? recordHead + 1 : 0;
+                recordFilled++;
+            }
+        }else{ recordDrops++; }
+    }
+  #else
     buffer[whichBuff][buffCount] = ADCH;
     if(recording > 1){
-        if(volMod < 0 ){  *OCRnA[tt] = ADCH >> (volMod*-1);
-        }else{            *OCRnA[tt] = ADCH << volMod;
-        }
+        *OCRnA[tt] = volTable[ADCH];
     }
         buffCount++;
         if(buffCount >= buffSize){
@@ -656,10 +1528,12 @@ ISR(TIMER2_COMPB_vect){
             buffEmpty[!whichBuff] = 0;
             whichBuff = !whichBuff;
         }
+  #endif
   }
 
 #endif
 
+#if !defined (PCM_FIXED_TIMER)
 ISR(TIMER1_OVF_vect){
 
 
@@ -668,10 +1542,11 @@ ISR(TIMER1_OVF_vect){
     #if defined (STEREO_OR_16BIT)
     if( !bitRead(optionByte,4) ){
     #endif
-        if(volMod < 0 ){  *OCRnA[tt] = *OCRnB[tt] = buffer[whichBuff][buffCount] >> (volMod*-1);
-        }else{            *OCRnA[tt] = *OCRnB[tt] = buffer[whichBuff][buffCount] << volMod;
-        }
+        *OCRnA[tt] = *OCRnB[tt] = volTable[buffer[whichBuff][buffCount]];
         ++buffCount;
+        #if defined (ENABLE_TRACE)
+            if(traceFirstSample){ traceFirstSample = 0; pcmTrace(TRACE_FIRST_SAMPLE,0); }
+        #endif
 
     #if defined (STEREO_OR_16BIT)
     }else{
@@ -680,33 +1555,81 @@ ISR(TIMER1_OVF_vect){
             //buffer[whichBuff][buffCount+1] += 127;
         }
         #if !defined (MODE2)
-            if(volMod < 0 ){ *OCRnA[tt] = buffer[whichBuff][buffCount] >> (volMod*-1);
-                             *OCRnB[tt] = buffer[whichBuff][buffCount+1] >> (volMod*-1);
-
-            }else{           *OCRnA[tt] = buffer[whichBuff][buffCount] << volMod;
-                             *OCRnB[tt] = buffer[whichBuff][buffCount+1] << volMod;
-            }
+            *OCRnA[tt] = volTable[buffer[whichBuff][buffCount]];
+            *OCRnB[tt] = volTable[buffer[whichBuff][buffCount+1]];
         #else
-            if(volMod < 0 ){
-                             *OCRnA[tt] = *OCRnB[tt] = buffer[whichBuff][buffCount] >> (volMod*-1);
-                             *OCRnA[tt2] = *OCRnB[tt2] =buffer[whichBuff][buffCount+1] >> (volMod*-1);
+            *OCRnA[tt] = *OCRnB[tt] = volTable[buffer[whichBuff][buffCount]];
+            *OCRnA[tt2] = *OCRnB[tt2] = volTable[buffer[whichBuff][buffCount+1]];
+        #endif
+        buffCount+=2;
+    }
+    #endif
 
-            }else{           *OCRnA[tt] = *OCRnB[tt] = buffer[whichBuff][buffCount] << volMod;
-                             *OCRnA[tt2] = *OCRnB[tt2] = buffer[whichBuff][buffCount+1] << volMod;
-            }
+    if(buffCount >= buffSize){
+      buffCount = 0;
+      buffEmpty[whichBuff] = true;
+      whichBuff = !whichBuff;
+      #if defined (PCM_STATS)
+        if(buffEmpty[whichBuff]){ stat.underruns++; }
+      #endif
+    }
+    #if defined (PCM_STATS)
+        unsigned int ticks = *TCNT[tt];
+        if(ticks > stat.sampleMaxTicks){ stat.sampleMaxTicks = ticks; }
+    #endif
+}
+
+#else //PCM_FIXED_TIMER
+
+//The same as above with the registers and the format known to the compiler
+template<class Timer, byte Channels, byte Bits, bool Quality>
+void TMRpcmT<Timer,Channels,Bits,Quality>::sampleInterrupt(){
 
+    if(Quality){loadCounter = !loadCounter;if(loadCounter){ return; } }
+
+    if(Channels == 1 && Bits == 8){
+        unsigned int out = volTable[buffer[whichBuff][buffCount]];
+        Timer::ocra() = out;
+        #if !defined (DISABLE_SPEAKER2)
+            Timer::ocrb() = out;
+        #endif
+        ++buffCount;
+    }else{
+        if(Bits == 16){ buffer[whichBuff][buffCount] += 127; }
+        Timer::ocra() = volTable[buffer[whichBuff][buffCount]];
+        #if !defined (DISABLE_SPEAKER2)
+            Timer::ocrb() = volTable[buffer[whichBuff][buffCount+1]];
         #endif
         buffCount+=2;
     }
+    #if defined (ENABLE_TRACE)
+        if(traceFirstSample){ traceFirstSample = 0; pcmTrace(TRACE_FIRST_SAMPLE,0); }
     #endif
 
     if(buffCount >= buffSize){
       buffCount = 0;
       buffEmpty[whichBuff] = true;
       whichBuff = !whichBuff;
+      #if defined (PCM_STATS)
+        if(buffEmpty[whichBuff]){ stat.underruns++; }
+      #endif
     }
+    #if defined (PCM_STATS)
+        unsigned int ticks = Timer::tcnt();
+        if(ticks > stat.sampleMaxTicks){ stat.sampleMaxTicks = ticks; }
+    #endif
 }
 
+ISR(PCM_TIMER_VECT(PCM_FIXED_TIMER,OVF)){
+    pcmPlayer::sampleInterrupt();
+}
+
+ISR(PCM_TIMER_VECT(PCM_FIXED_TIMER,CAPT)){
+    pcmPlayer::refillInterrupt();
+}
+
+#endif //PCM_FIXED_TIMER
+
 #endif
 
 
@@ -714,16 +1637,23 @@ ISR(TIMER1_OVF_vect){
 void TMRpcm::disable(){
     playing = 0;
     *TIMSK[tt] &= ~( togByte | _BV(TOIE1) );
+    if(activeSource){ activeSource->stop(); activeSource = NULL; }
+    #if defined (PCM_STATS)
+        statsEndPlay();
+    #endif
+    #if defined (PLAY_QUEUE)
+        pendingSource = NULL; queueCount = 0; activePriority = 0;
+    #endif
     if(ifOpen()){ sFile.close();}
     if(bitRead(*TCCRnA[tt],7) > 0){
         int current = *OCRnA[tt];
-        for(int i=0; i < resolution; i++){
+        for(int i=0; i < (int)resolution; i++){
             #if defined(rampMega)
-                *OCRnB[tt] = constrain((current + i),0,resolution);
-                *OCRnA[tt] = constrain((current - i),0,resolution);
+                *OCRnB[tt] = constrain((current + i),0,(int)resolution);
+                *OCRnA[tt] = constrain((current - i),0,(int)resolution);
             #else
-                *OCRnB[tt] = constrain((current - i),0,resolution);
-                *OCRnA[tt] = constrain((current - i),0,resolution);
+                *OCRnB[tt] = constrain((current - i),0,(int)resolution);
+                *OCRnA[tt] = constrain((current - i),0,(int)resolution);
             #endif
             for(int i=0; i<10; i++){ while(*TCNT[tt] < resolution-50){} }
         }
@@ -739,6 +1669,57 @@ boolean TMRpcm::isPlaying(){
     return playing;
 }
 
+//The PWM output keeps running between two sounds until disable() ramps it down and stops the timer
+boolean TMRpcm::isOutputOn(){
+    return bitRead(*TCCRnA[tt],7);
+}
+
+//*** The buffer interrupt as PCM_SPI_AUDIO client of pcmSpi ***
+
+//1 if nothing plays from the card, or if both buffers are full and the playing one lasts at least micros more
+boolean audioCanWait(unsigned int micros){
+    if(!refillOnCard()){ return 1; }
+    #if defined (SD_RAW_READ)
+        if(activeSource == &rawSource){ return 0; } //In a multi-block read
+    #endif
+    //Samples played in that time, computed before the interrupts are held
+    unsigned int needed = ((unsigned long)micros * spiSampleRate) / 1000000UL + 1;
+    if(bitRead(optionByte,4)){ needed <<= 1; }
+    noInterrupts();
+    boolean ok = !playing || (!buffEmpty[0] && !buffEmpty[1] && (unsigned int)(buffSize - buffCount) >= needed);
+    interrupts();
+    return ok;
+}
+
+//Called with the interrupts disabled. A source off the card keeps refilling while another client has the bus
+void audioHold(){
+    if(playing && refillOnCard()){ *TIMSK[tt] &= ~togByte; }
+}
+
+void audioResume(){
+    if(playing){ *TIMSK[tt] |= togByte; }
+}
+
+//The SD card is shared with the buffer interrupt: a PCM_SPI_LOG request to pcmSpi. The buffer interrupt is
+//held off until releaseCard(), and the card can be used for micros
+boolean TMRpcm::claimCard(unsigned int micros){
+    return pcmSpiAcquire(PCM_SPI_LOG, micros);
+}
+
+void TMRpcm::releaseCard(){
+    pcmSpiRelease(PCM_SPI_LOG, 0);
+}
+
+//What one buffer plays at the playing rate, more can never be granted by audioCanWait(). 0xFFFF if nothing
+//plays from the card
+unsigned int TMRpcm::cardWaitMicros(){
+    if(!playing || !refillOnCard()){ return 0xFFFF; }
+    unsigned long samples = buffSize;
+    if(bitRead(optionByte,4)){ samples >>= 1; }
+    samples = samples * 1000000UL / spiSampleRate;
+    return samples > 0xFFFF ? 0xFFFF : samples;
+}
+
 
 
 //***************************************************************************************
@@ -782,9 +1763,9 @@ void TMRpcm::play(char* filename, unsigned long seekPoint, boolean which){
         //rampUp = 0;
         bitClear(optionByte,5);
         for(unsigned int i=0; i < resolution; i++){
-            *OCRnB[tt] = constrain(resolution-i,0,resolution);
+            *OCRnB[tt] = resolution-i;
             #if defined (MODE2)
-                *OCRnB[tt2] = constrain(resolution-i,0,resolution);
+                *OCRnB[tt2] = resolution-i;
             #endif
             delayMicroseconds(50);
 
@@ -1295,7 +2276,6 @@ boolean TMRpcm::searchMainTags(File xFile, char *datStr){
 unsigned long TMRpcm::searchMainTags(SdFile xFile, char *datStr){
     xFile.seekSet(36);
 #endif
-        boolean found = 0;
         char dChars[4] = {'d','a','t','a'};
         char tmpChars[4];
 
@@ -1347,7 +2327,6 @@ unsigned long TMRpcm::searchMainTags(SdFile xFile, char *datStr){
             if(xFile.read() == datStr[0] && xFile.peek() == datStr[1]){
                 xFile.read((char*)tmpChars,3);
                 if( tmpChars[1] == datStr[2] &&  tmpChars[2] == datStr[3] ){
-                        found = 1;
                         #if !defined (SDFAT)
                             return 1; break;
                         #else
@@ -1371,6 +2350,10 @@ unsigned long TMRpcm::searchMainTags(SdFile xFile, char *datStr){
 
 byte TMRpcm::metaInfo(boolean infoType, char* filename, char* tagData, byte whichInfo){
 
+    #if defined (WAV_TAGS)
+        wavIndexEntry* entry = findIndex(filename);
+        if(entry != NULL){ return readTag(entry, infoType * 3 + whichInfo, tagData); }
+    #endif
 
     if(ifOpen()){ noInterrupts();}
 
@@ -1385,8 +2368,8 @@ byte TMRpcm::metaInfo(boolean infoType, char* filename, char* tagData, byte whic
     #endif
 
     boolean found=0;
-        char* datStr = "LIST";
-        if(infoType == 1){datStr = "ID3 "; datStr[3] = 3;}
+        char datStr[4] = {'L','I','S','T'};
+        if(infoType == 1){ memcpy(datStr,"ID3\x03",4); }
         char tmpChars[4];
 
     if(infoType == 0){ //if requesting LIST info, check for data at beginning of file first
@@ -1414,7 +2397,7 @@ byte TMRpcm::metaInfo(boolean infoType, char* filename, char* tagData, byte whic
 
     unsigned long listEnd;
     unsigned int listLen;
-    char* tagNames[] = {"INAM","IART","IPRD"};
+    const char* tagNames[] = {"INAM","IART","IPRD"};
 
     if(infoType == 0){ //LIST format
         listLen = xFile.read(); listLen = xFile.read() << 8 | listLen;
@@ -1433,7 +2416,7 @@ byte TMRpcm::metaInfo(boolean infoType, char* filename, char* tagData, byte whic
         #else
             xFile.seekSet(xFile.curPosition() + 5);
         #endif
-            listLen = xFile.read() << 7 | listLen; listLen = xFile.read() | listLen;
+            listLen = xFile.read() << 7; listLen = xFile.read() | listLen;
             tagNames[0] = "TPE1"; tagNames[1] ="TIT2"; tagNames[2] ="TALB";
         #if !defined (SDFAT)
             listEnd = xFile.position() + listLen;
@@ -1493,10 +2476,9 @@ byte TMRpcm::metaInfo(boolean infoType, char* filename, char* tagData, byte whic
             }else{
                 if(p==3){
                     if(infoType == 1){
-                        byte junk;
                         for(byte j=0; j<len; j++){
                             tagData[j] = xFile.read();
-                            junk=xFile.read();
+                            xFile.read();   //High byte of the UTF-16 character
                         }
                     }else{
                         xFile.read((char*)tagData,len);
@@ -1572,9 +2554,8 @@ void TMRpcm::finalizeWavTemplate(char* filename){
 
 
 
-    seek(4); byte data[4] = {lowByte(fSize),highByte(fSize), fSize >> 16,fSize >> 24};
+    seek(4); byte data[4] = {lowByte(fSize),highByte(fSize), (byte)(fSize >> 16),(byte)(fSize >> 24)};
     sFile.write(data,4);
-    byte tmp;
     seek(40);
     fSize = fSize - 36;
     data[0] = lowByte(fSize); data[1]=highByte(fSize);data[2]=fSize >> 16;data[3]=fSize >> 24;
@@ -1665,7 +2646,13 @@ void TMRpcm::startRecording(char *fileName, unsigned int SAMPLE_RATE, byte pin,
 
     recording = passThrough + 1;
     setPin();
+    #if !defined (ENABLE_MULTI)
+        if(!volTableReady){ buildVolTable(); }
+    #endif
     if(recording < 3){
+      #if defined (RECORD_RAW)
+        if(!openRecording(fileName, SAMPLE_RATE)){ recording = 0; return; }
+      #else
         //*** Creates a blank WAV template file. Data can be written starting at the 45th byte ***
         createWavTemplate(fileName, SAMPLE_RATE);
 
@@ -1689,6 +2676,7 @@ void TMRpcm::startRecording(char *fileName, unsigned int SAMPLE_RATE, byte pin,
 
       #endif
     seek(44);
+      #endif
     }
     buffCount = 0; buffEmpty[0] = 1; buffEmpty[1] = 1;
 
@@ -1757,6 +2745,10 @@ void TMRpcm::stopRecording(char *fileName){
 
     if(recording == 1 || recording == 2){
         recording = 0;
+      #if defined (RECORD_RAW)
+        closeRecording();
+        return;
+      #endif
         unsigned long position = fPosition();
         #if defined (SDFAT)
             sFile.truncate(position);
@@ -1767,6 +2759,105 @@ void TMRpcm::stopRecording(char *fileName){
 }
 
 
+#if defined (RECORD_RAW)
+
+//*** Header of one block: RIFF, fmt and a JUNK chunk filled with silence, so the data starts at byte 512 ***
+//*** Players which expect the data at byte 44 only play 460 samples of silence first ***
+void wavHeaderBlock(byte* block, unsigned int sampleRate, unsigned long dataBytes){
+    memset(block, 0x80, 512);
+    unsigned long riffSize = 504 + dataBytes;
+    memcpy(block, "RIFF", 4);
+    memcpy(block+4, &riffSize, 4);
+    memcpy(block+8, "WAVEfmt ", 8);
+    byte fmt[20] = {16,0,0,0, 1,0, 1,0, lowByte(sampleRate),highByte(sampleRate),0,0,
+                    lowByte(sampleRate),highByte(sampleRate),0,0, 1,0, 8,0};    //PCM, mono, byte rate, align 1, 8 bits
+    memcpy(block+16, fmt, 20);
+    unsigned long junkSize = 460;
+    memcpy(block+36, "JUNK", 4);
+    memcpy(block+40, &junkSize, 4);
+    memcpy(block+504, "data", 4);
+    memcpy(block+508, &dataBytes, 4);
+}
+
+//Allocates a contiguous file of BLOCK_COUNT blocks, can take a few seconds. Call it at boot, then
+//startRecording() on this file starts at once. An existing contiguous file of that size is kept
+boolean TMRpcm::prepareRecording(char* fileName){
+    disable();
+    uint32_t bgnBlock, endBlock;
+    if(sFile.open(fileName, O_READ)){
+        boolean ok = sFile.contiguousRange(&bgnBlock, &endBlock) && endBlock - bgnBlock + 1 >= BLOCK_COUNT
+                     && sFile.fileSize() >= BLOCK_COUNT * 512;
+        sFile.close();
+        if(ok){ return 1; }
+        sFile.remove(fileName);
+    }
+    if(!sFile.createContiguous(SdBaseFile::cwd(), fileName, BLOCK_COUNT * 512)){
+        #if defined (debug)
+            Serial.println("failed to allocate");
+        #endif
+        return 0;
+    }
+    sFile.close();
+    return 1;
+}
+
+//A file too short for BLOCK_COUNT, e.g. left by createWavTemplate(), is allocated again: the blocks past
+//its end would be lost
+boolean TMRpcm::openRecording(char* fileName, unsigned int sampleRate){
+    uint32_t bgnBlock, endBlock;
+    if(!sFile.open(fileName, O_RDWR) || !sFile.contiguousRange(&bgnBlock, &endBlock)
+       || endBlock - bgnBlock + 1 < BLOCK_COUNT || sFile.fileSize() < BLOCK_COUNT * 512){
+        if(sFile.isOpen()){ sFile.close(); }
+        if(!prepareRecording(fileName) || !sFile.open(fileName, O_RDWR) || !sFile.contiguousRange(&bgnBlock, &endBlock)){ return 0; }
+    }
+    recordCard = sFile.volume()->sdCard();
+    recordFirstBlock = bgnBlock;
+    recordLastBlock = endBlock;
+    recordRate = sampleRate;
+    //No length yet: a recording cut by a reset still opens, up to the end of the file
+    wavHeaderBlock(recordRing[0], sampleRate, (endBlock - bgnBlock) * 512);
+    if(!recordCard->writeBlock(bgnBlock, recordRing[0])
+       || !recordCard->writeStart(bgnBlock + 1, endBlock - bgnBlock)){ sFile.close(); return 0; }
+    recordBlock = bgnBlock + 1;
+    recordHead = recordTail = recordFilled = 0;
+    recordCount = 0;
+    recordDrops = 0;
+    return 1;
+}
+
+//The interrupts are stopped: write the rest of the ring, then the sizes in the header
+void TMRpcm::closeRecording(){
+    while(recordFilled && recordBlock <= recordLastBlock){
+        recordCard->writeData(recordRing[recordTail]);
+        recordBlock++;
+        recordTail = recordTail + 1 < RECORD_RAW_BLOCKS ? recordTail + 1 : 0;
+        recordFilled--;
+    }
+    unsigned long dataBytes = (recordBlock - recordFirstBlock - 1) * 512;
+    if(recordCount && recordBlock <= recordLastBlock){
+        memset(recordRing[recordHead] + recordCount, 0x80, 512 - recordCount);
+        recordCard->writeData(recordRing[recordHead]);
+        dataBytes += recordCount;
+    }
+    recordCard->writeStop();
+    wavHeaderBlock(recordRing[0], recordRate, dataBytes);
+    recordCard->writeBlock(recordFirstBlock, recordRing[0]);
+    sFile.close();
+    #if defined (debug)
+        Serial.print("lost samples: ");
+        Serial.println(recordDrops);
+    #endif
+}
+
+unsigned int TMRpcm::recordingDrops(){
+    noInterrupts();
+    unsigned int drops = recordDrops;
+    interrupts();
+    return drops;
+}
+
+#endif
+
 #endif
 
 #endif // Not defined RF_ONLY
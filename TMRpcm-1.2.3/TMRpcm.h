@@ -13,6 +13,9 @@ Contributors:
 #include <Arduino.h>
 #include <pcmConfig.h>
 #include <pcmRF.h>
+#include <pcmSource.h>
+#include <pcmTrace.h>
+#include <pcmSpi.h>
 #if !defined (SDFAT)
 	#include <SD.h>
 #else
@@ -23,6 +26,65 @@ Contributors:
 	class RF24;
 #endif
 
+#if defined (MEMORY_CLIPS)
+	#define CLIP_IN_RAM      SOURCE_IN_RAM
+	#define CLIP_IN_PROGMEM  SOURCE_IN_PROGMEM
+
+	//Raw 8-bit unsigned mono samples, without WAV header. farData is the PROGMEM address
+	struct pcmClip {
+		const byte* data;
+		uint_farptr_t farData;
+		unsigned long length;
+		unsigned int sampleRate;
+		byte location;
+	};
+#endif
+
+#if defined (WAV_TAGS)
+	#if !defined (WAV_INDEX)
+		#error "WAV_TAGS needs WAV_INDEX"
+	#endif
+	//LIST INAM, IART, IPRD then ID3 TPE1, TIT2, TALB: infoNum 0 to 2 of listInfo() and id3Info()
+	#define WAV_TAG_COUNT 6
+#endif
+
+#if defined (WAV_INDEX)
+	//Header info of an indexed WAV file, as saved in WAV_INDEX_FILE
+	struct wavIndexEntry {
+		char name[13];              //8.3 name
+		byte channels;
+		byte bitsPerSample;
+		unsigned int sampleRate;
+		unsigned long dataOffset;   //First byte of the data chunk
+		unsigned long dataLength;
+		unsigned long fileSize;     //To detect a file changed since the index was built
+		unsigned long firstCluster; //0 if not known (SD library)
+		unsigned int format;        //WAV format tag, 0x11 for IMA-ADPCM
+		unsigned int blockAlign;    //IMA-ADPCM block size, bitsPerSample is 4 for these files
+		#if defined (WAV_TAGS)
+		unsigned long tagOffset[WAV_TAG_COUNT]; //First byte of each tag value, 0 if none. See WAV_TAGS in pcmConfig.h
+		byte tagLength[WAV_TAG_COUNT];
+		#endif
+	};
+#endif
+
+#if defined (PCM_STATS)
+	#define PCM_STATS_SD_BUCKETS 5
+
+	struct pcmStats {
+		unsigned int underruns;         //Buffers played again because the refill was too late
+		unsigned long refills;
+		unsigned int refillMaxMicros;   //Time to fill one buffer, including the interrupts it let through
+		unsigned int refillAvgMicros;
+		unsigned long refillTotalMicros;
+		unsigned int sampleMaxTicks;    //Longest sample interrupt, in timer ticks (CPU cycles) after the overflow
+		unsigned int sdRefills[PCM_STATS_SD_BUCKETS]; //Refills from the card taking < 0.5, 1, 2, 4 ms and longer
+		unsigned long playingMillis;
+		unsigned long totalMillis;      //Since resetStats()
+		byte dutyPercent;               //Part of the time spent playing
+	};
+#endif
+
 class TMRpcm
 {
  public:
@@ -53,6 +115,37 @@ class TMRpcm
 
 	#if !defined (ENABLE_MULTI)//Normal Mode
 		void play(char* filename, unsigned long seekPoint);
+		void play(pcmSource* source);
+		void setGain(unsigned int gain);
+		boolean isOutputOn();
+		boolean claimCard(unsigned int micros);
+		void releaseCard();
+		unsigned int cardWaitMicros();
+		#if defined (PCM_STATS)
+		pcmStats stats();
+		void resetStats();
+		#endif
+		void playTone(unsigned int frequency, unsigned int onMillis, unsigned int offMillis);
+		#if defined (WAV_INDEX)
+		byte buildIndex(boolean rescan);
+		wavIndexEntry* findIndex(char* filename);
+		#endif
+		#if defined (PLAYLIST)
+		boolean playlist(char** filenames, byte count);
+		#endif
+		#if defined (PLAY_QUEUE)
+		boolean play(pcmSource* source, byte priority);
+		byte getPriority();
+		#endif
+		#if defined (MEMORY_CLIPS)
+		pcmClip* loadClip(char* filename, byte* ram, unsigned int maxLength);
+		pcmClip* addClip(uint_farptr_t progmemData, unsigned long length, unsigned int sampleRate);
+		pcmClip* addClip(const byte* data, unsigned long length, unsigned int sampleRate, byte location);
+		void play(pcmClip* clip);
+		#if defined (PLAY_QUEUE)
+		boolean play(pcmClip* clip, byte priority);
+		#endif
+		#endif
 
 	//*** MULTI MODE **
 	#else
@@ -76,6 +169,10 @@ class TMRpcm
 		void startRecording(char* fileName, unsigned int SAMPLE_RATE, byte pin);
 		void startRecording(char *fileName, unsigned int SAMPLE_RATE, byte pin, byte passThrough);
 		void stopRecording(char *fileName);
+		#if defined (RECORD_RAW)
+		boolean prepareRecording(char* fileName);
+		unsigned int recordingDrops();
+		#endif
 	#endif
 
  private:
@@ -97,13 +194,35 @@ class TMRpcm
 
 	#if defined (ENABLE_MULTI)
 		void ramp(boolean wBuff);
+	#else
+		void startPlayback(byte tmp);
+	#endif
+	#if defined (WAV_INDEX)
+		boolean indexInfo(char* filename);
+		boolean parseWav(wavIndexEntry* entry);
+		boolean loadIndex();
+		void saveIndex();
+	#endif
+	#if defined (WAV_TAGS)
+		void parseListTags(wavIndexEntry* entry, unsigned long pos, unsigned long end);
+		void parseId3Tags(wavIndexEntry* entry, unsigned long pos);
+		byte readTag(wavIndexEntry* entry, byte tag, char* tagData);
+	#endif
+	#if defined (PLAYLIST)
+		boolean openWav(pcmWavSource* wav, wavIndexEntry* entry);
 	#endif
 
 	#if defined (MODE2)
 		void setPins();
 	#endif
+	#if defined (RECORD_RAW)
+		boolean openRecording(char* fileName, unsigned int sampleRate);
+		void closeRecording();
+	#endif
 };
 
+#include <pcmPlayer.h>
+
 #endif
 
 
@@ -0,0 +1,47 @@
+
+/* Example sketch playing clips from memory instead of streaming them from the SD card.
+Clips are raw 8-bit unsigned mono samples. A clip compiled into PROGMEM is registered
+with addClip(), a WAV file is copied once into RAM with loadClip(). play(clip) then
+starts within microseconds and does not access the SD card at all.
+Requires MEMORY_CLIPS in pcmConfig.h
+*/
+
+#include <SD.h>
+#define SD_ChipSelectPin 53  //use digital pin 4 on arduino Uno
+#include <TMRpcm.h>
+#include <SPI.h>
+
+TMRpcm tmrpcm;
+
+// One period of a sine wave, looped to produce a 500Hz tone at 16kHz
+static const byte beep[32] PROGMEM = {
+  128,153,177,199,218,234,245,253,255,253,245,234,218,199,177,153,
+  128,103, 79, 57, 38, 22, 11,  3,  1,  3, 11, 22, 38, 57, 79,103
+};
+
+byte ram[2048];
+pcmClip* beepClip;
+pcmClip* voiceClip;
+
+void setup(){
+
+  tmrpcm.speakerPin = 46; //5,6,11 or 46 on Mega, 9 on Uno, Nano, etc
+
+  Serial.begin(115200);
+  if (!SD.begin(SD_ChipSelectPin)) {  // see if the card is present and can be initialized:
+    Serial.println("SD fail");
+  }
+  beepClip = tmrpcm.addClip(pgm_get_far_address(beep), sizeof(beep), 16000);
+  voiceClip = tmrpcm.loadClip("atnobs.wav", ram, sizeof(ram)); //Only the first 2048 samples are kept
+}
+
+void loop(){
+
+  if(Serial.available()){
+    switch(Serial.read()){
+    case 'b': tmrpcm.loop(1); tmrpcm.play(beepClip); break;
+    case 'v': tmrpcm.loop(0); tmrpcm.play(voiceClip); break;
+    case 's': tmrpcm.stopPlayback(); break;
+    }
+  }
+}
@@ -0,0 +1,51 @@
+/* Example sketch mixing a warning beep over a voice message on a single speaker pin.
+Each voice of a pcmMixerSource is a source of its own (clip, tone, WAV file) with its own
+gain. The mixer sums them into the output buffer, so beeps started while the message
+plays are heard over it. A voice leaves the mixer when its source ends, the beeps
+with 's'.
+Requires MIXER_VOICES and MEMORY_CLIPS in pcmConfig.h
+*/
+
+#include <SD.h>
+#define SD_ChipSelectPin 53  //use digital pin 4 on arduino Uno
+#include <TMRpcm.h>
+#include <SPI.h>
+
+TMRpcm tmrpcm;
+pcmMixerSource mixer;
+pcmMemorySource voice;
+pcmToneSource beep;
+
+byte ram[2048];
+char beepVoice = -1;
+
+void setup(){
+
+  tmrpcm.speakerPin = 46; //5,6,11 or 46 on Mega, 9 on Uno, Nano, etc
+
+  Serial.begin(115200);
+  if (!SD.begin(SD_ChipSelectPin)) {  // see if the card is present and can be initialized:
+    Serial.println("SD fail");
+  }
+  pcmClip* clip = tmrpcm.loadClip("atnobs.wav", ram, sizeof(ram)); //16kHz voice, the first 2048 samples
+  if(clip == NULL){ return; }
+  voice.begin(clip->data, clip->length, clip->sampleRate, SOURCE_IN_RAM);
+  mixer.begin(clip->sampleRate, 1);   //Keeps playing silence without voices
+  tmrpcm.play(&mixer);
+}
+
+void loop(){
+
+  if(Serial.available()){
+    switch(Serial.read()){
+    case 'v': mixer.add(&voice, 255); break;           //Message at full scale
+    case 'b':                                           //Beeps at half scale over it
+      if(beepVoice >= 0){ mixer.remove(beepVoice); }
+      beep.begin(1000, 16000, 255);
+      beep.setEnvelope(60, 140);
+      beepVoice = mixer.add(&beep, 128);
+      break;
+    case 's': if(beepVoice >= 0){ mixer.remove(beepVoice); beepVoice = -1; } break;
+    }
+  }
+}
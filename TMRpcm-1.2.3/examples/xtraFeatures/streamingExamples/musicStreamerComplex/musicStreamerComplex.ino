@@ -58,6 +58,8 @@ void setup(){
 
 void loop(){  
 
+  rfAudio.update();                  // Reads the next packets when the local playback spares the card
+
   if(Serial.available()){    
     switch(Serial.read()){
     case 'a': audio.stopPlayback(); rfAudio.play("catfish",1);        break;   // Play to radio # 1 in the radio group
@@ -54,6 +54,8 @@ void setup(){
 
 void loop(){  
 
+  rfAudio.update();                  // Reads the next packets from the card
+
   if(Serial.available()){    
     switch(Serial.read()){
     case 'e': rfAudio.play("catfish",1); break;          // Play to radio # 1 in the radio group
@@ -24,8 +24,8 @@ Blog: https://tmrh20.blogspot.com/
 /****************** GENERAL USER DEFINES *********************************
  See https://github.com/TMRh20/TMRpcm/wiki for info on usage
 
-   Override the default size of the buffers (MAX 254). There are 2 buffers, so memory usage will be double this number
-   Defaults to 64bytes for Uno etc. 254 for Mega etc. note: In multi mode there are 4 buffers*/
+   Override the default size of the buffers (MAX 254, or more in single track mode). There are 2 buffers, so memory usage will be double this number
+   Defaults to 64bytes for Uno etc. 254 for Mega etc. 512 with SD_RAW_READ. note: In multi mode there are 4 buffers*/
 //#define buffSize 128  //must be an even number
 
   /* Uncomment to run the SD card at full speed (half speed is default for standard SD lib)*/
@@ -34,6 +34,63 @@ Blog: https://tmrh20.blogspot.com/
   /* HANDLE_TAGS - This options allows proper playback of WAV files with embedded metadata*/
 //#define HANDLE_TAGS
 
+  /* MEMORY_CLIPS - Number of clips which can be preloaded into RAM (or external RAM on the Mega)
+     with loadClip(), or compiled into PROGMEM and registered with addClip(). play(clip) then
+     plays them without any SD card access. Single track mode only*/
+#define MEMORY_CLIPS 4
+
+  /* TONE_SAMPLE_RATE - Sample rate of the sine tones generated by playTone(). 16kHz is plenty for alert beeps
+     and leaves time for the radar and the main loop*/
+#define TONE_SAMPLE_RATE 16000
+
+  /* PLAY_QUEUE - Number of sources waiting behind the playing one for play(source, priority). A higher priority
+     source cuts in at the next buffer boundary, fading from the last output sample over CROSSFADE_SAMPLES
+     instead of ramping the PWM output down and up. Single track mode only*/
+#define PLAY_QUEUE 4
+#define CROSSFADE_SAMPLES 32
+
+  /* WAV_INDEX - Number of WAV files in the root directory whose header is indexed by buildIndex(). play() then opens
+     the file and seeks straight to the audio data, without parsing the header. The index is saved to
+     WAV_INDEX_FILE so the card is only scanned again when asked to. Single track mode only*/
+#define WAV_INDEX 8
+#define WAV_INDEX_FILE "WAVINDEX.BIN"
+
+  /* WAV_TAGS - buildIndex() also finds the LIST INFO and ID3v2 tags of each file in the same pass over its chunks, and
+     keeps their offset and length in the index, 30 bytes more per file. getInfo(), listInfo() and id3Info() then read
+     the tag with one seek instead of searching the file. Files not in the index are still searched. Needs WAV_INDEX*/
+#define WAV_TAGS
+
+  /* PLAYLIST - Maximum number of indexed WAV files played back to back by playlist(), e.g. the words of a spoken
+     message. Each file gets its own handle, opened and seeked to its data before playback starts, so the buffer
+     interrupt goes on with the data of the next one in the same buffer: no gap, no header parse, no ramp. Needs
+     WAV_INDEX, the files must share the sample rate and format*/
+#define PLAYLIST 4
+
+  /* MIXER_VOICES - Number of 8-bit mono sources a pcmMixerSource sums into the single output, e.g. a tone over a voice
+     message on one speaker pin. Each voice is filled by MIXER_CHUNK samples at a time, scaled by its own gain and added
+     with saturation in the buffer interrupt, a dozen cycles per sample and voice. Voices must not be SD_RAW_READ files*/
+//#define MIXER_VOICES 2
+#define MIXER_CHUNK 32
+
+  /* ADPCM - IMA-ADPCM (4-bit) mono sources, decoded to 8-bit samples in the buffer interrupt: half the card reads and
+     flash of 8-bit PCM. play(filename) plays IMA-ADPCM WAV files (format 0x11) found in the WAV index, without
+     seekPoint. Clips in RAM or PROGMEM are played through a pcmAdpcmSource, see tools/adpcm_clip.py*/
+#define ADPCM
+#define ADPCM_CHUNK 32
+
+  /* PCM_STATS - Count buffer underruns and time the interrupts, read with stats(). Costs a few cycles per sample
+     and a micros() call per refill. Single track mode only*/
+//#define PCM_STATS
+
+  /* SPI_STATS - Transfers, bytes, busy and wait times of each client of the shared SPI bus, read with pcmSpiGetStats().
+     See pcmSpi.h. Costs two micros() calls per SPI transfer*/
+//#define SPI_STATS
+
+  /* ENABLE_TRACE - Timestamped events from the radar and the player in a ring of TRACE_SIZE records, sent in binary by
+     pcmTraceDump(). See pcmTrace.h and tools/trace_decode.py for the latency from echo to sound*/
+//#define ENABLE_TRACE
+#define TRACE_SIZE 64
+
   /*Ethernet shield support etc. The library outputs on both timer pins, 9 and 10 on Uno by default. Uncommenting this
     will disable output on the 2nd timer pin and should allow it to function with shields etc that use Uno pin 10 (TIMER1 COMPB).*/
 //#define DISABLE_SPEAKER2
@@ -41,13 +98,32 @@ Blog: https://tmrh20.blogspot.com/
   /* Use 8-bit TIMER2 - If using an UNO, Nano, etc and need TIMER1 for other things*/
 //#define USE_TIMER2
 
+  /* Mega only: Leave TIMER4 and its interrupt vectors free for other things, e.g. the HC-SR04
+     input capture on ICP4 (pin 49). speakerPin 6 (TIMER4) will fall back to TIMER1*/
+#define DISABLE_TIMER4
+
 //#define debug
 /****************** ADVANCED USER DEFINES ********************************
-   See https://github.com/TMRh20/TMRpcm/wiki for info on usage
+   See https://github.com/TMRh20/TMRpcm/wiki for info on usage */
 
    /* Use the SDFAT library from http://code.google.com/p/sdfatlib/            */
 //#define SDFAT
 
+   /* SD_RAW_READ - SdFat only. Files stored in contiguous clusters are read with one SD multi-block read, one 512 byte
+      block per buffer refill, instead of going through the file system. buffSize is 512. Other files play as usual.
+      While such a file plays, no other file may be accessed on the card */
+//#define SD_RAW_READ
+
+   /* PCM_FIXED_TIMER - Single track mode. Fix the timer (1, or 3, 4, 5 on Mega) and the sample format at compile time.
+      The interrupts then write the timer registers directly and skip the format tests, see pcmPlayer.h. speakerPin
+      must be on that timer (Mega: 11 for TIMER1, 5 for TIMER3, 6 for TIMER4, 46 for TIMER5), quality() has no effect
+      and files in another format are not played. Sources passed to play() must deliver samples in this format.
+      Blind_Guidance: uncomment with 5, its speaker is on pin 46 */
+//#define PCM_FIXED_TIMER 5
+#define PCM_FIXED_CHANNELS 1
+#define PCM_FIXED_BITS 8
+#define PCM_FIXED_QUALITY 1
+
    /* MULTI Track mode currently allows playback of 2 tracks at once          */
 //#define ENABLE_MULTI  //Using separate pins on a single 16-bit timer
 
@@ -73,8 +149,15 @@ Blog: https://tmrh20.blogspot.com/
    Depending on the card, can take a few seconds for recording to start
    																									*/
 //#define ENABLE_RECORDING
-	// Amount of space to pre-allocate for recording
-//	#define BLOCK_COUNT 10000UL  // 10000 = 500MB   2000 = 100MB
+	// Amount of space to pre-allocate for recording, in 512 byte blocks
+//	#define BLOCK_COUNT 10000UL  // 10000 = 5MB   2000 = 1MB
+
+   /* RECORD_RAW - SdFat only. Record into a contiguous file allocated once by prepareRecording() (BLOCK_COUNT blocks),
+      so startRecording() starts at once. The samples go through a ring of RECORD_RAW_BLOCKS 512 byte blocks and are
+      written with one SD multi-block write, one block per interrupt. The RIFF sizes are written by stopRecording(),
+      the file keeps its allocated size and the audio data starts at byte 512. recordingDrops() counts lost samples*/
+//	#define RECORD_RAW
+	#define RECORD_RAW_BLOCKS 3
 
 //*********************** Radio (NRF24L01+) Streaming *********************
 
@@ -83,6 +166,12 @@ to Comment if not using radio                                                  *
 
 //#define ENABLE_RF
 
+  /* RF_TIMER - 16-bit timer sending the packets (1, or 3, 4, 5 on Mega), not the one of the local playback nor TIMER4 with
+     DISABLE_TIMER4. RF_RING - Packets of 32 samples read ahead by pcmRF::update() from the main loop, so the timer
+     interrupt only sends ready packets and never waits for the card*/
+#define RF_TIMER 1
+#define RF_RING 8
+
   /* Uncomment this line to disable all standard features except RF playback.
      This will minimize resource usage if not playing or recording files locally */
 //#define RF_ONLY
@@ -0,0 +1,78 @@
+/*Library by TMRh20 2012-2014
+
+  pcmPlayer - Player with the timer and the sample format fixed at compile time
+
+  TMRpcm picks the timer registers through the tt arrays and tests the format bits of optionByte in every
+  sample interrupt. With PCM_FIXED_TIMER in pcmConfig.h, the interrupts of that timer are generated from
+  TMRpcmT<pcmTimer<n>, channels, bits, quality> instead: every register is a constant address and the format
+  branches are resolved by the compiler. pcmPlayer is that configuration, and TMRpcm keeps the same API.
+*/
+
+#ifndef pcmPlayer_h   // if x.h hasn't been included yet...
+#define pcmPlayer_h   //   #define this so the compiler knows it has been included
+
+#include <Arduino.h>
+#include <pcmConfig.h>
+#include <TMRpcm.h>
+
+#if defined (PCM_FIXED_TIMER)
+
+	#if defined (ENABLE_MULTI) || defined (MODE2) || defined (USE_TIMER2) || defined (RF_ONLY)
+		#error "PCM_FIXED_TIMER needs single track mode on a 16-bit timer, without MODE2"
+	#endif
+	#if (PCM_FIXED_CHANNELS == 2 || PCM_FIXED_BITS == 16) && !defined (STEREO_OR_16BIT)
+		#error "Stereo or 16-bit PCM_FIXED formats need STEREO_OR_16BIT"
+	#endif
+	#if PCM_FIXED_CHANNELS == 2 && PCM_FIXED_BITS == 16
+		#error "16-bit stereo is not supported"
+	#endif
+	#if PCM_FIXED_TIMER == 4 && defined (DISABLE_TIMER4)
+		#error "PCM_FIXED_TIMER 4 conflicts with DISABLE_TIMER4"
+	#endif
+
+	//*** Registers of one 16-bit timer. index is its position in the tt arrays of TMRpcm.cpp ***
+	template<byte N> struct pcmTimer;
+
+	#define PCM_TIMER_TRAITS(n, idx) \
+		template<> struct pcmTimer<n> { \
+			static const byte index = idx; \
+			static inline volatile byte& timsk(){ return TIMSK##n; } \
+			static inline volatile unsigned int& ocra(){ return OCR##n##A; } \
+			static inline volatile unsigned int& ocrb(){ return OCR##n##B; } \
+			static inline volatile unsigned int& tcnt(){ return TCNT##n; } \
+		};
+
+	PCM_TIMER_TRAITS(1, 0)
+	#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+		PCM_TIMER_TRAITS(3, 1)
+		PCM_TIMER_TRAITS(4, 2)
+		PCM_TIMER_TRAITS(5, 3)
+	#elif PCM_FIXED_TIMER != 1
+		#error "PCM_FIXED_TIMER other than 1 needs a Mega"
+	#endif
+
+	//Vector names of the fixed timer, e.g. PCM_TIMER_VECT(5,OVF) is TIMER5_OVF_vect
+	#define PCM_TIMER_VECT(n,v) PCM_TIMER_VECT_(n,v)
+	#define PCM_TIMER_VECT_(n,v) TIMER##n##_##v##_vect
+
+	template<class Timer, byte Channels, byte Bits, bool Quality>
+	class TMRpcmT : public TMRpcm
+	{
+	 public:
+		typedef Timer timer;
+		static const byte channels = Channels;
+		static const byte bits = Bits;
+		static const boolean highQuality = Quality;
+		//optionByte bits 4 (2 bytes per output sample) and 1 (16-bit) as set by wavInfo() for files in this format
+		static const byte formatBits = Channels == 2 ? _BV(4) : (Bits == 16 ? _BV(4) | _BV(1) : 0);
+
+		//Bodies of the timer interrupts, defined in TMRpcm.cpp
+		static inline void sampleInterrupt() __attribute__((always_inline));
+		static inline void refillInterrupt() __attribute__((always_inline));
+	};
+
+	typedef TMRpcmT<pcmTimer<PCM_FIXED_TIMER>, PCM_FIXED_CHANNELS, PCM_FIXED_BITS, PCM_FIXED_QUALITY> pcmPlayer;
+
+#endif
+
+#endif
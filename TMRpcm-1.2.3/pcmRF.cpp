@@ -10,6 +10,29 @@
 	#include <RF24.h>
 
 
+	#if RF_TIMER != 1 && !defined(__AVR_ATmega1280__) && !defined(__AVR_ATmega2560__)
+		#error "RF_TIMER other than 1 needs a Mega"
+	#endif
+	#if defined (PCM_FIXED_TIMER) && !defined (RF_ONLY)
+		#if RF_TIMER == PCM_FIXED_TIMER
+			#error "RF_TIMER is the timer of the local playback"
+		#endif
+	#endif
+	#if RF_TIMER == 4 && defined (DISABLE_TIMER4)
+		#error "RF_TIMER 4 conflicts with DISABLE_TIMER4"
+	#endif
+
+	//Registers of RF_TIMER, the bit positions are the same on all 16-bit timers
+	#define RF_REG(r,s) RF_REG_(r,RF_TIMER,s)
+	#define RF_REG_(r,n,s) RF_REG__(r,n,s)
+	#define RF_REG__(r,n,s) r##n##s
+	#define RF_TIMSK  RF_REG(TIMSK,)
+	#define RF_ICR    RF_REG(ICR,)
+	#define RF_TCNT   RF_REG(TCNT,)
+	#define RF_TCCRA  RF_REG(TCCR,A)
+	#define RF_TCCRB  RF_REG(TCCR,B)
+	#define RF_VECT   RF_REG(TIMER,_COMPA_vect)
+
 	boolean rfPlaying = 0;
 	const uint64_t addresses[14] = { 0xABCDABCD71LL, 0x544d52687CLL, 0x544d526832LL, 0x544d52683CLL,0x544d526846LL, 0x544d526850LL,0x544d52685ALL, 0x544d526820LL, 0x544d52686ELL, 0x544d52684BLL, 0x544d526841LL, 0x544d526855LL,0x544d52685FLL,0x544d526869LL};
 
@@ -19,7 +42,15 @@
 		SdFile txFile;
 	#endif
 
-	byte buff[32];
+	//*** Packets read ahead by update(), sent by the timer interrupt ***
+	byte ring[RF_RING][32];
+	byte ringHead = 0;              //Next packet to fill, main loop only
+	volatile byte ringTail = 0;     //Next packet to send, interrupt only
+	volatile byte ringCount = 0;
+	volatile boolean rfEnd = 0;     //The last packet is in the ring
+	volatile byte rfOwed = 0;       //Ticks not served yet, sent as a burst into the TX FIFO
+	volatile unsigned int rfUnderruns = 0;
+	pcmSource* rfSource = NULL;     //NULL: txFile
 	RF24 radi(0,0);
 
 //************** RF SECTION ********************
@@ -44,26 +75,27 @@ boolean pcmRF::isPlaying(){
 
 }
 
-void pcmRF::stop(){
-	TIMSK1 &= ~( _BV(OCIE1A) | _BV(OCIE1B) );
+void stop(){
+	RF_TIMSK &= ~( _BV(OCIE1A) | _BV(OCIE1B) );
+	if(rfSource){ rfSource->stop(); rfSource = NULL; }
 	#if !defined(SDFAT)
 		if(txFile){txFile.close();}
 	#else
 		if(txFile.isOpen()){txFile.close();}
 	#endif
 	rfPlaying = 0;
-}
 
+}
 
-void stop(){
-	TIMSK1 &= ~( _BV(OCIE1A) | _BV(OCIE1B) );
-	#if !defined(SDFAT)
-		if(txFile){txFile.close();}
-	#else
-		if(txFile.isOpen()){txFile.close();}
-	#endif
-	rfPlaying = 0;
+void pcmRF::stop(){
+	::stop();
+}
 
+unsigned int pcmRF::underruns(){
+	noInterrupts();
+	unsigned int u = rfUnderruns;
+	interrupts();
+	return u;
 }
 
 void pcmRF::broadcast(byte device){
@@ -76,16 +108,43 @@ void pcmRF::broadcast(byte device){
 	interrupts();
 }
 
-void pcmRF::play(char* filename, byte device){
-  stop();
-  rfPlaying = 1;
+void fillRing();
+
+//PCM_SPI_RADIO client of pcmSpi: time to the next tick, plus one more while the TX FIFO has room for a burst
+boolean radioCanWait(unsigned int micros){
+	if(!rfPlaying){ return 1; }
+	noInterrupts();
+	unsigned long ticks = RF_ICR - RF_TCNT;
+	if(rfOwed < 2){ ticks += RF_ICR; }
+	interrupts();
+	return ticks / (F_CPU / 1000000UL) >= micros;
+}
 
+//Fills the ring before the first packet, then sends one packet of 32 samples per tick
+void startRF(unsigned int sampleRate, byte device){
 	if(device == 255){
 		radi.openWritingPipe(addresses[1]);
 	}else{
 		radi.openWritingPipe(addresses[device+2]);
 	}
+	ringHead = ringTail = ringCount = 0;
+	rfEnd = 0; rfOwed = 0; rfUnderruns = 0;
+	rfPlaying = 1;
+	pcmSpiRegister(PCM_SPI_RADIO, radioCanWait, NULL, NULL);
+	fillRing();
+
+	unsigned int res = (10 * (1600000/sampleRate)) * 32;
+
+	noInterrupts();
+	RF_ICR = res;
+	RF_TCCRA = _BV(WGM11);
+	RF_TCCRB = _BV(WGM13) | _BV(WGM12) | _BV(CS10);
+	RF_TIMSK = ( _BV(OCIE1A) );
+	interrupts();
+}
 
+void pcmRF::play(char* filename, byte device){
+  stop();
 
 	#if !defined(SDFAT)
 		if(!txFile){ txFile = SD.open(filename);}
@@ -107,15 +166,7 @@ void pcmRF::play(char* filename, byte device){
 		txFile.seekSet(44);
 	#endif
 
-	unsigned int res = (10 * (1600000/SAMPLE_RATE)) * 32;
-
-
-	noInterrupts();
-	ICR1 = res;
-	TCCR1A = _BV(WGM11);
-	TCCR1B = _BV(WGM13) | _BV(WGM12) | _BV(CS10);
-	TIMSK1 = ( _BV(OCIE1A) );
-	interrupts();
+	startRF(SAMPLE_RATE, device);
 
   }else{
 	  #if defined (debug)
@@ -124,17 +175,64 @@ void pcmRF::play(char* filename, byte device){
   }
 }
 
+//Any source, e.g. a clip in memory or a WAV file. It must stay valid until the stream ends
+void pcmRF::play(pcmSource* source, byte device){
+	stop();
+	if(source == NULL){ return; }
+	source->rewind();
+	rfSource = source;
+	startRF(source->sampleRate, device);
+}
 
+//Reads packets until the ring is full. A packet is only read when pcmSpi grants the bus, the local playback
+//and the RF interrupt then wait, so the radio is never accessed in the middle of a card transfer. Also for a
+//source: a WAV file or a playlist reads the card, and a source gives no way to tell
+void fillRing(){
+	while(rfPlaying && !rfEnd && ringCount < RF_RING){
+		byte* packet = ring[ringHead];
+		int got;
+		if(!pcmSpiAcquire(PCM_SPI_RADIO, 1000)){ return; }
+		if(rfSource){
+			got = rfSource->fill(packet,32);
+		}else{
+			got = txFile.read(packet,32);
+		}
+		pcmSpiRelease(PCM_SPI_RADIO, got > 0 ? got : 0);
+		if(got <= 0){ rfEnd = 1; return; }
+		if(got < 32){ memset(packet + got, packet[got-1], 32 - got); }
+		ringHead = (ringHead + 1) % RF_RING;
+		noInterrupts();
+		ringCount++;
+		if(got < 32){ rfEnd = 1; }
+		interrupts();
+	}
+}
 
-ISR(TIMER1_COMPA_vect){
-	radi.writeFast(&buff,32);
-	txFile.read((byte*)buff,32);
-	if(txFile.available() < 32){ radi.txStandBy(); stop(); }
+void pcmRF::update(){
+	fillRing();
 }
 
 
 
+ISR(RF_VECT){
+	if(rfOwed < 3){ rfOwed++; }     //Depth of the nRF24 TX FIFO
+	if(!pcmSpiBegin(PCM_SPI_RADIO)){ return; }    //The card is being read, sent on the next tick
+	byte sent = 0;
+	while(rfOwed && ringCount){
+		radi.writeFast(ring[ringTail],32);
+		ringTail = (ringTail + 1) % RF_RING;
+		ringCount--;
+		rfOwed--;
+		sent++;
+	}
+	pcmSpiEnd(PCM_SPI_RADIO, sent * 32);
+	if(rfOwed){
+		if(rfEnd){ radi.txStandBy(); stop(); }
+		else{ rfUnderruns++; }
+	}
+}
 
-#endif
 
 
+
+#endif
@@ -10,16 +10,23 @@
 
 
 	class RF24;
+	class TMRpcm;
+	class pcmSource;
 
 	class pcmRF
 	{
 	 public:
 	 	pcmRF( RF24& _radio);
 		void play(char* filename, byte device);
+		void play(pcmSource* source, byte device);
 		void broadcast(byte device);
 		boolean isPlaying();
 		void stop();
 		void begin();
+		//Reads ahead into the packet ring, to be called from the main loop while playing.
+		//The card is shared with the local playback through pcmSpi
+		void update();
+		unsigned int underruns();  //Packets not ready in time
 	 private:
 
 	};
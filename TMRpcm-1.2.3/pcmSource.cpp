@@ -0,0 +1,586 @@
+/*Library by TMRh20 2012-2014*/
+
+#include <pcmConfig.h>
+#include <TMRpcm.h>
+#include <pcmSource.h>
+#include <util/atomic.h>
+
+#if !defined (RF_ONLY) && !defined (ENABLE_MULTI)
+
+#if !defined (SDFAT)
+    extern File sFile;
+#else
+    extern SdFile sFile;
+#endif
+extern volatile unsigned int dataEnd;
+
+//****************** WAV file source **********************
+
+unsigned int fileFill(pcmSource*, byte* buf, unsigned int len){
+    if((unsigned int)sFile.available() <= dataEnd){ return 0; }
+    int got = sFile.read(buf,len);
+    if(got < 0){ return 0; }
+    return got;
+}
+
+boolean fileRewind(pcmSource* src){
+    #if !defined (SDFAT)
+        return sFile.seek(((pcmFileSource*)src)->dataStart);
+    #else
+        return sFile.seekSet(((pcmFileSource*)src)->dataStart);
+    #endif
+}
+
+void fileStop(pcmSource*){
+    #if !defined (SDFAT)
+        if(sFile){ sFile.close(); }
+    #else
+        if(sFile.isOpen()){ sFile.close(); }
+    #endif
+}
+
+const pcmSourceOps fileOps = { fileFill, fileRewind, fileStop };
+
+pcmFileSource::pcmFileSource(){
+    ops = &fileOps;
+    onCard = 1;
+}
+
+void pcmFileSource::begin(unsigned int rate, unsigned long start){
+    sampleRate = rate;
+    dataStart = start;
+}
+
+#if defined (SD_RAW_READ)
+
+//****************** Contiguous WAV file, raw blocks **********************
+
+Sd2Card* rawCard;
+
+void rawStop(pcmSource* src){
+    pcmRawSource* raw = (pcmRawSource*)src;
+    if(raw->reading){ rawCard->readStop(); raw->reading = 0; }
+    fileStop(src);
+}
+
+unsigned int rawFill(pcmSource* src, byte* buf, unsigned int len){
+    pcmRawSource* raw = (pcmRawSource*)src;
+    if(len < 512 || raw->block > raw->lastBlock){ return 0; }
+    if(!raw->reading){
+        if(!rawCard->readStart(raw->block)){ return 0; }
+        raw->reading = 1;
+    }
+    if(!rawCard->readData(buf)){ rawCard->readStop(); raw->reading = 0; return 0; }
+    //Header or skipped bytes hold the first sample, a few ms of constant output
+    for(unsigned int i=0; i<raw->skip; i++){ buf[i] = buf[raw->skip]; }
+    raw->skip = 0;
+    unsigned int n = 512;
+    if(raw->block == raw->lastBlock){
+        n = raw->tailLength;
+        rawCard->readStop(); raw->reading = 0;
+    }
+    raw->block++;
+    return n;
+}
+
+boolean rawRewind(pcmSource* src){
+    return ((pcmRawSource*)src)->seek(((pcmRawSource*)src)->dataStart);
+}
+
+const pcmSourceOps rawOps = { rawFill, rawRewind, rawStop };
+
+pcmRawSource::pcmRawSource(){
+    ops = &rawOps;
+    onCard = 1;
+    reading = 0;
+}
+
+//Returns 0 if the open file is not contiguous, it is then played through fileSource
+boolean pcmRawSource::begin(unsigned int rate, unsigned long start, unsigned long end){
+    uint32_t bgnBlock, endBlock;
+    reading = 0;
+    if(end <= start || !sFile.contiguousRange(&bgnBlock, &endBlock)){ return 0; }
+    rawCard = sFile.volume()->sdCard();
+    sampleRate = rate;
+    dataStart = start;
+    firstBlock = bgnBlock;
+    lastBlock = bgnBlock + (end - 1) / 512;
+    tailLength = (end - 1) % 512 + 1;
+    if(lastBlock > endBlock){ return 0; }
+    return seek(start);
+}
+
+boolean pcmRawSource::seek(unsigned long position){
+    if(reading){ rawCard->readStop(); reading = 0; }
+    block = firstBlock + position / 512;
+    skip = position % 512;
+    return block <= lastBlock;
+}
+
+#endif
+
+#if defined (PLAYLIST)
+
+//****************** WAV file with its own handle **********************
+
+unsigned int wavFill(pcmSource* src, byte* buf, unsigned int len){
+    pcmWavSource* wav = (pcmWavSource*)src;
+    if(len > wav->left){ len = wav->left; }
+    if(len == 0){ return 0; }
+    int got = wav->file.read(buf,len);
+    if(got <= 0){ wav->left = 0; return 0; }
+    wav->left -= got;
+    return got;
+}
+
+boolean wavRewind(pcmSource* src){
+    pcmWavSource* wav = (pcmWavSource*)src;
+    wav->left = wav->dataLength;
+    #if !defined (SDFAT)
+        return wav->file.seek(wav->dataStart);
+    #else
+        return wav->file.seekSet(wav->dataStart);
+    #endif
+}
+
+void wavStop(pcmSource* src){
+    pcmWavSource* wav = (pcmWavSource*)src;
+    #if !defined (SDFAT)
+        if(wav->file){ wav->file.close(); }
+    #else
+        if(wav->file.isOpen()){ wav->file.close(); }
+    #endif
+}
+
+const pcmSourceOps wavOps = { wavFill, wavRewind, wavStop };
+
+pcmWavSource::pcmWavSource(){
+    ops = &wavOps;
+    onCard = 1;
+    left = 0;
+}
+
+//****************** Playlist **********************
+
+unsigned int playlistFill(pcmSource* src, byte* buf, unsigned int len){
+    pcmPlaylistSource* list = (pcmPlaylistSource*)src;
+    unsigned int got = 0;
+    while(list->current < list->count){
+        got += list->items[list->current]->fill(buf+got,len-got);
+        if(got == len){ break; }
+        //The next source starts right after the last sample of this one
+        if(++list->current < list->count){ list->items[list->current]->rewind(); }
+    }
+    return got;
+}
+
+boolean playlistRewind(pcmSource* src){
+    pcmPlaylistSource* list = (pcmPlaylistSource*)src;
+    list->current = 0;
+    if(list->count == 0){ return 0; }
+    return list->items[0]->rewind();
+}
+
+void playlistStop(pcmSource* src){
+    pcmPlaylistSource* list = (pcmPlaylistSource*)src;
+    for(byte i=0; i<list->count; i++){ list->items[i]->stop(); }
+}
+
+const pcmSourceOps playlistOps = { playlistFill, playlistRewind, playlistStop };
+
+pcmPlaylistSource::pcmPlaylistSource(){
+    ops = &playlistOps;
+    onCard = 0;
+    count = 0; current = 0;
+}
+
+void pcmPlaylistSource::clear(){
+    onCard = 0;
+    count = 0; current = 0;
+}
+
+boolean pcmPlaylistSource::add(pcmSource* source){
+    if(count >= PLAYLIST){ return 0; }
+    if(count == 0){ sampleRate = source->sampleRate; }
+    else if(source->sampleRate != sampleRate){ return 0; }
+    items[count++] = source;
+    if(source->onCard){ onCard = 1; }
+    return 1;
+}
+
+#endif
+
+#if defined (MIXER_VOICES)
+
+//****************** Mixer **********************
+
+byte mixScratch[MIXER_CHUNK];
+
+unsigned int mixerFill(pcmSource* src, byte* buf, unsigned int len){
+    pcmMixerSource* mix = (pcmMixerSource*)src;
+    unsigned int mixed = 0;     //Samples written by the longest voice
+    memset(buf, 128, len);
+    for(byte v=0; v<MIXER_VOICES; v++){
+        pcmSource* voice = mix->voices[v];
+        if(voice == NULL){ continue; }
+        unsigned int gain = mix->gains[v] + 1;
+        unsigned int pos = 0;
+        while(pos < len){
+            unsigned int chunk = len - pos;
+            if(chunk > MIXER_CHUNK){ chunk = MIXER_CHUNK; }
+            unsigned int got = voice->fill(mixScratch, chunk);
+            byte* out = buf + pos;
+            for(unsigned int i=0; i<got; i++){
+                int s = out[i] + ((((int)mixScratch[i] - 128) * (int)gain) >> 8);
+                out[i] = s > 255 ? 255 : (s < 0 ? 0 : s);
+            }
+            pos += got;
+            if(got < chunk){
+                voice->stop();
+                mix->voices[v] = NULL;
+                break;
+            }
+        }
+        if(pos > mixed){ mixed = pos; }
+    }
+    return mix->hold ? len : mixed;
+}
+
+boolean mixerRewind(pcmSource*){
+    return 1;
+}
+
+void mixerStop(pcmSource* src){
+    pcmMixerSource* mix = (pcmMixerSource*)src;
+    for(byte v=0; v<MIXER_VOICES; v++){
+        pcmSource* voice = mix->voices[v];
+        mix->voices[v] = NULL;
+        if(voice){ voice->stop(); }
+    }
+}
+
+const pcmSourceOps mixerOps = { mixerFill, mixerRewind, mixerStop };
+
+pcmMixerSource::pcmMixerSource(){
+    ops = &mixerOps;
+    onCard = 0;
+    hold = 0;
+    for(byte v=0; v<MIXER_VOICES; v++){ voices[v] = NULL; }
+}
+
+void pcmMixerSource::begin(unsigned int rate, boolean h){
+    mixerStop(this);
+    onCard = 0;
+    sampleRate = rate;
+    hold = h;
+}
+
+char pcmMixerSource::add(pcmSource* source, byte gain){
+    if(source == NULL || source->sampleRate != sampleRate){ return -1; }
+    for(byte v=0; v<MIXER_VOICES; v++){
+        if(voices[v] == source){ return -1; }   //Two voices would share its reads
+    }
+    for(byte v=0; v<MIXER_VOICES; v++){
+        if(voices[v] == NULL){
+            source->rewind();
+            gains[v] = gain;
+            noInterrupts();
+            if(source->onCard){ onCard = 1; }   //Until begin(), a voice may still be reading
+            voices[v] = source;     //Picked up by the next buffer
+            interrupts();
+            return v;
+        }
+    }
+    return -1;
+}
+
+void pcmMixerSource::setGain(byte voice, byte gain){
+    if(voice < MIXER_VOICES){ gains[voice] = gain; }
+}
+
+void pcmMixerSource::remove(byte voice){
+    if(voice >= MIXER_VOICES){ return; }
+    noInterrupts();
+    pcmSource* src = voices[voice];
+    voices[voice] = NULL;
+    interrupts();
+    if(src){ src->stop(); }
+}
+
+#endif
+
+#if defined (ADPCM)
+
+//****************** IMA-ADPCM **********************
+
+const int adpcmSteps[89] PROGMEM = {
+        7,     8,     9,    10,    11,    12,    13,    14,    16,    17,
+       19,    21,    23,    25,    28,    31,    34,    37,    41,    45,
+       50,    55,    60,    66,    73,    80,    88,    97,   107,   118,
+      130,   143,   157,   173,   190,   209,   230,   253,   279,   307,
+      337,   371,   408,   449,   494,   544,   598,   658,   724,   796,
+      876,   963,  1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+     2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,
+     5894,  6484,  7132,  7845,  8630,  9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+const char adpcmIndex[8] PROGMEM = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+byte adpcmIn[ADPCM_CHUNK];
+
+//Next compressed byte, -1 at the end of the data
+static inline int adpcmByte(pcmAdpcmSource* ad){
+    if(ad->pos >= ad->length){ return -1; }
+    if(ad->location == SOURCE_IN_FILE){
+        if(ad->inPos >= ad->inCount){
+            unsigned long left = ad->length - ad->pos;
+            int got = sFile.read(adpcmIn, left < ADPCM_CHUNK ? left : ADPCM_CHUNK);
+            if(got <= 0){ ad->pos = ad->length; return -1; }
+            ad->inCount = got; ad->inPos = 0;
+        }
+        ad->pos++;
+        return adpcmIn[ad->inPos++];
+    }
+    if(ad->location == SOURCE_IN_PROGMEM){ return pgm_read_byte_far(ad->farData + ad->pos++); }
+    return ad->data[ad->pos++];
+}
+
+unsigned int adpcmFill(pcmSource* src, byte* buf, unsigned int len){
+    pcmAdpcmSource* ad = (pcmAdpcmSource*)src;
+    int pred = ad->predictor;
+    char index = ad->stepIndex;
+    unsigned int n = 0;
+    while(n < len){
+        byte code;
+        if(ad->highNibble){
+            code = ad->pending >> 4;
+            ad->highNibble = 0;
+        }else{
+            if(ad->blockLeft == 0){
+                int b0 = adpcmByte(ad), b1 = adpcmByte(ad), b2 = adpcmByte(ad), b3 = adpcmByte(ad);
+                if(b3 < 0){ break; }
+                pred = (int16_t)(b0 | (unsigned int)b1 << 8);
+                index = b2 > 88 ? 88 : b2;
+                ad->blockLeft = ad->blockAlign - 4;
+                buf[n++] = (pred >> 8) + 128;
+                continue;
+            }
+            int b = adpcmByte(ad);
+            if(b < 0){ break; }
+            ad->blockLeft--;
+            ad->pending = b;
+            ad->highNibble = 1;
+            code = b & 0x0F;
+        }
+        unsigned int step = pgm_read_word(&adpcmSteps[(byte)index]);
+        unsigned int diff = step >> 3;
+        if(code & 1){ diff += step >> 2; }
+        if(code & 2){ diff += step >> 1; }
+        if(code & 4){ diff += step; }
+        long p = (code & 8) ? (long)pred - diff : (long)pred + diff;
+        pred = p > 32767 ? 32767 : (p < -32768 ? -32768 : p);
+        index += (char)pgm_read_byte(&adpcmIndex[code & 7]);
+        if(index < 0){ index = 0; }
+        else if(index > 88){ index = 88; }
+        buf[n++] = (pred >> 8) + 128;
+    }
+    ad->predictor = pred;
+    ad->stepIndex = index;
+    return n;
+}
+
+boolean adpcmRewind(pcmSource* src){
+    pcmAdpcmSource* ad = (pcmAdpcmSource*)src;
+    ad->pos = 0; ad->blockLeft = 0; ad->highNibble = 0;
+    ad->inPos = ad->inCount = 0;
+    if(ad->location != SOURCE_IN_FILE){ return 1; }
+    #if !defined (SDFAT)
+        return sFile.seek(ad->dataStart);
+    #else
+        return sFile.seekSet(ad->dataStart);
+    #endif
+}
+
+void adpcmStop(pcmSource* src){
+    if(((pcmAdpcmSource*)src)->location == SOURCE_IN_FILE){ fileStop(src); }
+}
+
+const pcmSourceOps adpcmOps = { adpcmFill, adpcmRewind, adpcmStop };
+
+pcmAdpcmSource::pcmAdpcmSource(){
+    ops = &adpcmOps;
+    onCard = 0;
+    length = 0; pos = 0; blockLeft = 0; highNibble = 0;
+    location = SOURCE_IN_RAM;
+}
+
+void pcmAdpcmSource::begin(const byte* d, unsigned long len, unsigned int rate, unsigned int align, byte loc){
+    data = d; farData = (uintptr_t)d; length = len; location = loc;
+    onCard = loc == SOURCE_IN_FILE;
+    sampleRate = rate;
+    blockAlign = align < 5 ? 5 : align;
+    adpcmRewind(this);
+}
+
+void pcmAdpcmSource::beginProgmem(uint_farptr_t d, unsigned long len, unsigned int rate, unsigned int align){
+    begin(NULL, len, rate, align, SOURCE_IN_PROGMEM);
+    farData = d;
+}
+
+void pcmAdpcmSource::beginFile(unsigned long start, unsigned long len, unsigned int rate, unsigned int align){
+    dataStart = start;
+    begin(NULL, len, rate, align, SOURCE_IN_FILE);
+}
+
+#endif
+
+//****************** RAM / PROGMEM source **********************
+
+unsigned int memoryFill(pcmSource* src, byte* buf, unsigned int len){
+    pcmMemorySource* mem = (pcmMemorySource*)src;
+    unsigned long left = mem->length - mem->pos;
+    if(left < len){ len = left; }
+    memcpy(buf, mem->data + mem->pos, len);
+    mem->pos += len;
+    return len;
+}
+
+unsigned int progmemFill(pcmSource* src, byte* buf, unsigned int len){
+    pcmMemorySource* mem = (pcmMemorySource*)src;
+    unsigned long left = mem->length - mem->pos;
+    if(left < len){ len = left; }
+    memcpy_PF(buf, mem->farData + mem->pos, len);
+    mem->pos += len;
+    return len;
+}
+
+boolean memoryRewind(pcmSource* src){
+    ((pcmMemorySource*)src)->pos = 0;
+    return 1;
+}
+
+const pcmSourceOps ramOps = { memoryFill, memoryRewind, NULL };
+const pcmSourceOps progmemOps = { progmemFill, memoryRewind, NULL };
+
+pcmMemorySource::pcmMemorySource(){
+    ops = &ramOps;
+    onCard = 0;
+    length = 0; pos = 0;
+}
+
+void pcmMemorySource::begin(const byte* d, unsigned long len, unsigned int rate, byte location){
+    if(location == SOURCE_IN_PROGMEM){ ops = &progmemOps; }
+    else{                              ops = &ramOps; }
+    data = d; farData = (uintptr_t)d; length = len; pos = 0;
+    sampleRate = rate;
+}
+
+void pcmMemorySource::beginProgmem(uint_farptr_t d, unsigned long len, unsigned int rate){
+    begin(NULL, len, rate, SOURCE_IN_PROGMEM);
+    farData = d;
+}
+
+//****************** Sine tone source **********************
+
+const byte sineTable[256] PROGMEM = {
+    128, 131, 134, 137, 140, 143, 146, 149, 152, 155, 158, 162, 165, 167, 170, 173,
+    176, 179, 182, 185, 188, 190, 193, 196, 198, 201, 203, 206, 208, 211, 213, 215,
+    218, 220, 222, 224, 226, 228, 230, 232, 234, 235, 237, 238, 240, 241, 243, 244,
+    245, 246, 248, 249, 250, 250, 251, 252, 253, 253, 254, 254, 254, 255, 255, 255,
+    255, 255, 255, 255, 254, 254, 254, 253, 253, 252, 251, 250, 250, 249, 248, 246,
+    245, 244, 243, 241, 240, 238, 237, 235, 234, 232, 230, 228, 226, 224, 222, 220,
+    218, 215, 213, 211, 208, 206, 203, 201, 198, 196, 193, 190, 188, 185, 182, 179,
+    176, 173, 170, 167, 165, 162, 158, 155, 152, 149, 146, 143, 140, 137, 134, 131,
+    128, 124, 121, 118, 115, 112, 109, 106, 103, 100,  97,  93,  90,  88,  85,  82,
+     79,  76,  73,  70,  67,  65,  62,  59,  57,  54,  52,  49,  47,  44,  42,  40,
+     37,  35,  33,  31,  29,  27,  25,  23,  21,  20,  18,  17,  15,  14,  12,  11,
+     10,   9,   7,   6,   5,   5,   4,   3,   2,   2,   1,   1,   1,   0,   0,   0,
+      0,   0,   0,   0,   1,   1,   1,   2,   2,   3,   4,   5,   5,   6,   7,   9,
+     10,  11,  12,  14,  15,  17,  18,  20,  21,  23,  25,  27,  29,  31,  33,  35,
+     37,  40,  42,  44,  47,  49,  52,  54,  57,  59,  62,  65,  67,  70,  73,  76,
+     79,  82,  85,  88,  90,  93,  97, 100, 103, 106, 109, 112, 115, 118, 121, 124,
+};
+
+unsigned int toneFill(pcmSource* src, byte* buf, unsigned int len){
+    pcmToneSource* tone = (pcmToneSource*)src;
+    uint16_t phase = tone->phase, step = tone->phaseStep;
+    unsigned int count = tone->envCount;
+    byte gain = tone->gain, target = 0;
+    boolean on = tone->envOn;
+    if(on){ target = tone->amplitude; }
+
+    for(unsigned int i=0; i<len; i++){
+        if(count == 0){
+            if(tone->onSamples && tone->offSamples){
+                on = !on;
+                count = on ? tone->onSamples : tone->offSamples;
+            }else{
+                on = tone->onSamples != 0;
+                count = 0xFFFF;
+            }
+            target = on ? tone->amplitude : 0;
+        }
+        count--;
+        if(gain < target){ gain = (target - gain > TONE_RAMP_STEP) ? gain + TONE_RAMP_STEP : target; }
+        else if(gain > target){ gain = (gain - target > TONE_RAMP_STEP) ? gain - TONE_RAMP_STEP : target; }
+
+        int s = (int)pgm_read_byte(&sineTable[phase >> 8]) - 128;
+        buf[i] = 128 + ((s * gain) >> 8);
+        phase += step;
+    }
+    tone->phase = phase; tone->envCount = count;
+    tone->gain = gain; tone->envOn = on;
+    return len;
+}
+
+boolean toneRewind(pcmSource*){
+    return 1;
+}
+
+const pcmSourceOps toneOps = { toneFill, toneRewind, NULL };
+
+pcmToneSource::pcmToneSource(){
+    ops = &toneOps;
+    onCard = 0;
+    phase = 0; phaseStep = 0; onSamples = 0; offSamples = 0;
+    envCount = 0; amplitude = 0; gain = 0; envOn = 0;
+}
+
+//amplitude: 0-255, full scale is 0 to 255 around the 128 center value
+void pcmToneSource::begin(unsigned int frequency, unsigned int rate, byte amp){
+    sampleRate = rate;
+    phase = 0; gain = 0; envOn = 0; envCount = 0;
+    amplitude = amp;
+    onSamples = 0xFFFF; offSamples = 0;
+    setFrequency(frequency);
+}
+
+void pcmToneSource::setFrequency(unsigned int frequency){
+    if(frequency >= sampleRate/2){ frequency = sampleRate/2 - 1; }
+    uint16_t step = ((unsigned long)frequency << 16) / sampleRate;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){ phaseStep = step; }   //16 bits, read by the refill interrupt
+}
+
+//onMillis 0 gives silence, offMillis 0 a continuous tone. The current part
+//is shortened if it is longer than the new one, so a closer obstacle is heard at once
+void pcmToneSource::setEnvelope(unsigned int onMillis, unsigned int offMillis){
+    unsigned long on = ((unsigned long)onMillis * sampleRate) / 1000;
+    unsigned long off = ((unsigned long)offMillis * sampleRate) / 1000;
+    if(on > 0xFFFE){ on = 0xFFFE; }
+    if(off > 0xFFFE){ off = 0xFFFE; }
+    if(onMillis && !on){ on = 1; }
+    if(offMillis && !off){ off = 1; }
+
+    noInterrupts();
+    onSamples = on; offSamples = off;
+    unsigned int part = envOn ? on : off;
+    if(!on || !off){ part = 0; }
+    if(envCount > part){ envCount = part; }
+    interrupts();
+}
+
+void pcmToneSource::setAmplitude(byte amp){
+    amplitude = amp;
+}
+
+#endif
@@ -0,0 +1,199 @@
+/*Library by TMRh20 2012-2014
+
+  pcmSource - Sample sources feeding the double buffered refill interrupt of TMRpcm
+
+  A source is called once per buffer, never per sample, through a small table of function
+  pointers. There are no virtual functions, so no vtable and no per call overhead beyond one
+  indirect call. New sources (codecs, generators) only need a fill function and an ops table.
+*/
+
+#ifndef pcmSource_h   // if x.h hasn't been included yet...
+#define pcmSource_h   //   #define this so the compiler knows it has been included
+
+#include <Arduino.h>
+#include <avr/pgmspace.h>
+#include <pcmConfig.h>
+#if defined (PLAYLIST)
+	#if !defined (SDFAT)
+		#include <SD.h>
+	#else
+		#include <SdFat.h>
+	#endif
+#endif
+
+class pcmSource;
+
+struct pcmSourceOps {
+	//Copy up to len samples to buf, return the number copied. Less than len means the end of the source
+	unsigned int (*fill)(pcmSource* src, byte* buf, unsigned int len);
+	//Restart at the first sample when looping, return 0 if not possible
+	boolean (*rewind)(pcmSource* src);
+	//Called once when playback of this source ends or is stopped, may be NULL
+	void (*stop)(pcmSource* src);
+};
+
+class pcmSource
+{
+ public:
+	unsigned int fill(byte* buf, unsigned int len){ return ops->fill(this,buf,len); }
+	boolean rewind(){ return ops->rewind(this); }
+	void stop(){ if(ops->stop){ ops->stop(this); } }
+	unsigned int sampleRate;
+	boolean onCard;     //Read from the SD card: the refill then takes the SPI bus through pcmSpi
+
+ protected:
+	const pcmSourceOps* ops;
+};
+
+//*** The WAV file opened by TMRpcm ***
+class pcmFileSource : public pcmSource
+{
+ public:
+	pcmFileSource();
+	void begin(unsigned int sampleRate, unsigned long dataStart);
+	unsigned long dataStart;
+};
+
+//*** Samples in RAM (internal or external) or in PROGMEM ***
+//PROGMEM is read through 32-bit addresses, from pgm_get_far_address(), as a clip may lie past the first 64 KB
+//of flash. begin() with SOURCE_IN_PROGMEM takes a near pointer, only valid in those 64 KB
+#define SOURCE_IN_RAM      0
+#define SOURCE_IN_PROGMEM  1
+#define SOURCE_IN_FILE     2   //The file opened by TMRpcm
+
+class pcmMemorySource : public pcmSource
+{
+ public:
+	pcmMemorySource();
+	void begin(const byte* data, unsigned long length, unsigned int sampleRate, byte location);
+	void beginProgmem(uint_farptr_t data, unsigned long length, unsigned int sampleRate);
+	const byte* data;
+	uint_farptr_t farData;
+	unsigned long length;
+	unsigned long pos;
+};
+
+#if defined (SD_RAW_READ)
+//*** The open WAV file, if stored in contiguous clusters, read with SD multi-block commands ***
+//fill() must be given whole 512 byte blocks
+class pcmRawSource : public pcmSource
+{
+ public:
+	pcmRawSource();
+	boolean begin(unsigned int sampleRate, unsigned long dataStart, unsigned long dataEnd);
+	boolean seek(unsigned long position);
+	unsigned long dataStart;
+	unsigned long firstBlock;  //Block of file position 0
+	unsigned long lastBlock;   //Block holding the last data byte
+	unsigned long block;       //Next block to read
+	unsigned int tailLength;   //Data bytes in the last block
+	unsigned int skip;         //Bytes before the data in the next block read
+	boolean reading;           //Multi-block read in progress
+};
+#endif
+
+#if defined (PLAYLIST)
+//*** The data chunk of a WAV file with its own handle, several can stay open ***
+class pcmWavSource : public pcmSource
+{
+ public:
+	pcmWavSource();
+	unsigned long dataStart;
+	unsigned long dataLength;
+	unsigned long left;        //Data bytes not read yet
+	#if !defined (SDFAT)
+	File file;
+	#else
+	SdFile file;
+	#endif
+};
+
+//*** Sources played one after the other. The next one fills the rest of the buffer the previous one ended in ***
+class pcmPlaylistSource : public pcmSource
+{
+ public:
+	pcmPlaylistSource();
+	void clear();
+	//Returns 0 if the list is full or the source has another sample rate than the first one
+	boolean add(pcmSource* source);
+	pcmSource* items[PLAYLIST];
+	byte count;
+	byte current;
+};
+#endif
+
+#if defined (MIXER_VOICES)
+//*** Sum of up to MIXER_VOICES sources, each with its own gain, saturated to the 8-bit range ***
+//A voice is removed when its source ends. The mixer ends with its last voice, unless hold is set:
+//it then plays silence until voices are added again
+class pcmMixerSource : public pcmSource
+{
+ public:
+	pcmMixerSource();
+	void begin(unsigned int sampleRate, boolean hold);
+	//These can be called while playing, the change applies at the next buffer
+	//Returns the voice number, or -1 if all are used, the sample rate differs or the source is already mixed.
+	//gain: 255 is full scale
+	char add(pcmSource* source, byte gain);
+	void setGain(byte voice, byte gain);
+	void remove(byte voice);
+
+	pcmSource* volatile voices[MIXER_VOICES];
+	volatile byte gains[MIXER_VOICES];
+	boolean hold;
+};
+#endif
+
+#if defined (ADPCM)
+//*** IMA-ADPCM mono data, in blocks of blockAlign bytes as in a WAV file: a 4 byte header with the first
+//sample and the step index, then 2 samples per byte, low nibble first ***
+class pcmAdpcmSource : public pcmSource
+{
+ public:
+	pcmAdpcmSource();
+	void begin(const byte* data, unsigned long length, unsigned int sampleRate, unsigned int blockAlign, byte location);
+	void beginProgmem(uint_farptr_t data, unsigned long length, unsigned int sampleRate, unsigned int blockAlign);
+	//From the file opened by TMRpcm, data chunk at dataStart
+	void beginFile(unsigned long dataStart, unsigned long length, unsigned int sampleRate, unsigned int blockAlign);
+	const byte* data;
+	uint_farptr_t farData;
+	unsigned long dataStart;
+	unsigned long length;
+	unsigned long pos;         //Next byte
+	unsigned int blockAlign;
+	unsigned int blockLeft;    //Bytes left in the current block, 0: next is a header
+	int predictor;
+	byte stepIndex;
+	byte pending;              //Byte of the next high nibble
+	boolean highNibble;
+	byte location;
+	byte inPos, inCount;       //Read ahead of SOURCE_IN_FILE
+};
+#endif
+
+//*** Generated sine tone (DDS), with an on/off envelope for beeps ***
+//The phase accumulator is 16 bits, the upper 8 bits index a 256 entry sine table,
+//so the frequency step is sampleRate/65536 (0.25Hz at 16kHz)
+#define TONE_RAMP_STEP  8   //Gain change per sample at the start and end of a beep, avoids clicks
+
+class pcmToneSource : public pcmSource
+{
+ public:
+	pcmToneSource();
+	void begin(unsigned int frequency, unsigned int sampleRate, byte amplitude);
+	//These can be called while playing, the change applies at the next buffer
+	void setFrequency(unsigned int frequency);
+	void setEnvelope(unsigned int onMillis, unsigned int offMillis);
+	void setAmplitude(byte amplitude);
+
+	uint16_t phase;                    //Wraps around, must stay 16 bits whatever the width of int
+	volatile uint16_t phaseStep;
+	volatile unsigned int onSamples;   //0: silent
+	volatile unsigned int offSamples;  //0: continuous tone
+	volatile unsigned int envCount;    //Samples left in the current on or off part
+	volatile byte amplitude;           //Gain of the on part, 255 is full scale
+	byte gain;
+	boolean envOn;
+};
+
+#endif
@@ -0,0 +1,129 @@
+/*Library by TMRh20 2012-2014
+
+  pcmSpi - Arbiter of the SPI bus shared by the SD card audio, the RF radio and the card logging. See pcmSpi.h
+*/
+
+#include <pcmSpi.h>
+
+struct pcmSpiClient {
+	pcmSpiCanWait canWait;
+	void (*hold)();
+	void (*resume)();
+};
+
+static pcmSpiClient clients[PCM_SPI_CLIENTS];
+volatile byte pcmSpiOwner = PCM_SPI_FREE;
+
+#if defined (SPI_STATS)
+	static pcmSpiStats stats[PCM_SPI_CLIENTS];
+	static unsigned long busyStart;
+	static unsigned long waitStart[PCM_SPI_CLIENTS];
+	static boolean waiting[PCM_SPI_CLIENTS];
+
+	static void statRefused(byte client){
+		stats[client].refused++;
+		if(!waiting[client]){ waiting[client] = 1; waitStart[client] = micros(); }
+	}
+
+	static void statGranted(byte client){
+		busyStart = micros();
+		if(waiting[client]){
+			unsigned long wait = busyStart - waitStart[client];
+			stats[client].waitMicros += wait;
+			if(wait > stats[client].maxWaitMicros){ stats[client].maxWaitMicros = wait > 0xFFFF ? 0xFFFF : wait; }
+			waiting[client] = 0;
+		}
+	}
+
+	static void statDone(byte client, unsigned int bytes){
+		stats[client].transfers++;
+		stats[client].bytes += bytes;
+		stats[client].busyMicros += micros() - busyStart;
+	}
+
+	pcmSpiStats pcmSpiGetStats(byte client){
+		noInterrupts();
+		pcmSpiStats s = stats[client];
+		interrupts();
+		return s;
+	}
+
+	void pcmSpiResetStats(){
+		noInterrupts();
+		memset(stats,0,sizeof(stats));
+		memset(waiting,0,sizeof(waiting));
+		interrupts();
+	}
+#else
+	#define statRefused(client)
+	#define statGranted(client)
+	#define statDone(client,bytes) ((void)(bytes))   //Counted with SPI_STATS only
+#endif
+
+void pcmSpiRegister(byte client, pcmSpiCanWait canWait, void (*hold)(), void (*resume)()){
+	noInterrupts();
+	clients[client].canWait = canWait;
+	clients[client].hold = hold;
+	clients[client].resume = resume;
+	interrupts();
+}
+
+//From the main loop only. The higher clients are asked first, with interrupts on, then held off
+boolean pcmSpiAcquire(byte client, unsigned int micros){
+	for(byte i=0; i<client; i++){
+		if(clients[i].canWait && !clients[i].canWait(micros)){
+			noInterrupts(); statRefused(client); interrupts();
+			return 0;
+		}
+	}
+	noInterrupts();
+	if(pcmSpiOwner != PCM_SPI_FREE){
+		statRefused(client);
+		interrupts();
+		return 0;
+	}
+	for(byte i=0; i<client; i++){
+		if(clients[i].hold){ clients[i].hold(); }
+	}
+	pcmSpiOwner = client;
+	statGranted(client);
+	interrupts();
+	return 1;
+}
+
+void pcmSpiRelease(byte client, unsigned int bytes){
+	noInterrupts();
+	if(pcmSpiOwner == client){
+		statDone(client,bytes);
+		pcmSpiOwner = PCM_SPI_FREE;
+		for(byte i=0; i<client; i++){
+			if(clients[i].resume){ clients[i].resume(); }
+		}
+	}
+	interrupts();
+}
+
+//From an interrupt, never waits: 0 while another client has the bus, retried on the next interrupt
+boolean pcmSpiBegin(byte client){
+	byte sreg = SREG;
+	cli();
+	boolean ok = pcmSpiOwner == PCM_SPI_FREE;
+	if(ok){
+		pcmSpiOwner = client;
+		statGranted(client);
+	}else{
+		statRefused(client);
+	}
+	SREG = sreg;
+	return ok;
+}
+
+void pcmSpiEnd(byte client, unsigned int bytes){
+	byte sreg = SREG;
+	cli();
+	if(pcmSpiOwner == client){
+		statDone(client,bytes);
+		pcmSpiOwner = PCM_SPI_FREE;
+	}
+	SREG = sreg;
+}
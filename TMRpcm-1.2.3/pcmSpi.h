@@ -0,0 +1,52 @@
+/*Library by TMRh20 2012-2014
+
+  pcmSpi - Arbiter of the SPI bus shared by the SD card audio, the RF radio and the card logging
+
+  Clients rank by their number, the lower one first: PCM_SPI_AUDIO (buffer refills of TMRpcm), PCM_SPI_RADIO (pcmRF
+  packets), PCM_SPI_LOG (card writes from the main loop). A client driven by an interrupt registers how long it can
+  wait for the bus. The main loop asks for the bus with pcmSpiAcquire() and the time it needs: granted only if no higher
+  client needs the bus before the end, their interrupts then wait for pcmSpiRelease(). Interrupts take the bus with
+  pcmSpiBegin(), which fails while another client has it. With SPI_STATS in pcmConfig.h, pcmSpiGetStats() gives the
+  transfers, bytes, busy and wait times of each client.
+*/
+
+#ifndef pcmSpi_h   // if x.h hasn't been included yet...
+#define pcmSpi_h   //   #define this so the compiler knows it has been included
+
+#include <Arduino.h>
+#include <pcmConfig.h>
+
+#define PCM_SPI_AUDIO    0
+#define PCM_SPI_RADIO    1
+#define PCM_SPI_LOG      2
+#define PCM_SPI_CLIENTS  3
+#define PCM_SPI_FREE     0xFF
+
+#if defined (SPI_STATS)
+	struct pcmSpiStats {
+		unsigned long transfers;
+		unsigned long bytes;
+		unsigned long busyMicros;
+		unsigned long waitMicros;     //From the first refused request to the grant
+		unsigned int maxWaitMicros;
+		unsigned long refused;
+	};
+#endif
+
+//Returns 0 if the client needs the bus within micros. Called with interrupts on
+typedef boolean (*pcmSpiCanWait)(unsigned int micros);
+
+//hold and resume stop and restart the interrupt of the client while a lower one has the bus, may be NULL
+void pcmSpiRegister(byte client, pcmSpiCanWait canWait, void (*hold)(), void (*resume)());
+boolean pcmSpiAcquire(byte client, unsigned int micros);
+void pcmSpiRelease(byte client, unsigned int bytes);
+boolean pcmSpiBegin(byte client);
+void pcmSpiEnd(byte client, unsigned int bytes);
+extern volatile byte pcmSpiOwner;
+
+#if defined (SPI_STATS)
+	pcmSpiStats pcmSpiGetStats(byte client);
+	void pcmSpiResetStats();
+#endif
+
+#endif
@@ -0,0 +1,36 @@
+/*Library by TMRh20 2012-2014*/
+
+#include <pcmTrace.h>
+
+#if defined (ENABLE_TRACE)
+
+pcmTraceRecord traceRing[TRACE_SIZE];
+byte traceHead = 0, traceCount = 0;
+
+//Safe from interrupts and main code, the interrupt state is restored
+void pcmTrace(byte id, byte arg){
+    unsigned long now = micros();
+    byte sreg = SREG;
+    cli();
+    pcmTraceRecord* rec = &traceRing[traceHead];
+    rec->id = id; rec->arg = arg; rec->micros = now;
+    if(++traceHead >= TRACE_SIZE){ traceHead = 0; }
+    if(traceCount < TRACE_SIZE){ traceCount++; }
+    SREG = sreg;
+}
+
+//Sends and clears the records. They are copied at once, events during the sending go to the next dump
+void pcmTraceDump(Print& out){
+    pcmTraceRecord copy[TRACE_SIZE];
+    noInterrupts();
+    byte count = traceCount;
+    byte first = (traceHead + TRACE_SIZE - count) % TRACE_SIZE;
+    for(byte i=0; i<count; i++){ copy[i] = traceRing[(first + i) % TRACE_SIZE]; }
+    traceCount = 0;
+    interrupts();
+
+    out.write('T'); out.write('R'); out.write(count);
+    out.write((const uint8_t*)copy, count * sizeof(pcmTraceRecord));
+}
+
+#endif
@@ -0,0 +1,42 @@
+/*Library by TMRh20 2012-2014
+
+  pcmTrace - Timestamped event records for latency measurements
+
+  Events are written from interrupts or from the main code into a small ring buffer, oldest records
+  are overwritten. pcmTraceDump() sends them in binary, to be decoded on the host by tools/trace_decode.py.
+  Without ENABLE_TRACE in pcmConfig.h, PCM_TRACE() compiles to nothing.
+*/
+
+#ifndef pcmTrace_h   // if x.h hasn't been included yet...
+#define pcmTrace_h   //   #define this so the compiler knows it has been included
+
+#include <Arduino.h>
+#include <pcmConfig.h>
+
+#if defined (ENABLE_TRACE)
+
+	//*** Event ids, up to 31 for the libraries, the sketch uses TRACE_USER and up ***
+	#define TRACE_US_TRIGGER     1   //HC-SR04 trigger pulse started
+	#define TRACE_US_ECHO        2   //End of the echo pulse, arg: distance in 2cm steps, 0 if none
+	#define TRACE_PLAY           8   //play() called
+	#define TRACE_HEADER         9   //WAV header parsed or found in the index
+	#define TRACE_RAMP          10   //PWM output ramped up, the buffers are filled next
+	#define TRACE_FIRST_SAMPLE  11   //First sample written to the PWM output
+	#define TRACE_USER          32
+
+	//Dump: 'T','R', record count, then the records, oldest first. Little endian as on AVR
+	struct pcmTraceRecord {
+		byte id;
+		byte arg;
+		unsigned long micros;
+	};
+
+	void pcmTrace(byte id, byte arg);
+	void pcmTraceDump(Print& out);
+
+	#define PCM_TRACE(id,arg) pcmTrace(id,arg)
+#else
+	#define PCM_TRACE(id,arg)
+#endif
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ * @file      Telemetry.cpp
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  Binary telemetry frames on the serial console.
+ */
+
+#include <Arduino.h>
+#include "Telemetry.h"
+
+static TelemetryFrame sQueue[TELEMETRY_QUEUE_FRAMES];
+static uint8_t sQueueHead = 0;   // Next frame to send
+static uint8_t sQueueCount = 0;
+static uint8_t sSequence = 0;
+static uint8_t sDecimation = 0;
+static uint16_t sDropCount = 0;
+
+/*
+ * Queue a sample, called from the tasks only (not from an interrupt)
+ * @return  false if the sample was not queued (decimated or dropped)
+ */
+bool sendTelemetry(uint16_t aRawCentimeter, uint16_t aCentimeter,
+                   uint16_t aPeriodMillis, uint8_t aAudioState, uint8_t aSleepPercent)
+{
+  uint8_t tSequence = sSequence++;
+  if (tSequence & ((1 << sDecimation) - 1))
+    return false;
+  // The UART caught up since the last queued sample, send more samples again
+  if (sQueueCount == 0 && sDecimation > 0)
+    sDecimation--;
+  if (sQueueCount >= TELEMETRY_QUEUE_FRAMES)
+    {
+      sDropCount++;
+      if (sDecimation < TELEMETRY_MAX_DECIMATION)
+        sDecimation++;
+      return false;
+    }
+
+  TelemetryFrame *tFrame = &sQueue[(sQueueHead + sQueueCount) % TELEMETRY_QUEUE_FRAMES];
+  tFrame->sync = TELEMETRY_SYNC;
+  tFrame->sequence = tSequence;
+  tFrame->timeMillis = millis();
+  tFrame->rawCentimeter = aRawCentimeter;
+  tFrame->centimeter = aCentimeter;
+  tFrame->periodMillis = aPeriodMillis;
+  tFrame->audioState = aAudioState;
+  tFrame->decimation = sDecimation;
+  tFrame->sleepPercent = aSleepPercent;
+
+  uint8_t tChecksum = 0;
+  const uint8_t *tBytes = (const uint8_t *)tFrame;
+  for (uint8_t i = 0; i < sizeof(TelemetryFrame) - 1; i++)
+    tChecksum ^= tBytes[i];
+  tFrame->checksum = tChecksum;
+  sQueueCount++;
+  return true;
+}
+
+/*
+ * Moves whole frames into the transmit buffer of the core, which is drained by
+ * its UART data register empty interrupt. Never waits for space.
+ */
+void flushTelemetry(void)
+{
+  while (sQueueCount > 0 && Serial.availableForWrite() >= (int)sizeof(TelemetryFrame))
+    {
+      Serial.write((const uint8_t *)&sQueue[sQueueHead], sizeof(TelemetryFrame));
+      sQueueHead = (sQueueHead + 1) % TELEMETRY_QUEUE_FRAMES;
+      sQueueCount--;
+    }
+}
+
+/*
+ * @return  Samples lost because the queue was full, since boot
+ */
+uint16_t getTelemetryDropCount(void)
+{
+  return sDropCount;
+}
@@ -0,0 +1,45 @@
+/**
+ * @file      Telemetry.h
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  Binary telemetry frames on the serial console. A few frames wait  in
+ * a small queue and are handed to  the UART only when its  transmit buffer can
+ * take a whole frame, so sending never blocks. When the UART cannot keep  up,
+ * only one sample out of 2^decimation is queued, and frames are dropped  when
+ * the queue is full. Decode on the host with tools/telemetry_decode.py.
+ */
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+
+#define TELEMETRY_SYNC            0xA5
+#define TELEMETRY_QUEUE_FRAMES    8
+#define TELEMETRY_MAX_DECIMATION  4     // Down to one sample out of 16
+
+#define TELEMETRY_AUDIO_PLAYING   0x01  // audioState bits
+#define TELEMETRY_AUDIO_PRIORITY_SHIFT 4
+
+// Little endian, as sent
+struct __attribute__((packed)) TelemetryFrame
+{
+  uint8_t  sync;            // TELEMETRY_SYNC
+  uint8_t  sequence;        // Incremented per sample, gaps are decimated or dropped samples
+  uint32_t timeMillis;
+  uint16_t rawCentimeter;
+  uint16_t centimeter;      // Filtered
+  uint16_t periodMillis;
+  uint8_t  audioState;
+  uint8_t  decimation;      // log2 of the decimation in use
+  uint8_t  sleepPercent;    // CPU asleep since the previous sample, see Scheduler.h
+  uint8_t  checksum;        // XOR of all previous bytes
+};
+
+bool sendTelemetry(uint16_t aRawCentimeter, uint16_t aCentimeter,
+                   uint16_t aPeriodMillis, uint8_t aAudioState, uint8_t aSleepPercent);
+void flushTelemetry(void);
+uint16_t getTelemetryDropCount(void);
+
+#endif // TELEMETRY_H_
@@ -0,0 +1,139 @@
+/**
+ * @file      Arduino.h
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  Arduino core of the host simulation. The time is the simulated one
+ * and every call gives the interrupts that are due a chance to run, see
+ * sim.h. Pins are mapped to ports of 8 bits in order: pin / 8 + 1, bit pin % 8.
+ */
+
+#ifndef SIM_ARDUINO_H_
+#define SIM_ARDUINO_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define LED_BUILTIN 13
+#define A0 54
+#define DEC 10
+#define HEX 16
+#define NOT_A_PIN 0
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+#define bit(b) (1UL << (b))
+#define lowByte(w) ((uint8_t)((w) & 0xff))
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define F(string) (string)
+
+// Binary constants used by the libraries
+#define B00000100 4
+#define B00000101 5
+#define B00000110 6
+#define B00100000 32
+#define B01100000 96
+
+#define noInterrupts() cli()
+#define interrupts() sei()
+
+#define SIM_PORTS 10
+extern volatile uint8_t simPinRegister[SIM_PORTS];
+extern volatile uint8_t simPortRegister[SIM_PORTS];
+extern volatile uint8_t simDdrRegister[SIM_PORTS];
+#define digitalPinToPort(pin) ((pin) / 8 + 1)
+#define digitalPinToBitMask(pin) (1 << ((pin) % 8))
+#define portInputRegister(port) (&simPinRegister[port])
+#define portOutputRegister(port) (&simPortRegister[port])
+#define portModeRegister(port) (&simDdrRegister[port])
+// Pin change interrupts as on the Mega: 10 to 13 and 50 to 53 on PCINT0, A8 to A15 on PCINT2
+#define SIM_PIN_ON_PCINT0(pin) (((pin) >= 10 && (pin) <= 13) || ((pin) >= 50 && (pin) <= 53))
+#define SIM_PIN_ON_PCINT2(pin) ((pin) >= 62 && (pin) <= 69)
+#define digitalPinToPCICR(pin) ((SIM_PIN_ON_PCINT0(pin) || SIM_PIN_ON_PCINT2(pin)) ? &PCICR : (volatile uint8_t *)0)
+#define digitalPinToPCICRbit(pin) (SIM_PIN_ON_PCINT0(pin) ? 0 : 2)
+#define digitalPinToPCMSK(pin) (SIM_PIN_ON_PCINT0(pin) ? &PCMSK0 : SIM_PIN_ON_PCINT2(pin) ? &PCMSK2 : (volatile uint8_t *)0)
+#define digitalPinToPCMSKbit(pin) \
+  (((pin) >= 10 && (pin) <= 13) ? (pin) - 6 : ((pin) >= 50 && (pin) <= 53) ? 53 - (pin) : SIM_PIN_ON_PCINT2(pin) ? (pin) - 62 : 0)
+
+void pinMode(uint8_t aPin, uint8_t aMode);
+void digitalWrite(uint8_t aPin, uint8_t aValue);
+int digitalRead(uint8_t aPin);
+int analogRead(uint8_t aPin);
+unsigned long micros(void);
+unsigned long millis(void);
+void delay(unsigned long aMillis);
+void delayMicroseconds(unsigned int aMicros);
+unsigned long pulseIn(uint8_t aPin, uint8_t aState, unsigned long aTimeoutMicros = 1000000L);
+unsigned long pulseInLong(uint8_t aPin, uint8_t aState, unsigned long aTimeoutMicros = 1000000L);
+
+static inline long map(long x, long in_min, long in_max, long out_min, long out_max)
+{
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+class Print
+{
+public:
+  virtual size_t write(uint8_t aByte) = 0;
+  virtual size_t write(const uint8_t *aBuffer, size_t aSize);
+  size_t write(const char *aString) { return write((const uint8_t *)aString, strlen(aString)); }
+  virtual int availableForWrite(void) { return 0; }
+  virtual void flush(void) {}
+
+  size_t print(const char *aString) { return write(aString); }
+  size_t print(char aChar) { return write((uint8_t)aChar); }
+  size_t print(unsigned char aValue, int aBase = DEC) { return print((unsigned long)aValue, aBase); }
+  size_t print(int aValue, int aBase = DEC) { return print((long)aValue, aBase); }
+  size_t print(unsigned int aValue, int aBase = DEC) { return print((unsigned long)aValue, aBase); }
+  size_t print(long aValue, int aBase = DEC);
+  size_t print(unsigned long aValue, int aBase = DEC);
+  size_t print(double aValue, int aDigits = 2);
+
+  size_t println(void) { return write("\r\n"); }
+  template<typename T> size_t println(T aValue) { size_t n = print(aValue); return n + println(); }
+  template<typename T> size_t println(T aValue, int aFormat) { size_t n = print(aValue, aFormat); return n + println(); }
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available(void) = 0;
+  virtual int read(void) = 0;
+  virtual int peek(void) = 0;
+};
+
+// USART0 at its baud rate: availableForWrite() is the room left in the 64 byte
+// buffer of the Arduino core, which drains in simulated time
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long aBaud);
+  void end(void) {}
+  size_t write(uint8_t aByte);
+  using Print::write;
+  int availableForWrite(void);
+  int available(void);
+  int read(void);
+  int peek(void);
+  operator bool() { return true; }
+};
+extern HardwareSerial Serial;
+
+#endif // SIM_ARDUINO_H_
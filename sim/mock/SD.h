@@ -0,0 +1,67 @@
+/**
+ * @file      SD.h
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  SD library of the host simulation: a flat FAT root directory in RAM,
+ * names compared without case. The card time is charged to the simulated
+ * CPU like the SPI transfers of the real library: a block read or write
+ * when another block than the cached one is accessed, a few cycles per byte
+ * copied from the cache. Interrupts run meanwhile if enabled.
+ */
+
+#ifndef SD_H_
+#define SD_H_
+
+#include <Arduino.h>
+
+#define O_READ     0x01
+#define O_WRITE    0x02
+#define O_APPEND   0x04
+#define O_CREAT    0x10
+#define O_TRUNC    0x40
+#define FILE_READ  O_READ
+#define FILE_WRITE (O_READ | O_WRITE | O_CREAT | O_APPEND)
+
+struct SimSdEntry;
+
+class File : public Stream
+{
+public:
+  File(void) : mEntry(NULL), mPosition(0), mDirectory(false), mNext(0) {}
+  size_t write(uint8_t aByte) { return write(&aByte, 1); }
+  size_t write(const uint8_t *aBuffer, size_t aSize);
+  using Print::write;
+  int read(void);
+  int read(void *aBuffer, uint16_t aSize);
+  int peek(void);
+  int available(void);
+  void flush(void);
+  bool seek(uint32_t aPosition);
+  uint32_t position(void) { return mPosition; }
+  uint32_t size(void);
+  void close(void);
+  operator bool() { return mEntry != NULL || mDirectory; }
+  char *name(void);
+  bool isDirectory(void) { return mDirectory; }
+  File openNextFile(uint8_t aMode = FILE_READ);
+  void rewindDirectory(void) { mNext = 0; }
+
+  SimSdEntry *mEntry;
+  uint32_t mPosition;
+  bool mDirectory;
+  uint16_t mNext;     // Of a directory
+};
+
+class SDClass
+{
+public:
+  bool begin(uint8_t aChipSelectPin = 53);
+  bool begin(uint32_t aClock, uint8_t aChipSelectPin);
+  File open(const char *aName, uint8_t aMode = FILE_READ);
+  bool exists(const char *aName);
+  bool remove(const char *aName);
+};
+extern SDClass SD;
+
+#endif // SD_H_
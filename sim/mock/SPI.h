@@ -0,0 +1,14 @@
+/**
+ * @file      SPI.h
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  The card is the only SPI device of the simulation, see SD.h.
+ */
+
+#ifndef SIM_SPI_H_
+#define SIM_SPI_H_
+
+#include <Arduino.h>
+
+#endif // SIM_SPI_H_
@@ -0,0 +1,22 @@
+/**
+ * @file      interrupt.h
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  Interrupt vectors are plain C functions, called by the simulator
+ * when their flag and enable bits are set and SREG allows it.
+ */
+
+#ifndef SIM_AVR_INTERRUPT_H_
+#define SIM_AVR_INTERRUPT_H_
+
+void cli(void);
+void sei(void);    // Pending interrupts are taken right away
+
+// ISR(vector, ISR_ALIASOF(target)); makes vector a second name of target, so
+// the simulator finds the handler under both vectors
+#define ISR(vector, ...) extern "C" void vector(void) __VA_ARGS__; extern "C" void vector(void)
+#define ISR_ALIASOF(vector) __attribute__((alias(#vector)))
+#define ISR_NOBLOCK
+
+#endif // SIM_AVR_INTERRUPT_H_
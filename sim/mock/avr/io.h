@@ -0,0 +1,86 @@
+/**
+ * @file      io.h
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  Registers of the ATmega2560 used by the sketch and TMRpcm, as plain
+ * variables of the host. The 16-bit timers 1, 3, 4 and 5 are run by the
+ * simulator, see sim.h. The interrupt flag registers clear the bits written
+ * as 1, like on the AVR.
+ */
+
+#ifndef SIM_AVR_IO_H_
+#define SIM_AVR_IO_H_
+
+#include <stdint.h>
+
+#define _BV(b) (1 << (b))
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+// Write one to clear, the simulator sets the flags with raise()
+struct SimFlagRegister
+{
+  volatile uint8_t value;
+  SimFlagRegister &operator=(uint8_t aValue) { value &= ~aValue; return *this; }
+  SimFlagRegister &operator|=(uint8_t aValue) { value &= ~aValue; return *this; }
+  operator uint8_t() const { return value; }
+  void raise(uint8_t aBits) { value |= aBits; }
+};
+
+// 16-bit timers, int is 32 bits on the host but the libraries take the address as unsigned int
+#define SIM_TIMER16(n)                                                  \
+  extern volatile uint8_t TCCR##n##A, TCCR##n##B, TCCR##n##C, TIMSK##n; \
+  extern volatile unsigned int TCNT##n, OCR##n##A, OCR##n##B, OCR##n##C, ICR##n; \
+  extern SimFlagRegister TIFR##n;
+SIM_TIMER16(1)
+SIM_TIMER16(3)
+SIM_TIMER16(4)
+SIM_TIMER16(5)
+
+// Bit positions, the same on all 16-bit timers
+#define SIM_TIMER16_BITS(n)                                             \
+  WGM##n##0 = 0, WGM##n##1 = 1, WGM##n##2 = 3, WGM##n##3 = 4,           \
+  COM##n##A1 = 7, COM##n##A0 = 6, COM##n##B1 = 5, COM##n##B0 = 4,       \
+  COM##n##C1 = 3, COM##n##C0 = 2,                                       \
+  CS##n##0 = 0, CS##n##1 = 1, CS##n##2 = 2, ICES##n = 6, ICNC##n = 7,   \
+  TOIE##n = 0, OCIE##n##A = 1, OCIE##n##B = 2, OCIE##n##C = 3, ICIE##n = 5, \
+  TOV##n = 0, OCF##n##A = 1, OCF##n##B = 2, OCF##n##C = 3, ICF##n = 5
+enum { SIM_TIMER16_BITS(1), SIM_TIMER16_BITS(3), SIM_TIMER16_BITS(4), SIM_TIMER16_BITS(5) };
+
+// 8-bit timers, not simulated
+extern volatile uint8_t TCCR0A, TCCR0B, TIMSK0, TCNT0, OCR0A, OCR0B;
+extern volatile uint8_t TCCR2A, TCCR2B, TIMSK2, TCNT2, OCR2A, OCR2B, ASSR;
+enum
+{
+  WGM20 = 0, WGM21 = 1, WGM22 = 3, COM2A1 = 7, COM2A0 = 6, COM2B1 = 5, COM2B0 = 4,
+  CS20 = 0, CS21 = 1, CS22 = 2, TOIE2 = 0, OCIE2A = 1, OCIE2B = 2
+};
+
+// Status register, bit 7 is the global interrupt enable
+extern volatile uint8_t SREG;
+#define SREG_I 7
+
+// SPI, USART, ADC, power, sleep and external memory
+extern volatile uint8_t SPCR, SPSR, SPDR;
+enum { SPR0 = 0, SPR1 = 1, CPHA = 2, CPOL = 3, MSTR = 4, DORD = 5, SPE = 6, SPIE = 7, SPI2X = 0, SPIF = 7 };
+extern volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UDR0;
+extern volatile uint8_t ADMUX, ADCSRA, ADCSRB, ADCL, ADCH, DIDR0;
+extern volatile unsigned int ADC;
+enum
+{
+  ADPS0 = 0, ADPS1 = 1, ADPS2 = 2, ADIE = 3, ADIF = 4, ADATE = 5, ADSC = 6, ADEN = 7,
+  ADTS0 = 0, ADTS1 = 1, ADTS2 = 2, MUX5 = 3, ADLAR = 5, REFS0 = 6, REFS1 = 7
+};
+extern volatile uint8_t ACSR;
+enum { ACD = 7 };
+extern volatile uint8_t PRR0, PRR1, SMCR, MCUCR, XMCRA, XMCRB, GPIOR0;
+enum { SRE = 7 };
+extern volatile uint8_t PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2;
+enum { PCIE0 = 0, PCIE1 = 1, PCIE2 = 2 };
+// Port K (A8 to A15) for the build of HCSR04Array only, never driven: the
+// simulated pin map is not the one of the Mega, see Arduino.h
+extern volatile uint8_t PINK;
+
+#endif // SIM_AVR_IO_H_
@@ -0,0 +1,32 @@
+/**
+ * @file      pgmspace.h
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  Flash and RAM are the same memory on the host.
+ */
+
+#ifndef SIM_AVR_PGMSPACE_H_
+#define SIM_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+typedef uintptr_t uint_farptr_t;   // 32 bits on the board, a full pointer here
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(a) (*(const uint8_t *)(a))
+#define pgm_read_word(a) (*(const uint16_t *)(a))
+#define pgm_read_dword(a) (*(const uint32_t *)(a))
+#define pgm_read_ptr(a) (*(void *const *)(a))
+#define memcpy_P memcpy
+#define memcpy_PF(d, a, n) memcpy((d), (const void *)(a), (n))
+#define pgm_read_byte_far(a) (*(const uint8_t *)(a))
+#define pgm_get_far_address(var) ((uint_farptr_t)&(var))
+#define strcpy_P strcpy
+#define strncmp_P strncmp
+#define strcmp_P strcmp
+#define strlen_P strlen
+
+#endif // SIM_AVR_PGMSPACE_H_
@@ -0,0 +1,26 @@
+/**
+ * @file      power.h
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  The simulated peripherals are never powered down.
+ */
+
+#ifndef SIM_AVR_POWER_H_
+#define SIM_AVR_POWER_H_
+
+#define power_adc_disable()
+#define power_twi_disable()
+#define power_spi_disable()
+#define power_timer1_disable()
+#define power_timer2_disable()
+#define power_timer3_disable()
+#define power_timer4_disable()
+#define power_timer5_disable()
+#define power_usart1_disable()
+#define power_usart2_disable()
+#define power_usart3_disable()
+#define power_timer1_enable()
+#define power_timer3_enable()
+
+#endif // SIM_AVR_POWER_H_
@@ -0,0 +1,21 @@
+/**
+ * @file      sleep.h
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  sleep_mode() advances the simulated time to the next interrupt, or
+ * to the next TIMER0 tick of millis().
+ */
+
+#ifndef SIM_AVR_SLEEP_H_
+#define SIM_AVR_SLEEP_H_
+
+#define SLEEP_MODE_IDLE 0
+
+#define set_sleep_mode(mode)
+#define sleep_enable()
+#define sleep_disable()
+void sleep_cpu(void);
+#define sleep_mode() sleep_cpu()
+
+#endif // SIM_AVR_SLEEP_H_
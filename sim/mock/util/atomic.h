@@ -0,0 +1,38 @@
+/**
+ * @file      atomic.h
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  ATOMIC_BLOCK of avr-libc on the simulated SREG. The interrupts
+ * that became pending in the block are taken at its end, by sei().
+ */
+
+#ifndef SIM_UTIL_ATOMIC_H_
+#define SIM_UTIL_ATOMIC_H_
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+static inline uint8_t simAtomicEnter(void)
+{
+  cli();
+  return 1;
+}
+
+static inline void simAtomicRestore(const uint8_t *aSreg)
+{
+  if (*aSreg & _BV(SREG_I))
+    sei();
+}
+
+static inline void simAtomicForceOn(const uint8_t *aSreg)
+{
+  (void)aSreg;
+  sei();
+}
+
+#define ATOMIC_RESTORESTATE uint8_t sSregSave __attribute__((__cleanup__(simAtomicRestore))) = SREG
+#define ATOMIC_FORCEON      uint8_t sSregSave __attribute__((__cleanup__(simAtomicForceOn))) = 0
+#define ATOMIC_BLOCK(type)  for (type, sToDo = simAtomicEnter(); sToDo; sToDo = 0)
+
+#endif // SIM_UTIL_ATOMIC_H_
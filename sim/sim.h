@@ -0,0 +1,94 @@
+/**
+ * @file      sim.h
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  Core of the host simulation of the Mega 2560: simulated time, the
+ * 16-bit timers 1, 3, 4 and 5 with their interrupts, pins and the cost model.
+ *
+ * The time only moves at the calls into the mock layer: micros(), millis(),
+ * sleep, card transfers, sei() and the entry and exit of the interrupts.
+ * It then moves by the work done since the previous call, estimated from
+ * the basic blocks run (counted by -fsanitize-coverage=trace-pc in the
+ * sketch and library objects), plus the hardware time charged by the mocks.
+ * The result is deterministic, so two runs of the same build and traces
+ * give the same numbers. The cycle counts are an estimate: a host basic
+ * block is not an AVR one, and 32-bit divisions or multiplications are
+ * library calls on the AVR. Compare the figures between builds, not with
+ * the datasheet.
+ *
+ * The firmware is built by the host compiler, where int is 32 bits instead
+ * of 16: an unsigned int counter wrapping at 65536 on the board does not
+ * wrap here. Such counters (the tone phase) are declared uint16_t.
+ */
+
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdint.h>
+#include <avr/io.h>
+
+#define SIM_CYCLES_PER_MICRO (F_CPU / 1000000UL)
+
+// Cost model, set by the command line of sim_main.cpp
+struct SimCost
+{
+  uint32_t cyclesPerBlock;      // Per basic block of the simulated code
+  uint32_t isrCycles;           // Entry, register saves and reti of an interrupt
+  uint32_t sdBlockReadCycles;   // Command, wait for the data token, 512 bytes and CRC
+  uint32_t sdBlockWriteCycles;  // The same plus the programming busy time of the card
+  uint32_t sdByteCycles;        // Copy of one byte from or to the block cache
+};
+extern SimCost simCost;
+
+// Per interrupt vector, without the interrupts nested in it
+struct SimIsrStats
+{
+  const char *name;
+  uint32_t calls;
+  uint64_t blocks;
+  uint64_t cycles;
+  uint32_t maxCycles;
+  uint64_t lastCall;            // simNow() of the last entry
+  uint32_t maxLatencyCycles;    // From the flag to the entry
+  uint32_t missed;              // Events while the flag was still set
+};
+
+#define SIM_VECTORS 20          // CAPT, COMPA, COMPB, COMPC, OVF of the timers 1, 3, 4, 5
+extern SimIsrStats simIsrStats[SIM_VECTORS];
+
+// Per 16-bit timer, 1, 3, 4 then 5, while its clock runs
+struct SimTimerStats
+{
+  uint8_t number;
+  uint64_t runningCycles;
+  uint8_t mode;                 // Waveform generation mode, the last one seen running
+  uint16_t prescaler;
+  uint16_t top;
+  uint8_t timskSeen;            // Interrupts that were enabled at some point
+  uint8_t outputsSeen;          // COMnx bits of TCCRnA, i.e. pins driven by the timer
+};
+
+#define SIM_TIMERS 4
+extern SimTimerStats simTimerStats[SIM_TIMERS];
+
+uint64_t simNow(void);
+void simSync(void);
+void simCharge(uint32_t aCycles);
+void simRunUntil(uint64_t aCycle);
+uint64_t simSleepCycles(void);
+uint64_t simIsrCycles(void);
+
+// Level of an input pin at a given time, e.g. the echo of the HC-SR04. An
+// input capture pin (48: ICP5, 49: ICP4) also triggers its timer capture.
+void simSchedulePin(uint64_t aCycle, uint8_t aPin, bool aLevel);
+
+// Called after a pin written by the simulated code changed
+extern void (*simOutputHook)(uint8_t aPin, bool aLevel);
+// Called before each interrupt vector, with its index in simIsrStats
+extern void (*simIsrHook)(uint8_t aVector);
+
+// Serial output of the sketch, NULL to drop it
+void simSetSerialOutput(void *aFile);
+
+#endif // SIM_H_
@@ -0,0 +1,714 @@
+/**
+ * @file      sim_avr.cpp
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  Simulated time, 16-bit timers, interrupts, pins and Serial of the
+ * Mega 2560, see sim.h.
+ */
+
+#include <stdio.h>
+#include <map>
+#include <Arduino.h>
+#include "sim.h"
+
+/*************/
+/* Registers */
+/*************/
+#define SIM_TIMER16_DEFINE(n)                                          \
+  volatile uint8_t TCCR##n##A, TCCR##n##B, TCCR##n##C, TIMSK##n;       \
+  volatile unsigned int TCNT##n, OCR##n##A, OCR##n##B, OCR##n##C, ICR##n; \
+  SimFlagRegister TIFR##n;
+SIM_TIMER16_DEFINE(1)
+SIM_TIMER16_DEFINE(3)
+SIM_TIMER16_DEFINE(4)
+SIM_TIMER16_DEFINE(5)
+
+volatile uint8_t TCCR0A, TCCR0B, TIMSK0, TCNT0, OCR0A, OCR0B;
+volatile uint8_t TCCR2A, TCCR2B, TIMSK2, TCNT2, OCR2A, OCR2B, ASSR;
+volatile uint8_t SREG;
+volatile uint8_t SPCR, SPSR, SPDR;
+volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UDR0;
+volatile uint8_t ADMUX, ADCSRA, ADCSRB, ADCL, ADCH, DIDR0;
+volatile unsigned int ADC;
+volatile uint8_t ACSR;
+volatile uint8_t PRR0, PRR1, SMCR, MCUCR, XMCRA, XMCRB, GPIOR0;
+volatile uint8_t PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2;
+volatile uint8_t PINK;
+
+volatile uint8_t simPinRegister[SIM_PORTS];
+volatile uint8_t simPortRegister[SIM_PORTS];
+volatile uint8_t simDdrRegister[SIM_PORTS];
+
+SimCost simCost = { 10, 50, 0, 0, 4 };
+SimIsrStats simIsrStats[SIM_VECTORS];
+void (*simOutputHook)(uint8_t aPin, bool aLevel) = NULL;
+void (*simIsrHook)(uint8_t aVector) = NULL;
+
+/********/
+/* Time */
+/********/
+static uint64_t sNow = 0;
+static uint64_t sBlocksSynced = 0;
+static uint64_t sCharged = 0;       // All hardware time charged, interrupt entries included
+static uint64_t sSleepCycles = 0;
+static uint64_t sIsrCycles = 0;     // Without nesting
+static uint32_t sDispatches = 0;
+
+/*
+ * Basic blocks of the code built with -fsanitize-coverage=trace-pc. The time
+ * also moves every few blocks, for the loops polling a register like the
+ * ramps of TMRpcm, and the interrupts then come between two blocks
+ */
+#define SIM_SYNC_BLOCKS 8
+static uint64_t sBlocks = 0;
+extern "C" void __sanitizer_cov_trace_pc(void)
+{
+  if (++sBlocks - sBlocksSynced >= SIM_SYNC_BLOCKS)
+    simSync();
+}
+
+/**********/
+/* Timers */
+/**********/
+struct SimTimer
+{
+  volatile uint8_t *tccra, *tccrb, *timsk;
+  volatile unsigned int *tcnt, *ocra, *ocrb, *ocrc, *icr;
+  SimFlagRegister *tifr;
+  uint8_t icpPin;               // 0 if not on a pin of the Mega board
+  uint32_t prescalerCount;      // Cycles toward the next timer clock
+};
+
+#define SIM_TIMER(n, pin) { &TCCR##n##A, &TCCR##n##B, &TIMSK##n, &TCNT##n, &OCR##n##A, &OCR##n##B, &OCR##n##C, &ICR##n, &TIFR##n, pin, 0 }
+static SimTimer sTimers[SIM_TIMERS] = { SIM_TIMER(1, 0), SIM_TIMER(3, 0), SIM_TIMER(4, 49), SIM_TIMER(5, 48) };
+#define SIM_TIMER_STATS(n) { n, 0, 0, 0, 0, 0, 0 }
+SimTimerStats simTimerStats[SIM_TIMERS] = { SIM_TIMER_STATS(1), SIM_TIMER_STATS(3), SIM_TIMER_STATS(4), SIM_TIMER_STATS(5) };
+
+// Vector order of the AVR, lowest first: CAPT, COMPA, COMPB, COMPC, OVF
+static const uint8_t sVectorFlags[5] = { _BV(ICF1), _BV(OCF1A), _BV(OCF1B), _BV(OCF1C), _BV(TOV1) };
+static uint64_t sFlagCycle[SIM_VECTORS];
+static bool sFlagMasked[SIM_VECTORS];     // Raised while disabled, no latency then
+
+#define SIM_TIMER_VECTORS(n)                                             \
+  extern "C" void TIMER##n##_CAPT_vect(void) __attribute__((weak));     \
+  extern "C" void TIMER##n##_COMPA_vect(void) __attribute__((weak));    \
+  extern "C" void TIMER##n##_COMPB_vect(void) __attribute__((weak));    \
+  extern "C" void TIMER##n##_COMPC_vect(void) __attribute__((weak));    \
+  extern "C" void TIMER##n##_OVF_vect(void) __attribute__((weak));
+SIM_TIMER_VECTORS(1)
+SIM_TIMER_VECTORS(3)
+SIM_TIMER_VECTORS(4)
+SIM_TIMER_VECTORS(5)
+
+#define SIM_TIMER_VECTOR_TABLE(n) TIMER##n##_CAPT_vect, TIMER##n##_COMPA_vect, TIMER##n##_COMPB_vect, \
+  TIMER##n##_COMPC_vect, TIMER##n##_OVF_vect
+static void (*const sVectors[SIM_VECTORS])(void) =
+{
+  SIM_TIMER_VECTOR_TABLE(1), SIM_TIMER_VECTOR_TABLE(3), SIM_TIMER_VECTOR_TABLE(4), SIM_TIMER_VECTOR_TABLE(5)
+};
+#define SIM_TIMER_VECTOR_NAMES(n) "TIMER" #n "_CAPT_vect", "TIMER" #n "_COMPA_vect", "TIMER" #n "_COMPB_vect", \
+  "TIMER" #n "_COMPC_vect", "TIMER" #n "_OVF_vect"
+static const char *const sVectorNames[SIM_VECTORS] =
+{
+  SIM_TIMER_VECTOR_NAMES(1), SIM_TIMER_VECTOR_NAMES(3), SIM_TIMER_VECTOR_NAMES(4), SIM_TIMER_VECTOR_NAMES(5)
+};
+
+static uint32_t getPrescaler(const SimTimer &aTimer)
+{
+  static const uint16_t tPrescalers[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+  return tPrescalers[*aTimer.tccrb & 0x07];
+}
+
+static uint8_t getWaveformMode(const SimTimer &aTimer)
+{
+  return ((*aTimer.tccrb >> WGM12) & 0x03) << 2 | (*aTimer.tccra & 0x03);
+}
+
+static uint16_t getTop(const SimTimer &aTimer)
+{
+  switch (getWaveformMode(aTimer))
+    {
+    case 1: case 5:
+      return 0x00FF;
+    case 2: case 6:
+      return 0x01FF;
+    case 3: case 7:
+      return 0x03FF;
+    case 4: case 9: case 11: case 15:
+      return *aTimer.ocra;
+    case 8: case 10: case 12: case 14:
+      return *aTimer.icr;
+    default:
+      return 0xFFFF;
+    }
+}
+
+// ICR is the top in these modes, its flag is set there and the capture pin is unused
+static bool isIcrTop(uint8_t aMode)
+{
+  return aMode == 8 || aMode == 10 || aMode == 12 || aMode == 14;
+}
+
+static bool isFastPwm(uint8_t aMode)
+{
+  return aMode == 5 || aMode == 6 || aMode == 7 || aMode == 14 || aMode == 15;
+}
+
+/*
+ * Count up to the top and wrap, the phase correct modes are run as fast PWM
+ */
+static uint16_t getWrap(const SimTimer &aTimer, uint16_t aCount)
+{
+  uint16_t tTop = getTop(aTimer);
+  return aCount > tTop ? 0xFFFF : tTop;   // Written above the top, counts to MAX first
+}
+
+static uint32_t getTicksTo(uint16_t aCount, uint16_t aWrap, uint16_t aValue)
+{
+  if (aValue > aCount)
+    return aValue - aCount;
+  return (uint32_t)(aWrap - aCount) + 1 + aValue;
+}
+
+static uint64_t getCyclesToEvent(const SimTimer &aTimer)
+{
+  uint32_t tPrescaler = getPrescaler(aTimer);
+  if (tPrescaler == 0)
+    return UINT64_MAX;
+  uint16_t tCount = *aTimer.tcnt;
+  uint16_t tWrap = getWrap(aTimer, tCount);
+  uint32_t tTicks = getTicksTo(tCount, tWrap, 0);
+  const uint16_t tValues[4] = { (uint16_t)*aTimer.ocra, (uint16_t)*aTimer.ocrb, (uint16_t)*aTimer.ocrc, tWrap };
+  for (uint8_t i = 0; i < 4; i++)
+    if (tValues[i] <= tWrap)
+      {
+        uint32_t t = getTicksTo(tCount, tWrap, tValues[i]);
+        if (t < tTicks)
+          tTicks = t;
+      }
+  return (uint64_t)tTicks * tPrescaler - aTimer.prescalerCount;
+}
+
+static void raiseFlag(uint8_t aTimer, uint8_t aKind)
+{
+  SimTimer &tTimer = sTimers[aTimer];
+  uint8_t tVector = aTimer * 5 + aKind;
+  // A flag left from while the interrupt was disabled is not a missed event:
+  // the vector runs once for both, as on the AVR, e.g. when TMRpcm enables
+  // the interrupts of a running timer without clearing its flags
+  if (!(tTimer.tifr->value & sVectorFlags[aKind]) || sFlagMasked[tVector])
+    {
+      sFlagCycle[tVector] = sNow;
+      sFlagMasked[tVector] = !(*tTimer.timsk & sVectorFlags[aKind]);
+    }
+  else if (*tTimer.timsk & sVectorFlags[aKind])
+    simIsrStats[tVector].missed++;    // Not served since the last event
+  tTimer.tifr->raise(sVectorFlags[aKind]);
+}
+
+/*
+ * Never beyond the next event of the timer, see getCyclesToEvent()
+ */
+static void advanceTimer(uint8_t aTimer, uint64_t aCycles)
+{
+  SimTimer &tTimer = sTimers[aTimer];
+  uint32_t tPrescaler = getPrescaler(tTimer);
+  if (tPrescaler == 0)
+    return;
+  SimTimerStats &tStats = simTimerStats[aTimer];
+  tStats.runningCycles += aCycles;
+  tStats.mode = getWaveformMode(tTimer);
+  tStats.prescaler = tPrescaler;
+  tStats.top = getTop(tTimer);
+  tStats.timskSeen |= *tTimer.timsk;
+  tStats.outputsSeen |= *tTimer.tccra & 0xFC;
+  uint64_t tTotal = tTimer.prescalerCount + aCycles;
+  uint32_t tTicks = tTotal / tPrescaler;
+  tTimer.prescalerCount = tTotal % tPrescaler;
+  if (tTicks == 0)
+    return;
+
+  uint16_t tCount = *tTimer.tcnt;
+  uint16_t tWrap = getWrap(tTimer, tCount);
+  uint32_t tNext = (uint32_t)tCount + tTicks;
+  bool tWrapped = tNext > tWrap;
+  if (tWrapped)
+    tNext -= (uint32_t)tWrap + 1;
+  *tTimer.tcnt = tNext;
+
+  uint8_t tMode = getWaveformMode(tTimer);
+  if (tNext == (uint16_t)*tTimer.ocra)
+    raiseFlag(aTimer, 1);
+  if (tNext == (uint16_t)*tTimer.ocrb)
+    raiseFlag(aTimer, 2);
+  if (tNext == (uint16_t)*tTimer.ocrc)
+    raiseFlag(aTimer, 3);
+  if (tNext == tWrap)
+    {
+      if (isFastPwm(tMode))
+        raiseFlag(aTimer, 4);
+      if (isIcrTop(tMode))
+        raiseFlag(aTimer, 0);
+    }
+  if (tWrapped && tNext == 0 && !isFastPwm(tMode) && (tWrap == 0xFFFF || tMode < 4 || (tMode >= 8 && tMode <= 11)))
+    raiseFlag(aTimer, 4);
+}
+
+/********/
+/* Pins */
+/********/
+struct SimPinEvent
+{
+  uint8_t pin;
+  bool level;
+};
+static std::multimap<uint64_t, SimPinEvent> sPinEvents;
+static uint8_t sPortSnapshot[SIM_PORTS];
+
+void simSchedulePin(uint64_t aCycle, uint8_t aPin, bool aLevel)
+{
+  SimPinEvent tEvent = { aPin, aLevel };
+  sPinEvents.insert(std::make_pair(aCycle, tEvent));
+}
+
+static void setInputPin(uint8_t aPin, bool aLevel)
+{
+  uint8_t tPort = digitalPinToPort(aPin);
+  uint8_t tMask = digitalPinToBitMask(aPin);
+  bool tOld = simPinRegister[tPort] & tMask;
+  if (aLevel)
+    simPinRegister[tPort] |= tMask;
+  else
+    simPinRegister[tPort] &= ~tMask;
+  if (tOld == aLevel)
+    return;
+
+  for (uint8_t i = 0; i < SIM_TIMERS; i++)
+    {
+      SimTimer &tTimer = sTimers[i];
+      if (tTimer.icpPin != aPin || getPrescaler(tTimer) == 0 || isIcrTop(getWaveformMode(tTimer)))
+        continue;
+      bool tRisingSelected = *tTimer.tccrb & _BV(ICES1);
+      if (aLevel == tRisingSelected)
+        {
+          *tTimer.icr = *tTimer.tcnt;
+          raiseFlag(i, 0);
+        }
+    }
+}
+
+// Reports the pins written by the simulated code, from the registers or digitalWrite()
+static void checkOutputs(void)
+{
+  for (uint8_t tPort = 0; tPort < SIM_PORTS; tPort++)
+    {
+      uint8_t tChanged = simPortRegister[tPort] ^ sPortSnapshot[tPort];
+      if (tChanged == 0)
+        continue;
+      sPortSnapshot[tPort] = simPortRegister[tPort];
+      for (uint8_t tBit = 0; tBit < 8; tBit++)
+        if ((tChanged & _BV(tBit)) && simOutputHook)
+          simOutputHook((tPort - 1) * 8 + tBit, simPortRegister[tPort] & _BV(tBit));
+    }
+}
+
+/**************/
+/* Interrupts */
+/**************/
+struct SimFrame
+{
+  uint64_t startBlocks;
+  uint64_t startCharged;
+  uint64_t nestedBlocks;
+  uint64_t nestedCharged;
+};
+static SimFrame sFrames[8];
+static uint8_t sDepth = 0;
+
+static int8_t getPendingVector(void)
+{
+  for (uint8_t i = 0; i < SIM_VECTORS; i++)
+    {
+      SimTimer &tTimer = sTimers[i / 5];
+      uint8_t tFlag = sVectorFlags[i % 5];
+      if ((tTimer.tifr->value & tFlag) && (*tTimer.timsk & tFlag))
+        return i;
+    }
+  return -1;
+}
+
+static void runVector(uint8_t aVector)
+{
+  simSync();                    // Work of the interrupted code
+  SimTimer &tTimer = sTimers[aVector / 5];
+  tTimer.tifr->value &= ~sVectorFlags[aVector % 5];
+  SimIsrStats &tStats = simIsrStats[aVector];
+  tStats.name = sVectorNames[aVector];
+  uint32_t tLatency = sNow - sFlagCycle[aVector];
+  if (!sFlagMasked[aVector] && tLatency > tStats.maxLatencyCycles)
+    tStats.maxLatencyCycles = tLatency;
+  tStats.lastCall = sNow;
+  sDispatches++;
+  if (simIsrHook)
+    simIsrHook(aVector);
+
+  if (sVectors[aVector] == NULL)
+    {
+      fprintf(stderr, "sim: %s enabled without a handler, the AVR would reset\n", sVectorNames[aVector]);
+      *tTimer.timsk &= ~sVectorFlags[aVector % 5];
+      return;
+    }
+
+  SREG &= ~_BV(SREG_I);
+  SimFrame &tFrame = sFrames[sDepth++];
+  tFrame.startBlocks = sBlocks;
+  tFrame.startCharged = sCharged;
+  tFrame.nestedBlocks = 0;
+  tFrame.nestedCharged = 0;
+  simCharge(simCost.isrCycles);
+  sVectors[aVector]();
+  simSync();
+  sDepth--;
+
+  uint64_t tBlocks = sBlocks - tFrame.startBlocks;
+  uint64_t tCharged = sCharged - tFrame.startCharged;
+  if (sDepth > 0)
+    {
+      sFrames[sDepth - 1].nestedBlocks += tBlocks;
+      sFrames[sDepth - 1].nestedCharged += tCharged;
+    }
+  tBlocks -= tFrame.nestedBlocks;
+  uint64_t tCycles = tBlocks * simCost.cyclesPerBlock + tCharged - tFrame.nestedCharged;
+  tStats.calls++;
+  tStats.blocks += tBlocks;
+  tStats.cycles += tCycles;
+  if (tCycles > tStats.maxCycles)
+    tStats.maxCycles = tCycles;
+  sIsrCycles += tCycles;
+
+  SREG |= _BV(SREG_I);          // reti
+  checkOutputs();
+}
+
+static void dispatchPending(void)
+{
+  while (SREG & _BV(SREG_I))
+    {
+      int8_t tVector = getPendingVector();
+      if (tVector < 0)
+        return;
+      runVector(tVector);
+    }
+}
+
+void cli(void)
+{
+  SREG &= ~_BV(SREG_I);
+}
+
+void sei(void)
+{
+  SREG |= _BV(SREG_I);
+  dispatchPending();
+}
+
+/*************/
+/* Time base */
+/*************/
+
+/*
+ * One step toward aCycle: up to the next timer or pin event, then the
+ * pending interrupts if enabled
+ */
+static void step(uint64_t aCycle)
+{
+  uint64_t tStep = aCycle - sNow;
+  for (uint8_t i = 0; i < SIM_TIMERS; i++)
+    {
+      uint64_t tCycles = getCyclesToEvent(sTimers[i]);
+      if (tCycles < tStep)
+        tStep = tCycles;
+    }
+  if (!sPinEvents.empty())
+    {
+      uint64_t tAt = sPinEvents.begin()->first;
+      tStep = tAt <= sNow ? 0 : (tAt - sNow < tStep ? tAt - sNow : tStep);
+    }
+  for (uint8_t i = 0; i < SIM_TIMERS; i++)
+    advanceTimer(i, tStep);
+  sNow += tStep;
+  while (!sPinEvents.empty() && sPinEvents.begin()->first <= sNow)
+    {
+      SimPinEvent tEvent = sPinEvents.begin()->second;
+      sPinEvents.erase(sPinEvents.begin());
+      setInputPin(tEvent.pin, tEvent.level);
+    }
+  if (SREG & _BV(SREG_I))
+    dispatchPending();
+}
+
+void simRunUntil(uint64_t aCycle)
+{
+  while (sNow < aCycle)
+    step(aCycle);
+}
+
+void simSync(void)
+{
+  uint64_t tBlocks = sBlocks - sBlocksSynced;
+  sBlocksSynced = sBlocks;
+  if (tBlocks > 0)
+    simRunUntil(sNow + tBlocks * simCost.cyclesPerBlock);
+}
+
+void simCharge(uint32_t aCycles)
+{
+  simSync();
+  sCharged += aCycles;
+  simRunUntil(sNow + aCycles);
+}
+
+uint64_t simNow(void)
+{
+  return sNow;
+}
+
+uint64_t simSleepCycles(void)
+{
+  return sSleepCycles;
+}
+
+uint64_t simIsrCycles(void)
+{
+  return sIsrCycles;
+}
+
+/*
+ * SLEEP_MODE_IDLE: up to the first interrupt, at the latest the TIMER0 tick
+ * of millis(), not simulated otherwise
+ */
+void sleep_cpu(void)
+{
+  simSync();
+  uint64_t tStart = sNow;
+  uint64_t tTick = (sNow / (SIM_CYCLES_PER_MICRO * 1000) + 1) * (SIM_CYCLES_PER_MICRO * 1000);
+  uint32_t tDispatches = sDispatches;
+  while (sNow < tTick && sDispatches == tDispatches)
+    step(tTick);
+  sSleepCycles += sNow - tStart;
+}
+
+/********************/
+/* Arduino wrappers */
+/********************/
+unsigned long micros(void)
+{
+  simSync();
+  return (uint32_t)(sNow / SIM_CYCLES_PER_MICRO);
+}
+
+unsigned long millis(void)
+{
+  simSync();
+  return (uint32_t)(sNow / (SIM_CYCLES_PER_MICRO * 1000));
+}
+
+void delay(unsigned long aMillis)
+{
+  simSync();
+  simRunUntil(sNow + (uint64_t)aMillis * SIM_CYCLES_PER_MICRO * 1000);
+}
+
+void delayMicroseconds(unsigned int aMicros)
+{
+  simSync();
+  simRunUntil(sNow + (uint64_t)aMicros * SIM_CYCLES_PER_MICRO);
+}
+
+void pinMode(uint8_t aPin, uint8_t aMode)
+{
+  uint8_t tPort = digitalPinToPort(aPin);
+  uint8_t tMask = digitalPinToBitMask(aPin);
+  if (aMode == OUTPUT)
+    simDdrRegister[tPort] |= tMask;
+  else
+    {
+      simDdrRegister[tPort] &= ~tMask;
+      if (aMode == INPUT_PULLUP)
+        simPortRegister[tPort] |= tMask;
+      else
+        simPortRegister[tPort] &= ~tMask;
+      checkOutputs();
+    }
+}
+
+void digitalWrite(uint8_t aPin, uint8_t aValue)
+{
+  uint8_t tPort = digitalPinToPort(aPin);
+  if (aValue)
+    simPortRegister[tPort] |= digitalPinToBitMask(aPin);
+  else
+    simPortRegister[tPort] &= ~digitalPinToBitMask(aPin);
+  checkOutputs();
+}
+
+int digitalRead(uint8_t aPin)
+{
+  uint8_t tPort = digitalPinToPort(aPin);
+  uint8_t tMask = digitalPinToBitMask(aPin);
+  simSync();
+  if (simDdrRegister[tPort] & tMask)
+    return (simPortRegister[tPort] & tMask) ? HIGH : LOW;
+  return (simPinRegister[tPort] & tMask) ? HIGH : LOW;
+}
+
+// Mid scale, the TMP36 then reads 75 degree. Not used without TEMPERATURE_PIN
+int analogRead(uint8_t)
+{
+  simCharge(13 * 128);          // 13 ADC clocks at F_CPU / 128
+  return 512;
+}
+
+unsigned long pulseInLong(uint8_t aPin, uint8_t aState, unsigned long aTimeoutMicros)
+{
+  unsigned long tStart = micros();
+  while (digitalRead(aPin) == aState)
+    if (micros() - tStart >= aTimeoutMicros)
+      return 0;
+  while (digitalRead(aPin) != aState)
+    {
+      if (micros() - tStart >= aTimeoutMicros)
+        return 0;
+      simCharge(SIM_CYCLES_PER_MICRO);
+    }
+  unsigned long tPulseStart = micros();
+  while (digitalRead(aPin) == aState)
+    {
+      if (micros() - tStart >= aTimeoutMicros)
+        return 0;
+      simCharge(SIM_CYCLES_PER_MICRO);
+    }
+  return micros() - tPulseStart;
+}
+
+unsigned long pulseIn(uint8_t aPin, uint8_t aState, unsigned long aTimeoutMicros)
+{
+  return pulseInLong(aPin, aState, aTimeoutMicros);
+}
+
+/*********/
+/* Print */
+/*********/
+size_t Print::write(const uint8_t *aBuffer, size_t aSize)
+{
+  size_t n = 0;
+  while (aSize--)
+    n += write(*aBuffer++);
+  return n;
+}
+
+size_t Print::print(unsigned long aValue, int aBase)
+{
+  char tDigits[33];
+  char *p = &tDigits[sizeof(tDigits) - 1];
+  *p = '\0';
+  do
+    {
+      uint8_t tDigit = aValue % aBase;
+      *--p = tDigit < 10 ? '0' + tDigit : 'A' + tDigit - 10;
+      aValue /= aBase;
+    }
+  while (aValue);
+  return write(p);
+}
+
+size_t Print::print(long aValue, int aBase)
+{
+  if (aValue < 0 && aBase == DEC)
+    return write((uint8_t)'-') + print((unsigned long)-aValue, aBase);
+  return print((unsigned long)aValue, aBase);
+}
+
+size_t Print::print(double aValue, int aDigits)
+{
+  char tText[32];
+  snprintf(tText, sizeof(tText), "%.*f", aDigits, aValue);
+  return write(tText);
+}
+
+/**********/
+/* Serial */
+/**********/
+#define SIM_SERIAL_BUFFER 64
+
+HardwareSerial Serial;
+static FILE *sSerialOutput = NULL;
+static uint32_t sSerialBaud = 0;
+static uint16_t sSerialQueued = 0;
+static uint64_t sSerialDrained = 0;   // simNow() up to which the queue was drained
+
+void simSetSerialOutput(void *aFile)
+{
+  sSerialOutput = (FILE *)aFile;
+}
+
+static void drainSerial(void)
+{
+  if (sSerialBaud == 0)
+    return;
+  uint64_t tByteCycles = F_CPU * 10 / sSerialBaud;   // Start, 8 data and stop bits
+  while (sSerialQueued > 0 && sNow - sSerialDrained >= tByteCycles)
+    {
+      sSerialQueued--;
+      sSerialDrained += tByteCycles;
+    }
+  if (sSerialQueued == 0)
+    sSerialDrained = sNow;
+}
+
+void HardwareSerial::begin(unsigned long aBaud)
+{
+  sSerialBaud = aBaud;
+  sSerialQueued = 0;
+  sSerialDrained = sNow;
+}
+
+// Waits for room in the buffer like the Arduino core
+size_t HardwareSerial::write(uint8_t aByte)
+{
+  simSync();
+  drainSerial();
+  while (sSerialBaud != 0 && sSerialQueued >= SIM_SERIAL_BUFFER - 1)
+    {
+      simCharge(SIM_CYCLES_PER_MICRO);
+      drainSerial();
+    }
+  if (sSerialBaud != 0)
+    sSerialQueued++;
+  if (sSerialOutput)
+    fputc(aByte, sSerialOutput);
+  return 1;
+}
+
+int HardwareSerial::availableForWrite(void)
+{
+  simSync();
+  drainSerial();
+  return SIM_SERIAL_BUFFER - 1 - sSerialQueued;
+}
+
+int HardwareSerial::available(void)
+{
+  return 0;
+}
+
+int HardwareSerial::read(void)
+{
+  return -1;
+}
+
+int HardwareSerial::peek(void)
+{
+  return -1;
+}
@@ -0,0 +1,505 @@
+/**
+ * @file      sim_main.cpp
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  Runs Blind_Guidance on the simulated Mega 2560: an echo trace
+ * drives the HC-SR04 input capture, WAV files are on the simulated card.
+ * At the end a JSON report goes to stdout: cycles per interrupt vector,
+ * audio underruns, card traffic, radar accuracy and the cadence and latency
+ * of the alerts. See the Makefile for the options.
+ *
+ * The events come from the latency trace of TMRpcm (ENABLE_TRACE), this
+ * file replaces pcmTrace.cpp.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <Arduino.h>
+#include <TMRpcm.h>
+#include "AlertEngine.h"
+#include "sim.h"
+#include "sim_sd.h"
+
+#define SIM_ECHO_DELAY_MICROS 450               // From the end of the trigger to the echo start
+#define SIM_ECHO_MAX_MICROS   23300             // 4 m, no echo beyond
+#define SIM_MICROS_PER_CENTIMETER_X100 5823     // Forth and back at 20 degree
+
+// Of Blind_Guidance.ino
+void setup(void);
+void loop(void);
+extern int rawLengthCentimeter;
+extern int lengthCentimeter;
+extern int intervalMessage;
+
+// Of TMRpcm.cpp
+extern volatile boolean buffEmpty[2], whichBuff, playing;
+extern byte tt;   // Player timer 1, 3, 4 or 5 as 0 to 3, set from speakerPin without PCM_FIXED_TIMER
+
+struct Statistic
+{
+  uint32_t count;
+  double sum;
+  double min;
+  double max;
+  void add(double aValue)
+  {
+    if (count == 0 || aValue < min)
+      min = aValue;
+    if (count == 0 || aValue > max)
+      max = aValue;
+    sum += aValue;
+    count++;
+  }
+  double average(void) const { return count ? sum / count : 0; }
+};
+
+struct TracePoint
+{
+  uint32_t millis;
+  uint32_t echoMicros;          // 0: no echo
+};
+
+static struct
+{
+  const char *label;
+  const char *tracePath;
+  const char *serialPath;
+  const char *cardPath;
+  uint32_t durationMillis;
+  uint8_t triggerPin;
+  uint8_t echoPin;
+  int alertCentimeter;
+} sOptions = { "", NULL, NULL, NULL, 0, 5, 49, 200 };
+
+static std::vector<TracePoint> sTrace;
+
+// Radar and alert state, updated by the hooks
+static uint32_t sPings, sEchoes, sTimeouts, sResults, sPlays, sRefills, sUnderruns, sStarvedSamples;
+static uint32_t sAlerts, sAlertsByUrgency[5], sDetections, sMissedDetections, sHaptics, sHapticsByUrgency[5];
+static Statistic sRawError, sFilteredError, sLateness, sInterval, sEchoToAlert, sAlertToSound, sDetectToSound;
+static Statistic sEchoToHaptic;
+static int sPingTruthCentimeter, sEchoTruthCentimeter;
+static uint64_t sLastEcho, sLastAlert, sDetectStart;
+static bool sHasLastAlert, sSoundPending, sWasInRange, sDetectPending, sStarving, sPingOpen;
+
+static double toMillis(uint64_t aCycles)
+{
+  return (double)aCycles / (SIM_CYCLES_PER_MICRO * 1000);
+}
+
+/*********/
+/* Trace */
+/*********/
+static uint32_t getTruthEchoMicros(uint32_t aMillis)
+{
+  uint32_t tEcho = 0;
+  for (size_t i = 0; i < sTrace.size() && sTrace[i].millis <= aMillis; i++)
+    tEcho = sTrace[i].echoMicros;
+  return tEcho > SIM_ECHO_MAX_MICROS ? 0 : tEcho;
+}
+
+/*
+ * "millis echo_micros" per line, or the CSV of tools/blackbox_decode.py and
+ * tools/telemetry_decode.py (time_ms and raw_cm columns)
+ */
+static bool loadTrace(const char *aPath)
+{
+  FILE *tFile = fopen(aPath, "r");
+  if (tFile == NULL)
+    return false;
+  char tLine[256];
+  int tTimeColumn = -1, tCentimeterColumn = -1;
+  while (fgets(tLine, sizeof(tLine), tFile))
+    {
+      if (tLine[0] == '#' || tLine[0] == '\n')
+        continue;
+      if (strstr(tLine, "time_ms"))
+        {
+          // CSV header
+          int tColumn = 0;
+          for (char *tName = strtok(tLine, ",\r\n"); tName; tName = strtok(NULL, ",\r\n"), tColumn++)
+            {
+              if (strcmp(tName, "time_ms") == 0)
+                tTimeColumn = tColumn;
+              else if (strcmp(tName, "raw_cm") == 0)
+                tCentimeterColumn = tColumn;
+            }
+          continue;
+        }
+      TracePoint tPoint;
+      if (tTimeColumn >= 0 && tCentimeterColumn >= 0)
+        {
+          long tTime = -1, tCentimeter = -1;
+          int tColumn = 0;
+          for (char *tValue = strtok(tLine, ",\r\n"); tValue; tValue = strtok(NULL, ",\r\n"), tColumn++)
+            {
+              if (tColumn == tTimeColumn)
+                tTime = atol(tValue);
+              else if (tColumn == tCentimeterColumn)
+                tCentimeter = atol(tValue);
+            }
+          if (tTime < 0 || tCentimeter < 0)
+            continue;
+          tPoint.millis = tTime;
+          tPoint.echoMicros = tCentimeter * SIM_MICROS_PER_CENTIMETER_X100 / 100;
+        }
+      else if (sscanf(tLine, "%u %u", &tPoint.millis, &tPoint.echoMicros) != 2)
+        continue;
+      if (!sTrace.empty() && tPoint.millis < sTrace.back().millis)
+        {
+          fprintf(stderr, "sim: %s: time goes back at %u ms, rest ignored\n", aPath, tPoint.millis);
+          break;
+        }
+      sTrace.push_back(tPoint);
+    }
+  fclose(tFile);
+  return true;
+}
+
+static bool loadCardFile(const char *aArgument)
+{
+  const char *tEqual = strchr(aArgument, '=');
+  if (tEqual == NULL)
+    return false;
+  std::string tName(aArgument, tEqual - aArgument);
+  FILE *tFile = fopen(tEqual + 1, "rb");
+  if (tFile == NULL)
+    return false;
+  std::vector<uint8_t> tData;
+  uint8_t tBuffer[4096];
+  size_t n;
+  while ((n = fread(tBuffer, 1, sizeof(tBuffer), tFile)) > 0)
+    tData.insert(tData.end(), tBuffer, tBuffer + n);
+  fclose(tFile);
+  simSdLoad(tName.c_str(), tData.data(), tData.size());
+  return true;
+}
+
+// 0.2 s 880 Hz beep, 8-bit 16 kHz mono, when no alert clip is given
+static void loadDefaultClip(const char *aName)
+{
+  const uint32_t tRate = 16000, tSamples = tRate / 5;
+  std::vector<uint8_t> tWav(44 + tSamples);
+  uint8_t *h = tWav.data();
+  uint32_t tFields[] = { 36 + tSamples, 16, 1 | (1 << 16), tRate, tRate, 1 | (8 << 16), tSamples };
+  memcpy(h, "RIFF", 4);
+  memcpy(h + 4, &tFields[0], 4);
+  memcpy(h + 8, "WAVEfmt ", 8);
+  memcpy(h + 16, &tFields[1], 20);
+  memcpy(h + 36, "data", 4);
+  memcpy(h + 40, &tFields[6], 4);
+  for (uint32_t i = 0; i < tSamples; i++)
+    h[44 + i] = (i * 880 * 2 / tRate) % 2 ? 178 : 78;
+  simSdLoad(aName, tWav.data(), tWav.size());
+}
+
+/*********/
+/* Hooks */
+/*********/
+static void onOutput(uint8_t aPin, bool aLevel)
+{
+  if (aPin != sOptions.triggerPin || aLevel)
+    return;
+  // Falling edge of the trigger: the module sends its burst, then the echo
+  sPings++;
+  uint32_t tEcho = getTruthEchoMicros(millis());
+  sPingTruthCentimeter = tEcho * 100 / SIM_MICROS_PER_CENTIMETER_X100;
+  uint64_t tStart = simNow() + SIM_ECHO_DELAY_MICROS * SIM_CYCLES_PER_MICRO;
+  if (tEcho > 0)
+    {
+      simSchedulePin(tStart, sOptions.echoPin, true);
+      simSchedulePin(tStart + (uint64_t)tEcho * SIM_CYCLES_PER_MICRO, sOptions.echoPin, false);
+    }
+
+  bool tInRange = tEcho > 0 && sPingTruthCentimeter < sOptions.alertCentimeter;
+  if (tInRange && !sWasInRange)
+    {
+      sDetectStart = tStart + (uint64_t)tEcho * SIM_CYCLES_PER_MICRO;
+      sDetectPending = true;
+    }
+  else if (!tInRange && sDetectPending)
+    {
+      sMissedDetections++;
+      sDetectPending = false;
+    }
+  sWasInRange = tInRange;
+}
+
+static void onInterrupt(uint8_t aVector)
+{
+  // CAPT then OVF of the player timer, in the order of SIM_VECTORS
+  if (aVector == tt * 5)
+    sRefills++;
+  if (aVector != tt * 5 + 4)
+    return;
+  if (playing && buffEmpty[whichBuff])
+    {
+      sStarvedSamples++;
+      if (!sStarving)
+        sUnderruns++;
+      sStarving = true;
+    }
+  else
+    sStarving = false;
+}
+
+void pcmTrace(byte id, byte arg)
+{
+  uint64_t tNow = simNow();
+  switch (id)
+    {
+    case TRACE_US_TRIGGER:
+      // No capture since the last trigger: timeout, published at the start of this cycle
+      if (sPingOpen)
+        sTimeouts++;
+      sPingOpen = true;
+      break;
+    case TRACE_US_ECHO:
+      sPingOpen = false;
+      if (arg == 0)
+        {
+          sTimeouts++;
+          break;
+        }
+      sEchoes++;
+      sLastEcho = tNow;
+      sEchoTruthCentimeter = sPingTruthCentimeter;
+      break;
+    case TRACE_USER + 0:        // TRACE_RADAR_RESULT
+      sResults++;
+      if (sEchoTruthCentimeter > 0 && rawLengthCentimeter > 0)
+        {
+          sRawError.add(abs(rawLengthCentimeter - sEchoTruthCentimeter));
+          sFilteredError.add(abs(lengthCentimeter - sEchoTruthCentimeter));
+        }
+      if (getAlertUrgency() == 0)
+        sHasLastAlert = false;  // Out of range, the cadence restarts at the next alert
+      break;
+    case TRACE_USER + 1:        // TRACE_ALERT
+      sAlerts++;
+      sAlertsByUrgency[arg < 5 ? arg : 0]++;
+      if (sHasLastAlert)
+        {
+          double tInterval = toMillis(tNow - sLastAlert);
+          sInterval.add(tInterval);
+          sLateness.add(tInterval - intervalMessage);
+        }
+      sLastAlert = tNow;
+      sHasLastAlert = true;
+      sEchoToAlert.add(toMillis(tNow - sLastEcho));
+      sSoundPending = true;
+      break;
+    case TRACE_USER + 2:        // TRACE_HAPTIC
+      sHaptics++;
+      sHapticsByUrgency[arg < 5 ? arg : 0]++;
+      sEchoToHaptic.add(toMillis(tNow - sLastEcho));
+      break;
+    case TRACE_PLAY:
+      sPlays++;
+      break;
+    case TRACE_FIRST_SAMPLE:
+      if (sSoundPending)
+        sAlertToSound.add(toMillis(tNow - sLastAlert));
+      sSoundPending = false;
+      if (sDetectPending)
+        {
+          sDetections++;
+          sDetectToSound.add(toMillis(tNow - sDetectStart));
+        }
+      sDetectPending = false;
+      break;
+    }
+}
+
+void pcmTraceDump(Print &out)
+{
+  out.write((uint8_t)'T');
+  out.write((uint8_t)'R');
+  out.write((uint8_t)0);
+}
+
+/**********/
+/* Report */
+/**********/
+static void printStatistic(const char *aName, const Statistic &aStatistic, bool aLast = false)
+{
+  printf("    \"%s\": {\"count\": %u, \"avg\": %.3f, \"min\": %.3f, \"max\": %.3f}%s\n", aName, aStatistic.count,
+         aStatistic.average(), aStatistic.min, aStatistic.max, aLast ? "" : ",");
+}
+
+static void printReport(uint64_t aBootCycles)
+{
+  uint64_t tTotal = simNow();
+  const SimSdStats &tCard = simSdGetStats();
+  printf("{\n");
+  printf("  \"label\": \"%s\",\n", sOptions.label);
+  printf("  \"config\": {\"duration_ms\": %u, \"cycles_per_block\": %u, \"isr_cycles\": %u, "
+         "\"sd_block_read_us\": %u, \"sd_block_write_us\": %u},\n", sOptions.durationMillis,
+         simCost.cyclesPerBlock, simCost.isrCycles, (unsigned)(simCost.sdBlockReadCycles / SIM_CYCLES_PER_MICRO),
+         (unsigned)(simCost.sdBlockWriteCycles / SIM_CYCLES_PER_MICRO));
+  printf("  \"cpu\": {\"boot_ms\": %.3f, \"sleep_percent\": %.2f, \"isr_percent\": %.2f},\n", toMillis(aBootCycles),
+         100.0 * simSleepCycles() / tTotal, 100.0 * simIsrCycles() / tTotal);
+
+  printf("  \"isr\": {");
+  bool tFirst = true;
+  for (uint8_t i = 0; i < SIM_VECTORS; i++)
+    {
+      const SimIsrStats &s = simIsrStats[i];
+      if (s.calls == 0)
+        continue;
+      printf("%s\n    \"%s\": {\"calls\": %u, \"blocks_avg\": %.1f, \"cycles_avg\": %.1f, \"cycles_max\": %u, "
+             "\"latency_max_cycles\": %u, \"missed\": %u}", tFirst ? "" : ",", s.name, s.calls,
+             (double)s.blocks / s.calls, (double)s.cycles / s.calls, s.maxCycles, s.maxLatencyCycles, s.missed);
+      tFirst = false;
+    }
+  printf("\n  },\n");
+
+  // Clock running, and what the timer did meanwhile: a PWM without any
+  // interrupt costs no CPU cycle
+  printf("  \"timers\": {");
+  for (uint8_t i = 0; i < SIM_TIMERS; i++)
+    {
+      const SimTimerStats &s = simTimerStats[i];
+      printf("%s\n    \"timer%u\": {\"running_percent\": %.2f, \"mode\": %u, \"prescaler\": %u, \"top\": %u, "
+             "\"timsk\": %u, \"outputs\": %u}", i ? "," : "", s.number, 100.0 * s.runningCycles / tTotal, s.mode,
+             s.prescaler, s.top, s.timskSeen, s.outputsSeen);
+    }
+  printf("\n  },\n");
+
+  printf("  \"audio\": {\"plays\": %u, \"refills\": %u, \"underruns\": %u, \"starved_samples\": %u},\n", sPlays,
+         sRefills, sUnderruns, sStarvedSamples);
+  printf("  \"card\": {\"block_reads\": %u, \"block_writes\": %u, \"bytes_read\": %llu, \"bytes_written\": %llu, "
+         "\"conflicts\": %u},\n", tCard.blockReads, tCard.blockWrites, (unsigned long long)tCard.bytesRead,
+         (unsigned long long)tCard.bytesWritten, tCard.conflicts);
+  printf("  \"radar\": {\n    \"pings\": %u, \"echoes\": %u, \"timeouts\": %u, \"results\": %u,\n", sPings, sEchoes,
+         sTimeouts, sResults);
+  printStatistic("raw_error_cm", sRawError);
+  printStatistic("filtered_error_cm", sFilteredError, true);
+  printf("  },\n");
+  printf("  \"alerts\": {\n    \"count\": %u, \"by_urgency\": [%u, %u, %u, %u],\n", sAlerts, sAlertsByUrgency[1],
+         sAlertsByUrgency[2], sAlertsByUrgency[3], sAlertsByUrgency[4]);
+  printStatistic("interval_ms", sInterval);
+  printStatistic("lateness_ms", sLateness);
+  printStatistic("echo_to_alert_ms", sEchoToAlert);
+  printStatistic("alert_to_sound_ms", sAlertToSound, true);
+  printf("  },\n");
+  printf("  \"haptic\": {\n    \"patterns\": %u, \"by_urgency\": [%u, %u, %u, %u],\n", sHaptics,
+         sHapticsByUrgency[1], sHapticsByUrgency[2], sHapticsByUrgency[3], sHapticsByUrgency[4]);
+  printStatistic("echo_to_haptic_ms", sEchoToHaptic, true);
+  printf("  },\n");
+  printf("  \"detection\": {\n    \"count\": %u, \"missed\": %u,\n", sDetections, sMissedDetections);
+  printStatistic("detect_to_sound_ms", sDetectToSound, true);
+  printf("  }\n}\n");
+}
+
+/********/
+/* Main */
+/********/
+static void usage(void)
+{
+  fprintf(stderr,
+          "usage: blind_sim [options]\n"
+          "  --trace FILE          echo trace, \"millis echo_micros\" lines or a decoded CSV\n"
+          "  --file NAME=PATH      host file copied to the card, e.g. --file atnobs.wav=alert.wav\n"
+          "  --duration MS         simulated time, default: end of the trace + 3 s\n"
+          "  --label TEXT          copied to the report\n"
+          "  --serial FILE         Serial output of the sketch, e.g. for tools/telemetry_decode.py\n"
+          "  --card-out DIR        card content at the end, e.g. BLACKBOX.BIN\n"
+          "  --alert-cm N          range of the alerts, as lengthCentimeterAlert (200)\n"
+          "  --cycles-per-block N  cost model, see sim.h (%u)\n"
+          "  --isr-cycles N        (%u)\n"
+          "  --sd-read-us N        one block read (%u)\n"
+          "  --sd-write-us N       one block write (%u)\n",
+          simCost.cyclesPerBlock, simCost.isrCycles, (unsigned)(simCost.sdBlockReadCycles / SIM_CYCLES_PER_MICRO),
+          (unsigned)(simCost.sdBlockWriteCycles / SIM_CYCLES_PER_MICRO));
+}
+
+int main(int argc, char **argv)
+{
+  // A block at F_CPU / 2: command, about 100 us to the data token, 514 bytes at 8 cycles per bit and CRC
+  simCost.sdBlockReadCycles = 100 * SIM_CYCLES_PER_MICRO + 514 * 18;
+  simCost.sdBlockWriteCycles = 700 * SIM_CYCLES_PER_MICRO + 514 * 18;
+
+  for (int i = 1; i < argc; i++)
+    {
+      const char *tOption = argv[i];
+      const char *tValue = i + 1 < argc ? argv[i + 1] : NULL;
+      if (tValue == NULL)
+        {
+          usage();
+          return 2;
+        }
+      i++;
+      if (strcmp(tOption, "--trace") == 0)
+        sOptions.tracePath = tValue;
+      else if (strcmp(tOption, "--file") == 0)
+        {
+          if (!loadCardFile(tValue))
+            {
+              fprintf(stderr, "sim: cannot load %s\n", tValue);
+              return 1;
+            }
+        }
+      else if (strcmp(tOption, "--duration") == 0)
+        sOptions.durationMillis = atol(tValue);
+      else if (strcmp(tOption, "--label") == 0)
+        sOptions.label = tValue;
+      else if (strcmp(tOption, "--serial") == 0)
+        sOptions.serialPath = tValue;
+      else if (strcmp(tOption, "--card-out") == 0)
+        sOptions.cardPath = tValue;
+      else if (strcmp(tOption, "--alert-cm") == 0)
+        sOptions.alertCentimeter = atoi(tValue);
+      else if (strcmp(tOption, "--cycles-per-block") == 0)
+        simCost.cyclesPerBlock = atol(tValue);
+      else if (strcmp(tOption, "--isr-cycles") == 0)
+        simCost.isrCycles = atol(tValue);
+      else if (strcmp(tOption, "--sd-read-us") == 0)
+        simCost.sdBlockReadCycles = atol(tValue) * SIM_CYCLES_PER_MICRO;
+      else if (strcmp(tOption, "--sd-write-us") == 0)
+        simCost.sdBlockWriteCycles = atol(tValue) * SIM_CYCLES_PER_MICRO;
+      else
+        {
+          usage();
+          return 2;
+        }
+    }
+
+  if (sOptions.tracePath && !loadTrace(sOptions.tracePath))
+    {
+      fprintf(stderr, "sim: cannot read %s\n", sOptions.tracePath);
+      return 1;
+    }
+  if (sOptions.durationMillis == 0)
+    sOptions.durationMillis = (sTrace.empty() ? 0 : sTrace.back().millis) + 3000;
+  if (!simSdExists("atnobs.wav"))
+    loadDefaultClip("atnobs.wav");
+  FILE *tSerial = NULL;
+  if (sOptions.serialPath)
+    {
+      tSerial = fopen(sOptions.serialPath, "wb");
+      simSetSerialOutput(tSerial);
+    }
+
+  simOutputHook = onOutput;
+  simIsrHook = onInterrupt;
+
+  // The Arduino core enables the interrupts before setup()
+  SREG |= _BV(SREG_I);
+  setup();
+  uint64_t tBoot = simNow();
+  uint64_t tEnd = (uint64_t)sOptions.durationMillis * SIM_CYCLES_PER_MICRO * 1000;
+  while (simNow() < tEnd)
+    loop();
+
+  if (tSerial)
+    fclose(tSerial);
+  if (sOptions.cardPath && !simSdSave(sOptions.cardPath))
+    fprintf(stderr, "sim: cannot write to %s\n", sOptions.cardPath);
+  printReport(tBoot);
+  return 0;
+}
@@ -0,0 +1,341 @@
+/**
+ * @file      sim_sd.cpp
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  In-memory card of the simulation, with the timing of the SD
+ * library: one cached block, read or written back when another one is
+ * accessed, see SD.h.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <SD.h>
+#include "sim.h"
+#include "sim_sd.h"
+
+#define SIM_SD_BLOCK 512
+#define SIM_SD_CLUSTER_BLOCKS 64      // 32 KB clusters, as formatted for 1 to 2 GB
+
+struct SimSdEntry
+{
+  char name[13];                // 8.3, upper case
+  std::vector<uint8_t> data;
+  uint32_t firstBlock;          // Files are contiguous on the simulated card
+  bool dirty;                   // Size to write back in the directory
+};
+
+SDClass SD;
+static std::vector<SimSdEntry *> sEntries;
+static uint32_t sNextBlock = 1024;
+static const SimSdEntry *sCacheEntry = NULL;
+static uint32_t sCacheBlock = 0;
+static bool sCacheDirty = false;
+static uint8_t sBusy = 0;
+static SimSdStats sStats;
+
+/*
+ * A second access before the first one ends is a conflict on the SPI bus,
+ * e.g. an interrupt reading the card in the middle of a main loop write
+ */
+struct SimSdTransfer
+{
+  SimSdTransfer(void)
+  {
+    if (sBusy++)
+      sStats.conflicts++;
+  }
+  ~SimSdTransfer(void)
+  {
+    sBusy--;
+  }
+};
+
+static void toShortName(const char *aName, char *aShortName)
+{
+  while (*aName == '/')
+    aName++;
+  uint8_t i = 0;
+  for (; *aName && i < 12; aName++)
+    aShortName[i++] = toupper((unsigned char)*aName);
+  aShortName[i] = '\0';
+}
+
+static SimSdEntry *findEntry(const char *aName)
+{
+  char tName[13];
+  toShortName(aName, tName);
+  for (size_t i = 0; i < sEntries.size(); i++)
+    if (strcmp(sEntries[i]->name, tName) == 0)
+      return sEntries[i];
+  return NULL;
+}
+
+static SimSdEntry *createEntry(const char *aName)
+{
+  SimSdEntry *tEntry = new SimSdEntry;
+  toShortName(aName, tEntry->name);
+  tEntry->firstBlock = sNextBlock;
+  tEntry->dirty = false;
+  sNextBlock += 1 << 16;        // Room for 32 MB, no fragmentation
+  sEntries.push_back(tEntry);
+  return tEntry;
+}
+
+static void writeBack(void)
+{
+  if (!sCacheDirty)
+    return;
+  sCacheDirty = false;
+  sStats.blockWrites++;
+  simCharge(simCost.sdBlockWriteCycles);
+}
+
+/*
+ * Brings the block in the cache. aNoRead: to be written from its start
+ * beyond the end of the file, the old content is not needed
+ */
+static void cacheBlock(const SimSdEntry *aEntry, uint32_t aBlock, bool aNoRead)
+{
+  if (sCacheEntry == aEntry && sCacheBlock == aBlock)
+    return;
+  writeBack();
+  sCacheEntry = aEntry;
+  sCacheBlock = aBlock;
+  if (aNoRead)
+    return;
+  sStats.blockReads++;
+  simCharge(simCost.sdBlockReadCycles);
+}
+
+void simSdLoad(const char *aName, const uint8_t *aData, uint32_t aSize)
+{
+  SimSdEntry *tEntry = findEntry(aName);
+  if (tEntry == NULL)
+    tEntry = createEntry(aName);
+  tEntry->data.assign(aData, aData + aSize);
+}
+
+bool simSdSave(const char *aDirectory)
+{
+  for (size_t i = 0; i < sEntries.size(); i++)
+    {
+      std::string tPath = std::string(aDirectory) + "/" + sEntries[i]->name;
+      FILE *tFile = fopen(tPath.c_str(), "wb");
+      if (tFile == NULL)
+        return false;
+      fwrite(sEntries[i]->data.data(), 1, sEntries[i]->data.size(), tFile);
+      fclose(tFile);
+    }
+  return true;
+}
+
+bool simSdExists(const char *aName)
+{
+  return findEntry(aName) != NULL;
+}
+
+const SimSdStats &simSdGetStats(void)
+{
+  return sStats;
+}
+
+/********/
+/* File */
+/********/
+int File::read(void)
+{
+  uint8_t tByte;
+  return read(&tByte, 1) == 1 ? tByte : -1;
+}
+
+int File::read(void *aBuffer, uint16_t aSize)
+{
+  if (mEntry == NULL)
+    return -1;
+  SimSdTransfer tTransfer;
+  uint32_t tSize = mEntry->data.size();
+  uint16_t tCount = 0;
+  while (tCount < aSize && mPosition < tSize)
+    {
+      cacheBlock(mEntry, mEntry->firstBlock + mPosition / SIM_SD_BLOCK, false);
+      uint32_t tChunk = SIM_SD_BLOCK - mPosition % SIM_SD_BLOCK;
+      if (tChunk > (uint32_t)(aSize - tCount))
+        tChunk = aSize - tCount;
+      if (tChunk > tSize - mPosition)
+        tChunk = tSize - mPosition;
+      memcpy((uint8_t *)aBuffer + tCount, &mEntry->data[mPosition], tChunk);
+      simCharge(tChunk * simCost.sdByteCycles);
+      tCount += tChunk;
+      mPosition += tChunk;
+    }
+  sStats.bytesRead += tCount;
+  return tCount;
+}
+
+int File::peek(void)
+{
+  uint32_t tPosition = mPosition;
+  int tByte = read();
+  mPosition = tPosition;
+  return tByte;
+}
+
+int File::available(void)
+{
+  if (mEntry == NULL)
+    return 0;
+  uint32_t tLeft = mEntry->data.size() - mPosition;
+  return tLeft > 0x7FFF ? 0x7FFF : tLeft;
+}
+
+size_t File::write(const uint8_t *aBuffer, size_t aSize)
+{
+  if (mEntry == NULL)
+    return 0;
+  SimSdTransfer tTransfer;
+  size_t tCount = 0;
+  while (tCount < aSize)
+    {
+      uint32_t tOffset = mPosition % SIM_SD_BLOCK;
+      uint32_t tBlock = mPosition / SIM_SD_BLOCK;
+      if (tOffset == 0 && tBlock % SIM_SD_CLUSTER_BLOCKS == 0 && mPosition >= mEntry->data.size())
+        {
+          // New cluster: FAT block read and written back
+          sStats.blockReads++;
+          sStats.blockWrites++;
+          simCharge(simCost.sdBlockReadCycles + simCost.sdBlockWriteCycles);
+        }
+      cacheBlock(mEntry, mEntry->firstBlock + tBlock, tOffset == 0 && mPosition >= mEntry->data.size());
+      uint32_t tChunk = SIM_SD_BLOCK - tOffset;
+      if (tChunk > aSize - tCount)
+        tChunk = aSize - tCount;
+      if (mPosition + tChunk > mEntry->data.size())
+        mEntry->data.resize(mPosition + tChunk);
+      memcpy(&mEntry->data[mPosition], aBuffer + tCount, tChunk);
+      simCharge(tChunk * simCost.sdByteCycles);
+      sCacheDirty = true;
+      mEntry->dirty = true;
+      tCount += tChunk;
+      mPosition += tChunk;
+    }
+  sStats.bytesWritten += tCount;
+  return tCount;
+}
+
+// Data block and directory entry, like SdFile::sync()
+void File::flush(void)
+{
+  if (mEntry == NULL || !mEntry->dirty)
+    return;
+  SimSdTransfer tTransfer;
+  writeBack();
+  mEntry->dirty = false;
+  cacheBlock(NULL, 0, false);
+  sCacheDirty = true;
+  writeBack();
+}
+
+void File::close(void)
+{
+  flush();
+  mEntry = NULL;
+  mDirectory = false;
+}
+
+bool File::seek(uint32_t aPosition)
+{
+  if (mEntry == NULL || aPosition > mEntry->data.size())
+    return false;
+  mPosition = aPosition;
+  return true;
+}
+
+uint32_t File::size(void)
+{
+  return mEntry ? mEntry->data.size() : 0;
+}
+
+char *File::name(void)
+{
+  static char tRoot[] = "/";
+  return mEntry ? mEntry->name : tRoot;
+}
+
+File File::openNextFile(uint8_t)
+{
+  File tFile;
+  if (mDirectory && mNext < sEntries.size())
+    {
+      tFile.mEntry = sEntries[mNext++];
+      cacheBlock(NULL, 1 + mNext / 16, false);   // Directory, 16 entries per block
+    }
+  return tFile;
+}
+
+/***********/
+/* SDClass */
+/***********/
+bool SDClass::begin(uint8_t aChipSelectPin)
+{
+  return begin(F_CPU / 4, aChipSelectPin);
+}
+
+// Reset, voltage check and ACMD41 polling at 400 kHz, then the boot block,
+// the FAT parameters and the root directory
+bool SDClass::begin(uint32_t, uint8_t)
+{
+  simCharge(simCost.sdBlockReadCycles * 3 + 20000UL * SIM_CYCLES_PER_MICRO);
+  sStats.blockReads += 3;
+  return true;
+}
+
+File SDClass::open(const char *aName, uint8_t aMode)
+{
+  File tFile;
+  SimSdTransfer tTransfer;
+  simCharge(simCost.sdBlockReadCycles);   // Directory block
+  sStats.blockReads++;
+  if (strcmp(aName, "/") == 0)
+    {
+      tFile.mDirectory = true;
+      return tFile;
+    }
+  SimSdEntry *tEntry = findEntry(aName);
+  if (tEntry == NULL && (aMode & O_CREAT))
+    tEntry = createEntry(aName);
+  tFile.mEntry = tEntry;
+  if (tEntry && (aMode & O_TRUNC))
+    tEntry->data.clear();
+  if (tEntry && (aMode & O_APPEND))
+    tFile.mPosition = tEntry->data.size();
+  return tFile;
+}
+
+bool SDClass::exists(const char *aName)
+{
+  simCharge(simCost.sdBlockReadCycles);
+  sStats.blockReads++;
+  return findEntry(aName) != NULL;
+}
+
+bool SDClass::remove(const char *aName)
+{
+  for (size_t i = 0; i < sEntries.size(); i++)
+    if (sEntries[i] == findEntry(aName))
+      {
+        if (sCacheEntry == sEntries[i])
+          {
+            sCacheEntry = NULL;
+            sCacheDirty = false;
+          }
+        delete sEntries[i];
+        sEntries.erase(sEntries.begin() + i);
+        simCharge(simCost.sdBlockWriteCycles * 2);   // Directory entry and FAT
+        sStats.blockWrites += 2;
+        return true;
+      }
+  return false;
+}
@@ -0,0 +1,28 @@
+/**
+ * @file      sim_sd.h
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  Content and counters of the simulated card, see mock/SD.h.
+ */
+
+#ifndef SIM_SD_H_
+#define SIM_SD_H_
+
+#include <stdint.h>
+
+struct SimSdStats
+{
+  uint32_t blockReads;
+  uint32_t blockWrites;
+  uint64_t bytesRead;
+  uint64_t bytesWritten;
+  uint32_t conflicts;           // Card accessed again before the previous transfer ended
+};
+
+void simSdLoad(const char *aName, const uint8_t *aData, uint32_t aSize);
+bool simSdSave(const char *aDirectory);
+bool simSdExists(const char *aName);
+const SimSdStats &simSdGetStats(void);
+
+#endif // SIM_SD_H_
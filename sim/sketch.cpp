@@ -0,0 +1,13 @@
+/**
+ * @file      sketch.cpp
+ * @authors   Timothe PETITJEAN
+ * @copyright ESEO
+ *
+ * @brief  Blind_Guidance.ino as a translation unit, with the includes and
+ * the prototypes the Arduino builder adds.
+ */
+
+#include <Arduino.h>
+#include <SD.h>
+#include "sketch_prototypes.h"
+#include "../Blind_Guidance.ino"
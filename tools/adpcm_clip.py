@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+"""
+adpcm_clip.py - IMA-ADPCM clips for the ADPCM option of TMRpcm
+
+Encodes a mono PCM WAV file (8 or 16-bit) to 4-bit IMA-ADPCM, in blocks as
+decoded by pcmAdpcmSource (4 byte header with the first sample and the step
+index, then 2 samples per byte, low nibble first). Either as a WAV file
+(format 0x11) for the SD card, played by play(filename) once in the WAV
+index, or as a C header of PROGMEM data for a pcmAdpcmSource:
+
+    python3 adpcm_clip.py obstacle.wav OBSTACLE.WAV
+    python3 adpcm_clip.py obstacle.wav obstacle.h --name obstacle
+
+    #include "obstacle.h"
+    source.beginProgmem(pgm_get_far_address(obstacle), sizeof(obstacle), OBSTACLE_RATE, OBSTACLE_BLOCK);
+"""
+
+import argparse
+import struct
+import sys
+import wave
+
+STEPS = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+    12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+]  # Must match adpcmSteps in pcmSource.cpp
+INDEX = [-1, -1, -1, -1, 2, 4, 6, 8]
+
+
+def read_pcm(path):
+    """Samples as signed 16-bit values, and the sample rate."""
+    with wave.open(path, "rb") as wav:
+        if wav.getnchannels() != 1:
+            sys.exit("%s: mono files only" % path)
+        width = wav.getsampwidth()
+        frames = wav.readframes(wav.getnframes())
+        rate = wav.getframerate()
+    if width == 1:
+        return [(b - 128) << 8 for b in frames], rate
+    if width == 2:
+        return list(struct.unpack("<%dh" % (len(frames) // 2), frames)), rate
+    sys.exit("%s: 8 or 16-bit samples only" % path)
+
+
+def encode_sample(sample, predictor, index):
+    step = STEPS[index]
+    diff = sample - predictor
+    code = 0
+    if diff < 0:
+        code = 8
+        diff = -diff
+    # Same rounding as the decoder: step/8 + the selected halves
+    delta = step >> 3
+    if diff >= step:
+        code |= 4
+        diff -= step
+        delta += step
+    if diff >= step >> 1:
+        code |= 2
+        diff -= step >> 1
+        delta += step >> 1
+    if diff >= step >> 2:
+        code |= 1
+        delta += step >> 2
+    predictor = predictor - delta if code & 8 else predictor + delta
+    predictor = max(-32768, min(32767, predictor))
+    index = max(0, min(88, index + INDEX[code & 7]))
+    return code, predictor, index
+
+
+def encode(samples, block_align):
+    """IMA-ADPCM blocks of block_align bytes, the last one may be shorter."""
+    per_block = (block_align - 4) * 2 + 1
+    out = bytearray()
+    index = 0
+    for start in range(0, len(samples), per_block):
+        block = samples[start:start + per_block]
+        predictor = block[0]
+        out += struct.pack("<hBB", predictor, index, 0)
+        codes = []
+        for sample in block[1:]:
+            code, predictor, index = encode_sample(sample, predictor, index)
+            codes.append(code)
+        if len(codes) & 1:
+            codes.append(0)
+        for low, high in zip(codes[0::2], codes[1::2]):
+            out.append(low | high << 4)
+    return out, per_block
+
+
+def write_wav(path, data, rate, block_align, per_block, count):
+    fmt = struct.pack("<HHLLHHHH", 0x11, 1, rate, rate * block_align // per_block, block_align, 4, 2, per_block)
+    fact = struct.pack("<L", count)
+    body = (b"WAVE" + b"fmt " + struct.pack("<L", len(fmt)) + fmt + b"fact" + struct.pack("<L", len(fact)) + fact
+            + b"data" + struct.pack("<L", len(data)) + bytes(data) + (b"\0" if len(data) & 1 else b""))
+    with open(path, "wb") as out:
+        out.write(b"RIFF" + struct.pack("<L", len(body)) + body)
+
+
+def write_header(path, data, rate, block_align, name):
+    lines = ["// IMA-ADPCM clip, generated by tools/adpcm_clip.py", "#include <avr/pgmspace.h>", "",
+             "#define %s_RATE %d" % (name.upper(), rate), "#define %s_BLOCK %d" % (name.upper(), block_align),
+             "const byte %s[%d] PROGMEM = {" % (name, len(data))]
+    for i in range(0, len(data), 16):
+        lines.append("  " + ",".join("%d" % b for b in data[i:i + 16]) + ",")
+    lines.append("};")
+    with open(path, "w") as out:
+        out.write("\n".join(lines) + "\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", help="mono PCM WAV file")
+    parser.add_argument("output", help=".wav for the SD card, .h for PROGMEM")
+    parser.add_argument("--block", type=int, default=256, help="block size in bytes (default 256)")
+    parser.add_argument("--name", default="clip", help="array name in the .h output")
+    args = parser.parse_args()
+
+    samples, rate = read_pcm(args.input)
+    if not samples:
+        sys.exit("%s: no samples" % args.input)
+    data, per_block = encode(samples, args.block)
+    if args.output.lower().endswith(".h"):
+        write_header(args.output, data, rate, args.block, args.name)
+    else:
+        write_wav(args.output, data, rate, args.block, per_block, len(samples))
+    sys.stderr.write("%d samples, %d bytes (%.1f bits per sample)\n" % (len(samples), len(data),
+                                                                       8.0 * len(data) / len(samples)))
+
+
+if __name__ == "__main__":
+    main()
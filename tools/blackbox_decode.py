@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+"""
+blackbox_decode.py - CSV from the BLACKBOX.BIN log of Blind_Guidance
+
+The sketch, built with USE_BLACKBOX, appends one 16 byte record per radar
+sample to BLACKBOX.BIN on the SD card (see BlackBox.h). Records are found by
+their sync byte and checked with their XOR checksum, so the zero padding
+written at each boot is skipped. A new session starts where the time goes
+back, i.e. at each boot.
+
+    python3 blackbox_decode.py BLACKBOX.BIN > log.csv
+    python3 blackbox_decode.py --session 2 BLACKBOX.BIN   (only the 3rd boot)
+"""
+
+import argparse
+import struct
+import sys
+
+SYNC = 0xB5
+RECORD = struct.Struct("<BBHLHHHBB")  # Must match BlackBoxRecord
+AUDIO_PLAYING = 0x01
+AUDIO_PRIORITY_SHIFT = 4
+COLUMNS = "session,time_ms,raw_cm,cm,period_ms,playing,priority,alert,dropped"
+
+
+def checksum(record):
+    value = 0
+    for byte in record[:-1]:
+        value ^= byte
+    return value
+
+
+def records(data):
+    """Yields the valid records of the log, in file order."""
+    pos = 0
+    while True:
+        pos = data.find(bytes([SYNC]), pos)
+        if pos < 0 or pos + RECORD.size > len(data):
+            return
+        record = data[pos:pos + RECORD.size]
+        if checksum(record) != record[-1]:
+            pos += 1
+            continue
+        yield RECORD.unpack(record)
+        pos += RECORD.size
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("log", nargs="?", help="BLACKBOX.BIN, stdin if omitted")
+    parser.add_argument("--session", type=int, help="only this session, counted from 0")
+    args = parser.parse_args()
+
+    stream = open(args.log, "rb") if args.log else sys.stdin.buffer
+    session = 0
+    last_millis = None
+    last_sequence = None
+    dropped_total = 0
+    print(COLUMNS)
+    for _, alert, sequence, millis, raw, cm, period, audio, _ in records(stream.read()):
+        if last_millis is not None and millis < last_millis:
+            session += 1
+            last_sequence = None
+        last_millis = millis
+        dropped = 0
+        if last_sequence is not None:
+            dropped = (sequence - last_sequence - 1) & 0xFFFF
+        last_sequence = sequence
+        if args.session is not None and session != args.session:
+            continue
+        dropped_total += dropped
+        print("%d,%d,%d,%d,%d,%d,%d,%d,%d" % (session, millis, raw, cm, period, audio & AUDIO_PLAYING,
+                                              audio >> AUDIO_PRIORITY_SHIFT, alert, dropped))
+    sys.stderr.write("sessions: %d, records dropped: %d\n" % (session + 1, dropped_total))
+
+
+if __name__ == "__main__":
+    main()
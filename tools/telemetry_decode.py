@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""
+telemetry_decode.py - CSV from the binary telemetry frames of Blind_Guidance
+
+The sketch, built with USE_TELEMETRY, sends one 16 byte frame per radar
+sample (see Telemetry.h). Frames are found by their sync byte and checked
+with their XOR checksum, so text lines and trace dumps in the same capture
+are skipped.
+
+    python3 telemetry_decode.py walk.bin > walk.csv
+    python3 telemetry_decode.py --port /dev/ttyACM0   (needs pyserial, Ctrl-C to stop)
+"""
+
+import argparse
+import struct
+import sys
+
+SYNC = 0xA5
+FRAME = struct.Struct("<BBLHHHBBBB")  # Must match TelemetryFrame
+AUDIO_PLAYING = 0x01
+AUDIO_PRIORITY_SHIFT = 4
+COLUMNS = "time_ms,raw_cm,cm,period_ms,playing,priority,decimation,sleep_percent,lost"
+
+
+def checksum(frame):
+    value = 0
+    for byte in frame[:-1]:
+        value ^= byte
+    return value
+
+
+class Decoder:
+    def __init__(self):
+        self.data = bytearray()
+        self.last_sequence = None
+        self.lost = 0
+
+    def feed(self, chunk):
+        """Yields the CSV lines of the complete frames received so far."""
+        self.data += chunk
+        pos = 0
+        while True:
+            pos = self.data.find(bytes([SYNC]), pos)
+            if pos < 0 or pos + FRAME.size > len(self.data):
+                break
+            frame = self.data[pos:pos + FRAME.size]
+            if checksum(frame) != frame[-1]:
+                pos += 1
+                continue
+            _, sequence, millis, raw, cm, period, audio, decimation, sleep, _ = FRAME.unpack(frame)
+            lost = 0
+            if self.last_sequence is not None:
+                lost = (sequence - self.last_sequence - 1) & 0xFF
+            self.last_sequence = sequence
+            self.lost += lost
+            yield "%d,%d,%d,%d,%d,%d,%d,%d,%d" % (millis, raw, cm, period, audio & AUDIO_PLAYING,
+                                                  audio >> AUDIO_PRIORITY_SHIFT, decimation, sleep, lost)
+            pos += FRAME.size
+        # Keep the tail, a frame may be incomplete
+        if pos < 0:
+            pos = len(self.data)
+        del self.data[:pos]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("capture", nargs="?", help="raw serial capture, stdin if omitted")
+    parser.add_argument("--port", help="read from this serial port instead")
+    args = parser.parse_args()
+
+    decoder = Decoder()
+    print(COLUMNS)
+    if args.port:
+        import serial  # pyserial
+        with serial.Serial(args.port, 115200, timeout=0.1) as link:
+            try:
+                while True:
+                    for line in decoder.feed(link.read(256)):
+                        print(line, flush=True)
+            except KeyboardInterrupt:
+                pass
+    else:
+        stream = open(args.capture, "rb") if args.capture else sys.stdin.buffer
+        for line in decoder.feed(stream.read()):
+            print(line)
+    sys.stderr.write("samples not received (decimated or dropped): %d\n" % decoder.lost)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+"""
+trace_decode.py - Latency breakdown from the pcmTrace dumps of Blind_Guidance
+
+Build with ENABLE_TRACE in TMRpcm-1.2.3/pcmConfig.h. Each 't' sent to the
+board dumps the trace ring in binary ('T', 'R', count, count * 6 byte records)
+between the usual text lines. Log the raw serial output to a file during a
+walk, sending 't' often enough (the ring holds TRACE_SIZE records), then:
+
+    python3 trace_decode.py walk.bin
+    python3 trace_decode.py --port /dev/ttyACM0 --seconds 60   (needs pyserial)
+
+For every first PWM sample, the chain of events that led to it is searched
+backwards: echo -> radar result -> alert -> play -> header -> ramp -> sound.
+The vibration pulses (USE_HAPTIC) are matched to their echo the same way.
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+# Must match pcmTrace.h and Blind_Guidance.ino
+EVENTS = {
+    1: "us_trigger",
+    2: "us_echo",
+    8: "play",
+    9: "header",
+    10: "ramp",
+    11: "first_sample",
+    32: "radar_result",
+    33: "alert",
+    34: "haptic",
+}
+CHAIN = ["us_echo", "radar_result", "alert", "play", "header", "ramp", "first_sample"]
+RECORD = struct.Struct("<BBL")
+
+
+def parse_dumps(data):
+    """Yields (name, arg, micros) of all dumps found in a raw serial capture."""
+    pos = 0
+    while True:
+        pos = data.find(b"TR", pos)
+        if pos < 0 or pos + 3 > len(data):
+            return
+        count = data[pos + 2]
+        end = pos + 3 + count * RECORD.size
+        if end > len(data):
+            pos += 2
+            continue
+        records = [RECORD.unpack_from(data, pos + 3 + i * RECORD.size) for i in range(count)]
+        # A 'TR' inside the text lines gives unknown ids, skip it
+        if all(r[0] in EVENTS for r in records):
+            for event_id, arg, micros in records:
+                yield EVENTS[event_id], arg, micros
+            pos = end
+        else:
+            pos += 2
+
+
+def unwrap(records):
+    """micros() wraps after 71 minutes, make the times monotonic."""
+    offset = 0
+    last = None
+    for name, arg, micros in records:
+        if last is not None and micros + offset < last - (1 << 31):
+            offset += 1 << 32
+        last = micros + offset
+        yield name, arg, last
+
+
+def find_chains(records):
+    chains = []
+    for i, (name, _, _) in enumerate(records):
+        if name != "first_sample":
+            continue
+        chain = {"first_sample": records[i][2]}
+        step = len(CHAIN) - 1
+        for j in range(i - 1, -1, -1):
+            other = records[j][0]
+            if other == "first_sample":
+                break  # Belongs to the previous sound
+            # Stages may be missing, e.g. no header for a clip in memory
+            if other in CHAIN and CHAIN.index(other) < step:
+                step = CHAIN.index(other)
+                chain[other] = records[j][2]
+                if step == 0:
+                    break
+        chains.append(chain)
+    return chains
+
+
+def find_haptic(records):
+    """echo -> haptic delays (us), the pulse starts in the radar task."""
+    delays = []
+    echo = None
+    for name, _, micros in records:
+        if name == "us_echo":
+            echo = micros
+        elif name == "haptic" and echo is not None:
+            delays.append(micros - echo)
+    return delays
+
+
+def percentile(values, p):
+    values = sorted(values)
+    if not values:
+        return float("nan")
+    k = (len(values) - 1) * p / 100.0
+    lo = int(k)
+    hi = min(lo + 1, len(values) - 1)
+    return values[lo] + (values[hi] - values[lo]) * (k - lo)
+
+
+def report(chains, haptic):
+    print("%-28s %6s %10s %10s %10s" % ("stage (ms)", "n", "p50", "p99", "max"))
+    for a, b in zip(CHAIN, CHAIN[1:]):
+        deltas = [(c[b] - c[a]) / 1000.0 for c in chains if a in c and b in c]
+        if not deltas:
+            continue
+        print("%-28s %6d %10.2f %10.2f %10.2f" % (a + " -> " + b, len(deltas),
+              percentile(deltas, 50), percentile(deltas, 99), max(deltas)))
+    total = [(c["first_sample"] - c["us_echo"]) / 1000.0 for c in chains if "us_echo" in c]
+    if total:
+        print("%-28s %6d %10.2f %10.2f %10.2f" % ("echo -> sound (end to end)", len(total),
+              percentile(total, 50), percentile(total, 99), max(total)))
+    else:
+        print("No complete chain, dump more often or raise TRACE_SIZE")
+    if haptic:
+        haptic = [d / 1000.0 for d in haptic]
+        print("%-28s %6d %10.2f %10.2f %10.2f" % ("echo -> haptic", len(haptic),
+              percentile(haptic, 50), percentile(haptic, 99), max(haptic)))
+
+
+def capture(port, seconds):
+    import serial  # pyserial
+    data = bytearray()
+    with serial.Serial(port, 115200, timeout=0.1) as link:
+        end = time.time() + seconds
+        while time.time() < end:
+            link.write(b"t")
+            data += link.read(4096)
+            time.sleep(0.5)
+    return bytes(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("capture", nargs="?", help="raw serial capture, stdin if omitted")
+    parser.add_argument("--port", help="capture from this serial port instead")
+    parser.add_argument("--seconds", type=float, default=30, help="capture time with --port")
+    parser.add_argument("--raw", action="store_true", help="print the decoded records")
+    args = parser.parse_args()
+
+    if args.port:
+        data = capture(args.port, args.seconds)
+    elif args.capture:
+        with open(args.capture, "rb") as f:
+            data = f.read()
+    else:
+        data = sys.stdin.buffer.read()
+
+    records = list(unwrap(parse_dumps(data)))
+    if args.raw:
+        for name, arg, micros in records:
+            print("%12d %-14s %3d" % (micros, name, arg))
+    report(find_chains(records), find_haptic(records))
+
+
+if __name__ == "__main__":
+    main()